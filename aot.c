@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdint.h>
+
+#include "helper.h"
+#include "program.h"
+#include "cfg.h"
+#include "aot.h"
+#include "opcodes.h"
+
+// True if the VM's program-flow check (OP_SLT to OP_JAL) rejects this
+// instruction at pc, in which case the translation defers to vm_step
+static int flow_check_fails(int pc, const struct decoded_instruction *inst) {
+    if (inst->operation < OP_SLT || inst->operation > OP_JAL) {
+        return 0;
+    }
+    return pc + inst->imm < 0 || pc + inst->imm > INST_MEM_SIZE || inst->imm % 4 != 0;
+}
+
+// Hands the instruction at pc to the interpreter, then continues at pc + 4
+static void emit_runtime_call(FILE *out, int pc) {
+    fprintf(out, "    vm->pc = %d;\n", pc);
+    fprintf(out, "    status = vm_step(vm);\n");
+    fprintf(out, "    if (status != VM_RUNNING) return status;\n");
+    fprintf(out, "    goto L_%d;\n", pc + 4);
+}
+
+// Writes the C expression for the result of an ALU or RV32M operation
+// to result. Returns 0 for any other operation
+static int alu_expression(char *result, size_t size, const struct decoded_instruction *inst) {
+    int rs1 = inst->rs1, rs2 = inst->rs2, imm = inst->imm;
+    switch (inst->operation) {
+        case OP_ADD: snprintf(result, size, "(int32_t)((uint32_t)R[%d] + (uint32_t)R[%d])", rs1, rs2); break;
+        case OP_ADDI: snprintf(result, size, "(int32_t)((uint32_t)R[%d] + (uint32_t)%d)", rs1, imm); break;
+        case OP_SUB: snprintf(result, size, "(int32_t)((uint32_t)R[%d] - (uint32_t)R[%d])", rs1, rs2); break;
+        case OP_LUI: snprintf(result, size, "%d", imm); break;
+        case OP_XOR: snprintf(result, size, "R[%d] ^ R[%d]", rs1, rs2); break;
+        case OP_XORI: snprintf(result, size, "R[%d] ^ %d", rs1, imm); break;
+        case OP_OR: snprintf(result, size, "R[%d] | R[%d]", rs1, rs2); break;
+        case OP_ORI: snprintf(result, size, "R[%d] | %d", rs1, imm); break;
+        case OP_AND: snprintf(result, size, "R[%d] & R[%d]", rs1, rs2); break;
+        case OP_ANDI: snprintf(result, size, "R[%d] & %d", rs1, imm); break;
+        case OP_SLL: snprintf(result, size, "(int32_t)((uint32_t)R[%d] << (R[%d] & 0x1F))", rs1, rs2); break;
+        case OP_SRL: snprintf(result, size, "(int32_t)((uint32_t)R[%d] >> (R[%d] & 0x1F))", rs1, rs2); break;
+        case OP_SRA: snprintf(result, size, "R[%d] >> (R[%d] & 0x1F)", rs1, rs2); break;
+        case OP_SLT: snprintf(result, size, "R[%d] < R[%d]", rs1, rs2); break;
+        case OP_SLTI: snprintf(result, size, "R[%d] < %d", rs1, imm); break;
+        case OP_SLTU: snprintf(result, size, "(uint32_t)R[%d] < (uint32_t)R[%d]", rs1, rs2); break;
+        case OP_SLTIU: snprintf(result, size, "(uint32_t)R[%d] < %uu", rs1, (uint32_t)imm); break;
+        case OP_MUL: snprintf(result, size, "(int32_t)((uint32_t)R[%d] * (uint32_t)R[%d])", rs1, rs2); break;
+        case OP_MULH: snprintf(result, size, "(int32_t)(((int64_t)R[%d] * R[%d]) >> 32)", rs1, rs2); break;
+        case OP_MULHSU: snprintf(result, size, "(int32_t)(((int64_t)R[%d] * (int64_t)(uint32_t)R[%d]) >> 32)", rs1, rs2); break;
+        case OP_MULHU: snprintf(result, size, "(int32_t)(((uint64_t)(uint32_t)R[%d] * (uint32_t)R[%d]) >> 32)", rs1, rs2); break;
+        case OP_DIV:
+            snprintf(result, size, "R[%d] == 0 ? -1 : (R[%d] == INT32_MIN && R[%d] == -1) ? INT32_MIN : R[%d] / R[%d]",
+                     rs2, rs1, rs2, rs1, rs2);
+            break;
+        case OP_DIVU: snprintf(result, size, "R[%d] == 0 ? -1 : (int32_t)((uint32_t)R[%d] / (uint32_t)R[%d])", rs2, rs1, rs2); break;
+        case OP_REM:
+            snprintf(result, size, "R[%d] == 0 ? R[%d] : (R[%d] == INT32_MIN && R[%d] == -1) ? 0 : R[%d] %% R[%d]",
+                     rs2, rs1, rs1, rs2, rs1, rs2);
+            break;
+        case OP_REMU: snprintf(result, size, "R[%d] == 0 ? R[%d] : (int32_t)((uint32_t)R[%d] %% (uint32_t)R[%d])", rs2, rs1, rs1, rs2); break;
+        default:
+            return 0;
+    }
+    return 1;
+}
+
+// Bytes accessed by each load and store
+static const int access_sizes[OP_LIMIT] = {
+    [OP_LB] = 1, [OP_LH] = 2, [OP_LW] = 4, [OP_LBU] = 1, [OP_LHU] = 2,
+    [OP_SB] = 1, [OP_SH] = 2, [OP_SW] = 4,
+};
+
+// Data memory accesses at a known address are inlined when they fit in
+// data memory (the interpreter's helpers do not check the last bytes)
+static int data_access_fits(const struct decoded_instruction *inst, int address) {
+    return address - 0x0400 + access_sizes[inst->operation] <= DATA_MEM_SIZE;
+}
+
+static void emit_data_access(FILE *out, const struct decoded_instruction *inst, int address) {
+    int op = inst->operation;
+    int offset = address - 0x0400;
+    if (op <= OP_LHU && inst->rd == 0) {
+        return;
+    }
+    switch (op) {
+        case OP_LB: fprintf(out, "    R[%d] = (int8_t)D[%d];\n", inst->rd, offset); break;
+        case OP_LH: fprintf(out, "    R[%d] = (int16_t)(D[%d] | D[%d] << 8);\n", inst->rd, offset, offset + 1); break;
+        case OP_LW:
+            fprintf(out, "    R[%d] = (int32_t)((uint32_t)D[%d] | (uint32_t)D[%d] << 8 | (uint32_t)D[%d] << 16 | (uint32_t)D[%d] << 24);\n",
+                    inst->rd, offset, offset + 1, offset + 2, offset + 3);
+            break;
+        case OP_LBU: fprintf(out, "    R[%d] = D[%d];\n", inst->rd, offset); break;
+        case OP_LHU: fprintf(out, "    R[%d] = (uint16_t)(D[%d] | D[%d] << 8);\n", inst->rd, offset, offset + 1); break;
+        case OP_SB: fprintf(out, "    D[%d] = (uint8_t)R[%d];\n", offset, inst->rs2); break;
+        case OP_SH:
+        case OP_SW:
+            for (int i = 0; i < access_sizes[op]; i++) {
+                fprintf(out, "    D[%d] = (uint8_t)((uint32_t)R[%d] >> %d);\n", offset + i, inst->rs2, i * 8);
+            }
+            break;
+    }
+    // the lines written, for vm_reset (see vm_mark_data)
+    if (op >= OP_SB) {
+        int last = offset + access_sizes[op] - 1;
+        uint32_t lines = (uint32_t)(((uint64_t)2 << (last / DIRTY_LINE_SIZE)) - ((uint64_t)1 << (offset / DIRTY_LINE_SIZE)));
+        fprintf(out, "    vm->dirty_lines |= 0x%xu;\n", lines);
+    }
+}
+
+// The condition of a branch, NULL for any other operation
+static const char *branch_condition(int operation) {
+    switch (operation) {
+        case OP_BEQ: return "R[%d] == R[%d]";
+        case OP_BNE: return "R[%d] != R[%d]";
+        case OP_BLT: return "R[%d] < R[%d]";
+        case OP_BLTU: return "(uint32_t)R[%d] < (uint32_t)R[%d]";
+        case OP_BGE: return "R[%d] >= R[%d]";
+        case OP_BGEU: return "(uint32_t)R[%d] >= (uint32_t)R[%d]";
+    }
+    return NULL;
+}
+
+void aot_translate(const struct program *prog, FILE *out) {
+    fprintf(out, "/* Generated by riskxvii-aot, do not edit */\n");
+    fprintf(out, "#include <stdint.h>\n\n");
+    fprintf(out, "#include \"vm.h\"\n\n");
+    fprintf(out, "// Returns to the caller at a block boundary once the instruction budget is spent\n");
+    fprintf(out, "#define YIELD(next) if (vm->instret >= vm->instret_limit) { vm->pc = (next); return VM_RUNNING; }\n\n");
+    fprintf(out, "const uint64_t riskxvii_aot_inst_hash = 0x%016llxull;\n\n",
+            (unsigned long long)prog->inst_hash);
+    fprintf(out, "int riskxvii_aot_run(struct vm *vm) {\n");
+    fprintf(out, "    int32_t *R = (int32_t *)vm->reg_bank;\n");
+    fprintf(out, "    uint8_t *D = (uint8_t *)vm->blob->data_mem;\n");
+    fprintf(out, "    int32_t target;\n");
+    fprintf(out, "    int status;\n\n");
+
+    // Entry and jalr targets are only known at run time. The code of a
+    // block relies on the optimiser's view of it from its start, so other
+    // targets are stepped through by the interpreter
+    const struct cfg *cfg = &prog->cfg;
+    fprintf(out, "dispatch:\n");
+    fprintf(out, "    YIELD(vm->pc);\n");
+    fprintf(out, "    switch (vm->pc) {\n");
+    for (int i = 0; i < cfg->num_blocks; i++) {
+        fprintf(out, "        case %d: goto L_%d;\n", cfg->blocks[i].start_pc, cfg->blocks[i].start_pc);
+    }
+    fprintf(out, "        default:\n");
+    fprintf(out, "            if (vm->pc >= %d) return VM_FINISHED;\n", INST_MEM_SIZE);
+    fprintf(out, "            // inside a block, unaligned or negative pc\n");
+    fprintf(out, "            status = vm_step(vm);\n");
+    fprintf(out, "            if (status != VM_RUNNING) return status;\n");
+    fprintf(out, "            goto dispatch;\n");
+    fprintf(out, "    }\n\n");
+
+    for (int pc = 0; pc < INST_MEM_SIZE; pc += 4) {
+        const struct decoded_instruction *inst = &cfg->insts[pc / 4];
+        const struct block_hint *hint = &cfg->hints[pc / 4];
+        int op = inst->operation;
+        fprintf(out, "L_%d: /* %08x */\n", pc, (uint32_t)prog->raw[pc / 4]);
+
+        if (hint->kind == HINT_DEAD) {
+            fprintf(out, "    vm->instret++;\n");
+            continue;
+        }
+        if (hint->kind == HINT_DATA && data_access_fits(inst, hint->address)) {
+            fprintf(out, "    vm->instret++;\n");
+            emit_data_access(out, inst, hint->address);
+            continue;
+        }
+
+        // rejected control flow
+        if (flow_check_fails(pc, inst)) {
+            emit_runtime_call(out, pc);
+            continue;
+        }
+
+        // memory accesses, atomics and unknown instructions are left to
+        // the interpreter, as is any operation not translated below
+        char result[160];
+        int alu = alu_expression(result, sizeof(result), inst);
+        const char *condition = branch_condition(op);
+        if (!alu && condition == NULL && op != OP_JAL && op != OP_JALR) {
+            emit_runtime_call(out, pc);
+            continue;
+        }
+
+        fprintf(out, "    vm->instret++;\n");
+        if (alu) {
+            // writes to x0 are discarded
+            if (inst->rd != 0) {
+                fprintf(out, "    R[%d] = %s;\n", inst->rd, result);
+            }
+            fprintf(out, "    goto L_%d;\n", pc + 4);
+        } else if (condition != NULL) {
+            fprintf(out, "    target = (");
+            fprintf(out, condition, inst->rs1, inst->rs2);
+            fprintf(out, ") ? %d : %d;\n", pc + inst->imm, pc + 4);
+            fprintf(out, "    YIELD(target);\n");
+            fprintf(out, "    if (target == %d) goto L_%d;\n", pc + inst->imm, pc + inst->imm);
+            fprintf(out, "    goto L_%d;\n", pc + 4);
+        } else if (op == OP_JAL) {
+            if (inst->rd != 0) {
+                fprintf(out, "    R[%d] = %d;\n", inst->rd, pc + 4);
+            }
+            fprintf(out, "    YIELD(%d);\n", pc + inst->imm);
+            fprintf(out, "    goto L_%d;\n", pc + inst->imm);
+        } else {
+            fprintf(out, "    target = R[%d] + %d;\n", inst->rs1, inst->imm);
+            if (inst->rd != 0) {
+                fprintf(out, "    R[%d] = %d;\n", inst->rd, pc + 4);
+            }
+            fprintf(out, "    vm->pc = target;\n");
+            fprintf(out, "    goto dispatch;\n");
+        }
+    }
+
+    // Falling off the end of instruction memory
+    fprintf(out, "L_%d:\n", INST_MEM_SIZE);
+    fprintf(out, "    vm->pc = %d;\n", INST_MEM_SIZE);
+    fprintf(out, "    return VM_FINISHED;\n");
+    fprintf(out, "}\n");
+}
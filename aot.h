@@ -0,0 +1,45 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <stdint.h>
+
+#include "program.h"
+#include "vm.h"
+
+/*
+    Ahead-of-time translated images.
+
+    riskxvii-aot turns a .mi image into C source with one label per pc,
+    direct gotos for statically known branch targets and a switch on the
+    block starts of the program's control-flow graph only after jalr.
+    The code is that of the graph's optimised blocks: dead writes are
+    dropped and data memory accesses at known addresses are inlined.
+    Any other memory access, and any instruction the VM would reject,
+    calls back into vm_step, so behaviour matches the interpreter exactly. Every branch, jump and dispatch checks
+    vm->instret_limit, so a caller can run it a block at a time. The
+    source is compiled into a shared object exporting the symbols
+    below, which the VM loads with --aot.
+*/
+
+#define AOT_RUN_SYMBOL "riskxvii_aot_run"
+#define AOT_HASH_SYMBOL "riskxvii_aot_inst_hash"
+
+struct aot_module {
+    void *handle;
+    int (*run)(struct vm *vm);      // runs from vm->pc, returns a vm status
+};
+
+// Error codes returned by aot_load
+#define AOT_OK 0
+#define AOT_OPEN_FAILED 1
+#define AOT_IMAGE_MISMATCH 2    // translated from a different image
+
+// Loads the shared object at path, checking it was built from prog
+int aot_load(struct aot_module *mod, const char *path, const struct program *prog);
+
+void aot_unload(struct aot_module *mod);
+
+// Writes the C translation of prog to out
+void aot_translate(const struct program *prog, FILE *out);
+
+#endif // AOT_H
@@ -0,0 +1,32 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <dlfcn.h>
+
+#include "program.h"
+#include "vm.h"
+#include "aot.h"
+
+int aot_load(struct aot_module *mod, const char *path, const struct program *prog) {
+    mod->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (mod->handle == NULL) {
+        return AOT_OPEN_FAILED;
+    }
+    const uint64_t *hash = (const uint64_t *)dlsym(mod->handle, AOT_HASH_SYMBOL);
+    *(void **)(&mod->run) = dlsym(mod->handle, AOT_RUN_SYMBOL);
+    if (mod->run == NULL || hash == NULL) {
+        dlclose(mod->handle);
+        return AOT_OPEN_FAILED;
+    }
+    if (*hash != prog->inst_hash) {
+        dlclose(mod->handle);
+        return AOT_IMAGE_MISMATCH;
+    }
+    return AOT_OK;
+}
+
+void aot_unload(struct aot_module *mod) {
+    if (mod->handle != NULL) {
+        dlclose(mod->handle);
+        mod->handle = NULL;
+    }
+}
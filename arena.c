@@ -0,0 +1,159 @@
+#define _GNU_SOURCE     // CPU affinity
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+
+// The parts of libnuma used, loaded once by load_numa
+struct numa_api {
+    int available;
+    int (*node_of_cpu)(int cpu);
+    void (*tonode_memory)(void *start, size_t size, int node);
+};
+
+static struct numa_api numa;
+static pthread_once_t numa_once = PTHREAD_ONCE_INIT;
+
+static void load_numa(void) {
+    void *handle = dlopen("libnuma.so.1", RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) {
+        return;
+    }
+    int (*numa_available)(void);
+    *(void **)(&numa_available) = dlsym(handle, "numa_available");
+    *(void **)(&numa.node_of_cpu) = dlsym(handle, "numa_node_of_cpu");
+    *(void **)(&numa.tonode_memory) = dlsym(handle, "numa_tonode_memory");
+    // numa_available must be called before any other function
+    if (numa_available == NULL || numa.node_of_cpu == NULL || numa.tonode_memory == NULL ||
+        numa_available() < 0)
+    {
+        dlclose(handle);
+        return;
+    }
+    // kept loaded for the life of the process
+    numa.available = 1;
+}
+
+int arena_numa_available(void) {
+    pthread_once(&numa_once, load_numa);
+    return numa.available;
+}
+
+int arena_node_of_cpu(int cpu) {
+    return cpu >= 0 && arena_numa_available() ? numa.node_of_cpu(cpu) : -1;
+}
+
+// Whether the kernel backs MADV_HUGEPAGE regions with transparent huge
+// pages, "always" or "madvise" in its setting
+static int thp_enabled(void) {
+    FILE *f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+    if (f == NULL) {
+        return 0;
+    }
+    char setting[64] = {0};
+    size_t n = fread(setting, 1, sizeof(setting) - 1, f);
+    fclose(f);
+    setting[n] = '\0';
+    return strstr(setting, "[always]") != NULL || strstr(setting, "[madvise]") != NULL;
+}
+
+// A plain mapping of size bytes (a multiple of ARENA_HUGE_PAGE) starting
+// on a huge page boundary, so transparent huge pages can back all of it
+static void *map_aligned(size_t size) {
+    char *p = (char *)mmap(NULL, size + ARENA_HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return MAP_FAILED;
+    }
+    size_t head = (ARENA_HUGE_PAGE - (uintptr_t)p % ARENA_HUGE_PAGE) % ARENA_HUGE_PAGE;
+    if (head > 0) {
+        munmap(p, head);
+    }
+    munmap(p + head + size, ARENA_HUGE_PAGE - head);
+    return p + head;
+}
+
+int arena_init(struct arena *a, int slots, int node) {
+    a->slot_size = (sizeof(struct vm_context) + VM_CACHE_LINE - 1) & ~(size_t)(VM_CACHE_LINE - 1);
+    a->slots = slots;
+    a->size = (slots * a->slot_size + ARENA_HUGE_PAGE - 1) & ~(size_t)(ARENA_HUGE_PAGE - 1);
+
+    a->pages = ARENA_HUGETLB;
+    void *base = mmap(NULL, a->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (base == MAP_FAILED) {
+        // no huge pages reserved, ask for transparent ones
+        base = map_aligned(a->size);
+        if (base == MAP_FAILED) {
+            return 1;
+        }
+        a->pages = madvise(base, a->size, MADV_HUGEPAGE) == 0 && thp_enabled() ? ARENA_THP : ARENA_PLAIN;
+    }
+    a->base = (char *)base;
+
+    a->node = -1;
+    if (arena_numa_available()) {
+        int cpu = sched_getcpu();
+        a->node = node >= 0 ? node : cpu >= 0 ? numa.node_of_cpu(cpu) : -1;
+        if (a->node >= 0) {
+            numa.tonode_memory(a->base, a->size, a->node);
+        }
+    }
+    // fault the slots in now, from this thread (first touch)
+    long page = sysconf(_SC_PAGESIZE);
+    for (size_t offset = 0; offset < slots * a->slot_size; offset += page) {
+        a->base[offset] = 0;
+    }
+
+    a->free_slots = (int *)malloc(slots * sizeof(int));
+    a->num_free = slots;
+    for (int i = 0; i < slots; i++) {
+        a->free_slots[i] = slots - 1 - i;
+    }
+    pthread_mutex_init(&a->lock, NULL);
+    return 0;
+}
+
+struct vm_context *arena_alloc(struct arena *a) {
+    pthread_mutex_lock(&a->lock);
+    struct vm_context *ctx = NULL;
+    if (a->num_free > 0) {
+        ctx = (struct vm_context *)(a->base + a->free_slots[--a->num_free] * a->slot_size);
+    }
+    pthread_mutex_unlock(&a->lock);
+    return ctx;
+}
+
+void arena_release(struct arena *a, struct vm_context *ctx) {
+    pthread_mutex_lock(&a->lock);
+    a->free_slots[a->num_free++] = (int)(((char *)ctx - a->base) / a->slot_size);
+    pthread_mutex_unlock(&a->lock);
+}
+
+void arena_free(struct arena *a) {
+    munmap(a->base, a->size);
+    free(a->free_slots);
+    pthread_mutex_destroy(&a->lock);
+}
+
+int arena_pin_thread(int index) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0) {
+        return -1;
+    }
+    int n = index % CPU_COUNT(&allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && n-- == 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0 ? cpu : -1;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,66 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include "vm.h"
+
+/*
+    Slab arenas of vm_contexts (see vm.h), for running many instances at
+    once. An arena is one mapping of fixed-size slots, each a whole
+    instance's state, cache-line aligned and side by side, so instances
+    do not share lines and a few pages cover many of them.
+
+    The mapping is backed by huge pages where the host has them: first
+    explicit ones (MAP_HUGETLB), then transparent ones (MADV_HUGEPAGE on
+    a huge page aligned mapping, when the kernel's setting allows them),
+    otherwise plain pages. It is placed on a NUMA node through libnuma,
+    loaded with dlopen when present; without it the pages are touched
+    by the thread creating the arena, which the kernel's first-touch
+    policy places on that thread's node. Workers pinned with
+    arena_pin_thread that share an arena per node (arena_node_of_cpu)
+    get local memory either way.
+*/
+#define ARENA_HUGE_PAGE (2 << 20)
+
+#define ARENA_PLAIN 0           // normal pages
+#define ARENA_HUGETLB 1         // explicit huge pages
+#define ARENA_THP 2             // transparent huge pages advised
+
+struct arena {
+    char *base;
+    size_t size;                // of the mapping
+    size_t slot_size;           // sizeof(struct vm_context), rounded to a cache line
+    int slots;
+    int *free_slots;            // stack of free slot numbers
+    int num_free;
+    pthread_mutex_t lock;
+    int pages;                  // ARENA_PLAIN, ARENA_HUGETLB or ARENA_THP
+    int node;                   // NUMA node bound to by libnuma, -1 if first touch
+};
+
+// Maps an arena of slots contexts, on NUMA node node, or the calling
+// thread's if node is -1. Returns 1 if it cannot be mapped
+int arena_init(struct arena *a, int slots, int node);
+
+// A free slot, NULL if all are in use. Thread safe
+struct vm_context *arena_alloc(struct arena *a);
+
+// Returns ctx, from arena_alloc, to the arena. Thread safe
+void arena_release(struct arena *a, struct vm_context *ctx);
+
+// Unmaps the arena. Its contexts must no longer be in use
+void arena_free(struct arena *a);
+
+// Pins the calling thread to the index-th CPU (modulo their number) it
+// is allowed to run on. Returns the CPU, or -1 if it could not be pinned
+int arena_pin_thread(int index);
+
+// Whether libnuma could be loaded
+int arena_numa_available(void);
+
+// NUMA node of cpu, -1 if it is unknown or libnuma is not available
+int arena_node_of_cpu(int cpu);
+
+#endif // ARENA_H
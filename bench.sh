@@ -0,0 +1,59 @@
+#!/bin/bash
+
+# Runs every benchmark image in bench/ with each given binary (default: ./vm_riskxvii)
+# and reports the best MIPS out of several runs, plus the speedup over the first binary
+if [ $# -eq 0 ]; then
+    set -- ./vm_riskxvii
+fi
+bench_dir="bench"
+runs=3
+
+# Generated workloads (see gen.h): plain arithmetic, memory heavy and mixed
+gen_dir="$(mktemp -d)"
+trap 'rm -rf "${gen_dir}"' EXIT
+if [ -x ./riskxvii-gen ]; then
+    gen_flags="--seed 1 --iterations 1000 --repeat 100"
+    ./riskxvii-gen ${gen_flags} --mix 1,0,0,0,0 "${gen_dir}/gen_alu.mi"
+    ./riskxvii-gen ${gen_flags} --mix 2,3,3,0,1 "${gen_dir}/gen_memory.mi"
+    ./riskxvii-gen ${gen_flags} --mix 8,3,2,0,2 "${gen_dir}/gen_mixed.mi"
+fi
+
+# Best MIPS of a binary on one image, taken from its --stats output
+best_mips() {
+    local binary="$1" mi_file="$2" input_file="$3" best=0
+    for ((i = 0; i < runs; i++)); do
+        mips=$("${binary}" --stats "${mi_file}" < "${input_file}" 2>&1 > /dev/null | awk '/^MIPS:/ { print $2 }')
+        best=$(awk -v a="${mips:-0}" -v b="${best}" 'BEGIN { print (a > b) ? a : b }')
+    done
+    echo "${best}"
+}
+
+printf "%-24s" "image"
+for binary in "$@"; do
+    printf " %26s" "$(basename "${binary}")"
+done
+printf "\n"
+
+for mi_file in "${bench_dir}"/*.mi "${gen_dir}"/*.mi; do
+    if [ ! -f "${mi_file}" ]; then
+        continue
+    fi
+    filename="$(basename "${mi_file}" .mi)"
+    input_file="$(dirname "${mi_file}")/${filename}.in"
+    if [ ! -f "${input_file}" ]; then
+        input_file="/dev/null"
+    fi
+
+    printf "%-24s" "${filename}"
+    baseline=""
+    for binary in "$@"; do
+        mips=$(best_mips "${binary}" "${mi_file}" "${input_file}")
+        if [ -z "${baseline}" ]; then
+            baseline="${mips}"
+            printf " %15s MIPS      " "${mips}"
+        else
+            printf " %15s MIPS %4sx" "${mips}" "$(awk -v a="${mips}" -v b="${baseline}" 'BEGIN { printf "%.2f", (b > 0) ? a / b : 0 }')"
+        fi
+    done
+    printf "\n"
+done
@@ -0,0 +1,23 @@
+# Benchmark: register-only arithmetic, logic and branches (xorshift + checksum)
+  li t0, 0x800
+  li s0, 2000000       # iterations
+  li s1, 0x2545f491    # xorshift state
+  li s2, 0             # checksum
+  li t1, 13
+  li t2, 17
+  li t3, 5
+loop:
+  sll a0, s1, t1
+  xor s1, s1, a0
+  srl a0, s1, t2
+  xor s1, s1, a0
+  sll a0, s1, t3
+  xor s1, s1, a0
+  andi a1, s1, 0xff
+  add s2, s2, a1
+  sltu a2, s2, a1
+  sub s2, s2, a2
+  addi s0, s0, -1
+  bne s0, zero, loop
+  sw s2, 8(t0)
+  sw zero, 0x0c(t0)
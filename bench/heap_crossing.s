@@ -0,0 +1,20 @@
+# Benchmark: heap word/half loads and stores that straddle a bank boundary
+  li t0, 0x800
+  li a1, 128
+  sw a1, 0x30(t0)      # malloc(128), R[28] = base
+  li s0, 1000000       # iterations
+  li s1, 0
+loop:
+  lw a2, 62(t3)
+  addi a2, a2, 1
+  sw a2, 62(t3)
+  lw a3, 61(t3)
+  add a3, a3, a2
+  sw a3, 61(t3)
+  lhu a4, 63(t3)
+  add s1, s1, a4
+  sh a2, 63(t3)
+  addi s0, s0, -1
+  bne s0, zero, loop
+  sw s1, 8(t0)
+  sw zero, 0x0c(t0)
@@ -0,0 +1,16 @@
+# Benchmark: the same vector add as vadd_scalar through the 0x0844 routine
+  li t0, 0x800
+  li s0, 20000           # repetitions
+outer:
+  li a0, 0x600           # dst
+  li a1, 0x400           # src a
+  li a2, 0x500           # src b
+  li a3, 64              # elements
+  sw zero, 0x44(t0)
+  addi s0, s0, -1
+  bne s0, zero, outer
+  lw a4, 0x600(zero)
+  sw a4, 4(t0)
+  sw zero, 0x0c(t0)
+.data
+.word 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16
@@ -0,0 +1,25 @@
+# Benchmark: element-wise int32 vector add with an lw/add/sw loop
+  li t0, 0x800
+  li s0, 20000           # repetitions
+outer:
+  li a0, 0x600           # dst
+  li a1, 0x400           # src a
+  li a2, 0x500           # src b
+  li a3, 64              # elements
+inner:
+  lw a4, 0(a1)
+  lw a5, 0(a2)
+  add a4, a4, a5
+  sw a4, 0(a0)
+  addi a0, a0, 4
+  addi a1, a1, 4
+  addi a2, a2, 4
+  addi a3, a3, -1
+  bne a3, zero, inner
+  addi s0, s0, -1
+  bne s0, zero, outer
+  lw a4, 0x600(zero)
+  sw a4, 4(t0)
+  sw zero, 0x0c(t0)
+.data
+.word 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16
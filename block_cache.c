@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "helper.h"
+#include "program.h"
+#include "vm.h"
+#include "block_cache.h"
+#include "cfg.h"
+#include "metrics.h"
+#include "opcodes.h"
+
+#define REG_RA 1
+
+void block_cache_init(struct block_cache *bc, const struct program *prog) {
+    memset(bc, 0, sizeof(struct block_cache));
+    bc->program = prog;
+}
+
+void block_cache_free(struct block_cache *bc) {
+    for (int i = 0; i < NUM_INSTRUCTIONS; i++) {
+        struct block *b = bc->blocks[i];
+        if (b != NULL) {
+            if (b->private_copy) {
+                free((void *)b->insts);
+                free((void *)b->hints);
+            }
+            free(b);
+        }
+    }
+}
+
+static struct block *translate(struct block_cache *bc, int pc) {
+    const struct program *prog = bc->program;
+    const struct cfg_block *cb = cfg_block_at(&prog->cfg, pc);
+    struct block *b = (struct block *)calloc(1, sizeof(struct block));
+    b->start_pc = pc;
+    b->end_pc = cb->end_pc;
+    b->count = (cb->end_pc - pc) / 4 + 1;
+    b->terminator = cb->terminator;
+    b->taken_pc = cb->taken_pc;
+    b->raw = &prog->raw[pc / 4];
+
+    if (cb->start_pc == pc) {
+        b->insts = &prog->cfg.insts[pc / 4];
+        b->hints = &prog->cfg.hints[pc / 4];
+    } else {
+        // entered part way, so the graph's constants do not hold
+        struct decoded_instruction *insts = (struct decoded_instruction *)malloc(b->count * sizeof(struct decoded_instruction));
+        struct block_hint *hints = (struct block_hint *)malloc(b->count * sizeof(struct block_hint));
+        memcpy(insts, &prog->decoded[pc / 4], b->count * sizeof(struct decoded_instruction));
+        block_optimise(insts, hints, b->count, pc, &bc->opt);
+        b->insts = insts;
+        b->hints = hints;
+        b->private_copy = 1;
+    }
+
+    bc->blocks[pc / 4] = b;
+    return b;
+}
+
+// Returns the block starting at pc, NULL if pc cannot start a block
+static struct block *lookup(struct block_cache *bc, int pc) {
+    if (pc < 0 || pc >= INST_MEM_SIZE || pc % 4 != 0) {
+        return NULL;
+    }
+    bc->lookups++;
+    struct block *b = bc->blocks[pc / 4];
+    return b != NULL ? b : translate(bc, pc);
+}
+
+// Successor of a block ending in jalr: return-address stack first,
+// then the inline cache, then the block table
+static struct block *jalr_successor(struct block_cache *bc, struct block *b, const struct decoded_instruction *inst, int pc) {
+    bc->jalr_count++;
+    if (inst->rs1 == REG_RA && inst->rd == 0 && bc->ras_top > 0) {
+        struct return_address *ra = &bc->ras[--bc->ras_top % RAS_DEPTH];
+        if (ra->pc == pc && ra->block != NULL) {
+            bc->ras_hits++;
+            return ra->block;
+        }
+    }
+    for (int i = 0; i < JALR_CACHE_WAYS; i++) {
+        if (b->jalr_block[i] != NULL && b->jalr_pc[i] == pc) {
+            bc->jalr_cache_hits++;
+            return b->jalr_block[i];
+        }
+    }
+    struct block *target = lookup(bc, pc);
+    if (target != NULL) {
+        b->jalr_pc[b->jalr_next] = pc;
+        b->jalr_block[b->jalr_next] = target;
+        b->jalr_next = (b->jalr_next + 1) % JALR_CACHE_WAYS;
+    }
+    return target;
+}
+
+// Runs b, or a single instruction through the interpreter if pc cannot
+// start a block (an unaligned jalr target)
+static inline int execute(struct block_cache *bc, struct block *b, struct vm *vm) {
+    if (b == NULL) {
+        return vm_step(vm);
+    }
+    bc->blocks_executed++;
+    b->executions++;
+    return vm_run_block(vm, b->insts, b->raw, b->hints, b->count);
+}
+
+// Block to run after b, now that it has left the vm at pc
+static inline struct block *successor(struct block_cache *bc, struct block *b, int pc) {
+    if (b == NULL) {
+        return lookup(bc, pc);
+    }
+    const struct decoded_instruction *inst = &bc->program->decoded[b->end_pc / 4];
+    if (b->terminator == OP_JALR) {
+        return jalr_successor(bc, b, inst, pc);
+    }
+    if (b->terminator == OP_JAL && inst->rd == REG_RA) {
+        // a call, remember where the matching return will land
+        if (b->fallthrough == NULL) {
+            b->fallthrough = lookup(bc, b->end_pc + 4);
+        }
+        struct return_address *ra = &bc->ras[bc->ras_top++ % RAS_DEPTH];
+        ra->pc = b->end_pc + 4;
+        ra->block = b->fallthrough;
+    }
+    if (pc == b->taken_pc) {
+        if (b->taken == NULL) {
+            b->taken = lookup(bc, pc);
+        }
+        return b->taken;
+    }
+    if (b->fallthrough == NULL) {
+        b->fallthrough = lookup(bc, pc);
+    }
+    return b->fallthrough;
+}
+
+int block_cache_run(struct block_cache *bc, struct vm *vm) {
+    struct block *b = lookup(bc, vm->pc);
+    for (;;) {
+        int status = execute(bc, b, vm);
+        if (status != VM_RUNNING) {
+            bc->stopped = b;
+            return status;
+        }
+        b = successor(bc, b, vm->pc);
+    }
+}
+
+int block_cache_step(struct block_cache *bc, struct vm *vm) {
+    struct block *b = bc->next;
+    if (b == NULL || b->start_pc != vm->pc) {
+        b = lookup(bc, vm->pc);
+    }
+    int status = execute(bc, b, vm);
+    bc->next = status == VM_RUNNING ? successor(bc, b, vm->pc) : NULL;
+    return status;
+}
+
+void block_cache_count_classes(const struct block_cache *bc, const struct vm *vm, int status, uint64_t *classes) {
+    const struct decoded_instruction *decoded = bc->program->decoded;
+    for (int i = 0; i < NUM_INSTRUCTIONS; i++) {
+        const struct block *b = bc->blocks[i];
+        if (b == NULL || b->executions == 0) {
+            continue;
+        }
+        for (int j = 0; j < b->count; j++) {
+            classes[metrics_class(decoded[b->start_pc / 4 + j].operation)] += b->executions;
+        }
+    }
+    // the block the guest halted or failed in ran up to vm->pc
+    const struct block *b = bc->stopped;
+    if (b != NULL && status != VM_FINISHED && vm->pc >= b->start_pc && vm->pc <= b->end_pc) {
+        for (int pc = vm->pc + 4; pc <= b->end_pc; pc += 4) {
+            classes[metrics_class(decoded[pc / 4].operation)]--;
+        }
+    }
+}
+
+void block_cache_print_stats(const struct block_cache *bc) {
+    fprintf(stderr, "Blocks executed: %llu\n", (unsigned long long)bc->blocks_executed);
+    fprintf(stderr, "Block lookups: %llu\n", (unsigned long long)bc->lookups);
+    fprintf(stderr, "JALR: %llu (return-address stack hits %llu, inline cache hits %llu)\n",
+            (unsigned long long)bc->jalr_count,
+            (unsigned long long)bc->ras_hits,
+            (unsigned long long)bc->jalr_cache_hits);
+    const struct block_opt_stats *shared = &bc->program->cfg.opt;
+    fprintf(stderr, "Optimised: %d constants folded, %d dead writes, %d memory accesses resolved\n",
+            shared->folded + bc->opt.folded, shared->dead + bc->opt.dead, shared->resolved + bc->opt.resolved);
+}
@@ -0,0 +1,83 @@
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include <stdint.h>
+
+#include "program.h"
+#include "vm.h"
+#include "block_opt.h"
+
+#define JALR_CACHE_WAYS 4   // targets remembered per jalr
+#define RAS_DEPTH 32        // return-address stack entries
+
+/*
+    A basic block of the program's control-flow graph (see cfg.h), or its
+    tail when a jalr enters it part way. Successors are chained directly
+    once they have been seen, so only the first transfer to a block looks
+    it up.
+*/
+struct block {
+    int start_pc;
+    int count;                  // number of instructions
+    int end_pc;                 // pc of the last instruction
+    int terminator;             // operation number of the last instruction
+    int taken_pc;               // static target of a branch or jal, -1 otherwise
+    // optimised instructions, see block_opt.h: shared with the graph for
+    // blocks entered at their start, a private copy otherwise
+    const struct decoded_instruction *insts;
+    const int *raw;
+    const struct block_hint *hints;
+    char private_copy;
+    struct block *taken;
+    struct block *fallthrough;
+    // inline cache of a terminating jalr, keyed by its pc (i.e. this block)
+    int jalr_pc[JALR_CACHE_WAYS];
+    struct block *jalr_block[JALR_CACHE_WAYS];
+    int jalr_next;              // round-robin replacement
+    uint64_t executions;        // runs, complete or not
+};
+
+struct return_address {
+    int pc;
+    struct block *block;
+};
+
+struct block_cache {
+    const struct program *program;
+    struct block *blocks[NUM_INSTRUCTIONS];     // by start pc / 4
+    // pairs jal calls (rd = ra) with jalr returns (rs1 = ra, rd = zero)
+    struct return_address ras[RAS_DEPTH];
+    int ras_top;
+    struct block *next;         // successor chosen by the last block_cache_step
+    struct block *stopped;      // block the guest stopped in, see block_cache_run
+    // statistics
+    uint64_t blocks_executed;
+    uint64_t lookups;           // block table lookups for dynamic targets
+    uint64_t ras_hits;
+    uint64_t jalr_cache_hits;
+    uint64_t jalr_count;
+    struct block_opt_stats opt;     // private copies only
+};
+
+// Creates an empty cache for prog, blocks are translated on first use
+void block_cache_init(struct block_cache *bc, const struct program *prog);
+
+// Runs vm with the block engine until it stops, returns the vm status
+int block_cache_run(struct block_cache *bc, struct vm *vm);
+
+// Runs the block at vm->pc (or a single instruction if no block can
+// start there) and returns the vm status. Chaining and the return-address
+// stack work as in block_cache_run, this only hands control back in between
+int block_cache_step(struct block_cache *bc, struct vm *vm);
+
+// Adds the instructions executed by block_cache_run, by class (see
+// metrics.h), to classes. status is what it returned. Instructions run
+// outside a block, at pcs that cannot start one, are left out
+void block_cache_count_classes(const struct block_cache *bc, const struct vm *vm, int status, uint64_t *classes);
+
+// Prints the engine counters to stderr
+void block_cache_print_stats(const struct block_cache *bc);
+
+void block_cache_free(struct block_cache *bc);
+
+#endif // BLOCK_CACHE_H
@@ -0,0 +1,187 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "helper.h"
+#include "memory_handling.h"
+#include "bulk.h"
+#include "block_opt.h"
+#include "opcodes.h"
+
+#define REG_MALLOC_RESULT 28
+
+static int is_alu(int op) {
+    return (op >= OP_ADD && op <= OP_SRA) || (op >= OP_SLT && op <= OP_SLTIU) || (op >= OP_MUL && op <= OP_REMU);
+}
+
+static int is_memory(int op) {
+    return op >= OP_LB && op <= OP_SW;
+}
+
+// R-type operations also read rs2
+static int reads_rs2(int op) {
+    switch (op) {
+        case OP_ADD: case OP_SUB: case OP_XOR: case OP_OR: case OP_AND:
+        case OP_SLL: case OP_SRL: case OP_SRA: case OP_SLT: case OP_SLTU:
+        case OP_MUL: case OP_MULH: case OP_MULHSU: case OP_MULHU:
+        case OP_DIV: case OP_DIVU: case OP_REM: case OP_REMU:
+        case OP_BEQ: case OP_BNE: case OP_BLT: case OP_BLTU: case OP_BGE: case OP_BGEU:
+        case OP_SB: case OP_SH: case OP_SW:
+            return 1;
+    }
+    return 0;
+}
+
+// Mirrors the program-flow check in vm_execute, which rejects
+// operations slt ... jal with an out of range or unaligned offset
+static int flow_check_fails(int op, int pc, int imm) {
+    return op >= OP_SLT && op <= OP_JAL && (pc + imm < 0 || pc + imm > INST_MEM_SIZE || imm % 4 != 0);
+}
+
+// Result of an ALU operation on known operands
+static int32_t fold(int op, int32_t a, int32_t b, int32_t imm) {
+    switch (op) {
+        case OP_ADD: return (int32_t)((uint32_t)a + (uint32_t)b);
+        case OP_ADDI: return (int32_t)((uint32_t)a + (uint32_t)imm);
+        case OP_SUB: return (int32_t)((uint32_t)a - (uint32_t)b);
+        case OP_LUI: return imm;
+        case OP_XOR: return a ^ b;
+        case OP_XORI: return a ^ imm;
+        case OP_OR: return a | b;
+        case OP_ORI: return a | imm;
+        case OP_AND: return a & b;
+        case OP_ANDI: return a & imm;
+        case OP_SLL: return (int32_t)((uint32_t)a << (b & 0x1F));
+        case OP_SRL: return (int32_t)((uint32_t)a >> (b & 0x1F));
+        case OP_SRA: return a >> (b & 0x1F);
+        case OP_SLT: return a < b;
+        case OP_SLTI: return a < imm;
+        case OP_SLTU: return (uint32_t)a < (uint32_t)b;
+        case OP_SLTIU: return (uint32_t)a < (uint32_t)imm;
+        case OP_MUL: return (int32_t)((uint32_t)a * (uint32_t)b);
+        case OP_MULH: return (int32_t)(((int64_t)a * b) >> 32);
+        case OP_MULHSU: return (int32_t)(((int64_t)a * (int64_t)(uint32_t)b) >> 32);
+        case OP_MULHU: return (int32_t)(((uint64_t)(uint32_t)a * (uint32_t)b) >> 32);
+        case OP_DIV: return b == 0 ? -1 : (a == INT32_MIN && b == -1) ? INT32_MIN : a / b;
+        case OP_DIVU: return b == 0 ? -1 : (int32_t)((uint32_t)a / (uint32_t)b);
+        case OP_REM: return b == 0 ? a : (a == INT32_MIN && b == -1) ? 0 : a % b;
+        case OP_REMU: return b == 0 ? a : (int32_t)((uint32_t)a % (uint32_t)b);
+    }
+    return 0;
+}
+
+// Region handler for a memory access at a known address, HINT_NONE if
+// the access has to go through the full checks (e.g. it is invalid)
+static int classify(int op, int address) {
+    if (virtual_routine_exists(address)) {
+        return HINT_VIRTUAL;
+    }
+    if (address >= 0x0400 && address < 0x0800) {
+        return HINT_DATA;
+    }
+    if (address >= 0 && address < 0x0400 && op <= OP_LHU) {
+        return HINT_INST_LOAD;
+    }
+    if (address >= BASE_ADDR && address < BASE_ADDR + NUM_BANKS * BANK_SIZE) {
+        return HINT_HEAP;
+    }
+    return HINT_NONE;
+}
+
+static void propagate(struct decoded_instruction *insts, struct block_hint *hints,
+                      int count, int start_pc, struct block_opt_stats *stats) {
+    char known[REG_BANK_SIZE] = {1};    // x0 is always 0
+    int32_t value[REG_BANK_SIZE] = {0};
+
+    for (int i = 0; i < count; i++) {
+        struct decoded_instruction *inst = &insts[i];
+        int op = inst->operation;
+        int pc = start_pc + i * 4;
+
+        if (is_alu(op) && !flow_check_fails(op, pc, inst->imm)) {
+            if (inst->rd == 0) {
+                continue;
+            }
+            int known_inputs = known[inst->rs1] && (!reads_rs2(op) || known[inst->rs2]);
+            if (op == OP_LUI || known_inputs) {
+                int32_t result = fold(op, value[inst->rs1], value[inst->rs2], inst->imm);
+                if (op != OP_LUI) {
+                    inst->operation = OP_LUI;
+                    inst->imm = result;
+                    stats->folded++;
+                }
+                known[inst->rd] = 1;
+                value[inst->rd] = result;
+            } else {
+                known[inst->rd] = 0;
+            }
+        } else if (is_memory(op)) {
+            int resolved = 0;
+            if (known[inst->rs1]) {
+                int address = (int32_t)((uint32_t)value[inst->rs1] + (uint32_t)inst->imm);
+                hints[i].kind = classify(op, address);
+                hints[i].address = address;
+                resolved = hints[i].kind != HINT_NONE;
+                stats->resolved += resolved;
+            }
+            // loads write rd, and malloc and memcmp write R[28]
+            if (op <= OP_LHU && inst->rd != 0) {
+                known[inst->rd] = 0;
+            }
+            if (!resolved || hints[i].address == 0x0830 || hints[i].address == BULK_MEMCMP) {
+                known[REG_MALLOC_RESULT] = 0;
+            }
+        } else if ((op == OP_JAL || op == OP_JALR || (op >= OP_LR_W && op <= OP_AMOADD_W)) && inst->rd != 0) {
+            // jumps write the return address, atomics the old memory word
+            known[inst->rd] = 0;
+        }
+    }
+}
+
+// Backwards liveness: every register is live at the end of the block and
+// before anything that may fault or dump registers
+static void eliminate_dead(struct decoded_instruction *insts, struct block_hint *hints,
+                           int count, int start_pc, struct block_opt_stats *stats) {
+    uint32_t live = 0xFFFFFFFF;
+    for (int i = count - 1; i >= 0; i--) {
+        struct decoded_instruction *inst = &insts[i];
+        int op = inst->operation;
+        int pc = start_pc + i * 4;
+
+        if (!is_alu(op) || flow_check_fails(op, pc, inst->imm)) {
+            if (op >= OP_BEQ && op <= OP_JALR && !flow_check_fails(op, pc, inst->imm)) {
+                // valid control flow only reads its operands
+                if (op == OP_JAL || op == OP_JALR) {
+                    live &= ~(1u << inst->rd);
+                }
+                if (op != OP_JAL) {
+                    live |= 1u << inst->rs1;
+                }
+                if (reads_rs2(op)) {
+                    live |= 1u << inst->rs2;
+                }
+            } else {
+                live = 0xFFFFFFFF;
+            }
+            continue;
+        }
+        if (inst->rd != 0 && !(live & (1u << inst->rd))) {
+            hints[i].kind = HINT_DEAD;
+            stats->dead++;
+            continue;
+        }
+        live &= ~(1u << inst->rd);
+        if (op != OP_LUI) {
+            live |= 1u << inst->rs1;
+            if (reads_rs2(op)) {
+                live |= 1u << inst->rs2;
+            }
+        }
+    }
+}
+
+void block_optimise(struct decoded_instruction *insts, struct block_hint *hints,
+                    int count, int start_pc, struct block_opt_stats *stats) {
+    memset(hints, 0, count * sizeof(struct block_hint));
+    propagate(insts, hints, count, start_pc, stats);
+    eliminate_dead(insts, hints, count, start_pc, stats);
+}
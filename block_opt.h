@@ -0,0 +1,39 @@
+#ifndef BLOCK_OPT_H
+#define BLOCK_OPT_H
+
+#include "helper.h"
+
+// What the optimiser found out about one instruction of a block
+#define HINT_NONE 0
+#define HINT_DEAD 1         // result is overwritten before it is read, skip it
+#define HINT_DATA 2         // data memory access at a known address
+#define HINT_VIRTUAL 3      // virtual routine at a known address
+#define HINT_INST_LOAD 4    // load from instruction memory at a known address
+#define HINT_HEAP 5         // heap access at a known address
+
+struct block_hint {
+    int kind;
+    int address;            // resolved address for memory accesses
+};
+
+struct block_opt_stats {
+    int folded;             // instructions replaced by a constant load
+    int dead;               // writes dropped
+    int resolved;           // memory accesses with a known region
+};
+
+/*
+    Optimises the count instructions of a basic block starting at
+    start_pc, in place:
+        - register constants are propagated, and instructions whose
+          result is known are rewritten to lui rd, <result>
+        - memory accesses with a known address are resolved to the
+          handler of their region
+        - writes overwritten before being read are marked dead
+    Anything that may fault or dump registers is left untouched and
+    treated as reading every register.
+*/
+void block_optimise(struct decoded_instruction *insts, struct block_hint *hints,
+                    int count, int start_pc, struct block_opt_stats *stats);
+
+#endif // BLOCK_OPT_H
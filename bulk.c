@@ -0,0 +1,306 @@
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BULK_X86 1
+#endif
+
+#include "memory_handling.h"
+#include "bulk.h"
+
+// Largest range any routine can touch: the whole heap
+#define BULK_MAX (NUM_BANKS * BANK_SIZE)
+
+// Host memory backing the guest bytes at address, and how many of them
+// are contiguous there. Returns NULL if address is not in data memory
+// or an allocated heap bank
+static char *guest_span(int address, char *data_mem, struct heap *heap, int *contiguous) {
+    if (address >= 0x0400 && address < 0x0800) {
+        *contiguous = 0x0800 - address;
+        return &data_mem[address - 0x0400];
+    }
+    MemoryBank *bank = heap_get_ptr(heap, address);
+    if (bank == NULL) {
+        return NULL;
+    }
+    *contiguous = BANK_SIZE - address % BANK_SIZE;
+    return &bank->data[address % BANK_SIZE];
+}
+
+// Returns the host pointer if the whole range is contiguous on the host,
+// NULL otherwise. *valid is 0 if any part of the range is invalid
+static char *guest_range(int address, int size, char *data_mem, struct heap *heap, int *valid) {
+    char *first = NULL;
+    int contiguous_total = 0;
+    *valid = 1;
+    if (size < 0 || size > BULK_MAX) {
+        *valid = 0;
+        return NULL;
+    }
+    while (size > 0) {
+        int contiguous;
+        char *span = guest_span(address, data_mem, heap, &contiguous);
+        if (span == NULL) {
+            *valid = 0;
+            return NULL;
+        }
+        if (first == NULL) {
+            first = span;
+        } else if (span != first + contiguous_total) {
+            contiguous_total = -1;
+        }
+        int n = contiguous < size ? contiguous : size;
+        if (contiguous_total >= 0) {
+            contiguous_total += n;
+        }
+        address += n;
+        size -= n;
+    }
+    return contiguous_total >= 0 ? first : NULL;
+}
+
+// Copies between a validated guest range and a host buffer
+static void gather(unsigned char *out, int address, int size, char *data_mem, struct heap *heap) {
+    while (size > 0) {
+        int contiguous;
+        char *span = guest_span(address, data_mem, heap, &contiguous);
+        int n = contiguous < size ? contiguous : size;
+        memcpy(out, span, n);
+        out += n;
+        address += n;
+        size -= n;
+    }
+}
+
+static void scatter(const unsigned char *in, int address, int size, char *data_mem, struct heap *heap) {
+    while (size > 0) {
+        int contiguous;
+        char *span = guest_span(address, data_mem, heap, &contiguous);
+        int n = contiguous < size ? contiguous : size;
+        memcpy(span, in, n);
+        in += n;
+        address += n;
+        size -= n;
+    }
+}
+
+// Marks the heap banks of a validated range as written. Data memory is
+// tracked by the vm
+static void mark_written(int address, int size, struct heap *heap) {
+    for (int a = address - address % BANK_SIZE; a < address + size; a += BANK_SIZE) {
+        MemoryBank *bank = heap_get_ptr(heap, a);
+        if (bank != NULL) {
+            heap_mark_dirty(bank);
+        }
+    }
+}
+
+/*
+    SIMD kernels. libc's memmove and memset are already vectorised,
+    so only compare and add have explicit SSE2 / AVX2 versions
+*/
+
+// Element i of the vectors at dst, a and b, which may be unaligned
+static void add_element(unsigned char *dst, const unsigned char *a, const unsigned char *b, int i) {
+    uint32_t x, y;
+    memcpy(&x, a + i * 4, 4);
+    memcpy(&y, b + i * 4, 4);
+    x += y;
+    memcpy(dst + i * 4, &x, 4);
+}
+
+#ifdef BULK_X86
+__attribute__((target("avx2")))
+static void vadd_avx2(unsigned char *dst, const unsigned char *a, const unsigned char *b, int n) {
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + i * 4));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(b + i * 4));
+        _mm256_storeu_si256((__m256i *)(dst + i * 4), _mm256_add_epi32(x, y));
+    }
+    for (; i < n; i++) {
+        add_element(dst, a, b, i);
+    }
+}
+
+__attribute__((target("sse2")))
+static void vadd_sse2(unsigned char *dst, const unsigned char *a, const unsigned char *b, int n) {
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + i * 4));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + i * 4));
+        _mm_storeu_si128((__m128i *)(dst + i * 4), _mm_add_epi32(x, y));
+    }
+    for (; i < n; i++) {
+        add_element(dst, a, b, i);
+    }
+}
+
+// Index of the first differing byte, size if there is none
+__attribute__((target("sse2")))
+static int mismatch_sse2(const unsigned char *a, const unsigned char *b, int size) {
+    int i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+        int equal = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+        if (equal != 0xFFFF) {
+            return i + __builtin_ctz(~equal);
+        }
+    }
+    for (; i < size && a[i] == b[i]; i++);
+    return i;
+}
+#endif
+
+static void vadd_scalar(unsigned char *dst, const unsigned char *a, const unsigned char *b, int n) {
+    for (int i = 0; i < n; i++) {
+        add_element(dst, a, b, i);
+    }
+}
+
+static int mismatch_scalar(const unsigned char *a, const unsigned char *b, int size) {
+    int i = 0;
+    for (; i < size && a[i] == b[i]; i++);
+    return i;
+}
+
+// The kernels read an element before writing it, so dst may be a or b
+// but must not partly overlap them
+static void vadd(unsigned char *dst, const unsigned char *a, const unsigned char *b, int n) {
+#ifdef BULK_X86
+    if (__builtin_cpu_supports("avx2")) {
+        vadd_avx2(dst, a, b, n);
+        return;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        vadd_sse2(dst, a, b, n);
+        return;
+    }
+#endif
+    vadd_scalar(dst, a, b, n);
+}
+
+static int mismatch(const unsigned char *a, const unsigned char *b, int size) {
+#ifdef BULK_X86
+    if (__builtin_cpu_supports("sse2")) {
+        return mismatch_sse2(a, b, size);
+    }
+#endif
+    return mismatch_scalar(a, b, size);
+}
+
+/*
+    Routines. Ranges are validated completely before anything is written,
+    so an illegal call leaves memory untouched
+*/
+
+static int bulk_memcpy(int dst, int src, int size, char *data_mem, struct heap *heap) {
+    int dst_valid, src_valid;
+    char *d = guest_range(dst, size, data_mem, heap, &dst_valid);
+    char *s = guest_range(src, size, data_mem, heap, &src_valid);
+    if (!dst_valid || !src_valid) {
+        return 1;
+    }
+    mark_written(dst, size, heap);
+    if (d != NULL && s != NULL) {
+        memmove(d, s, size);
+    } else {
+        // ranges spanning several heap banks go through a bounce buffer
+        _Alignas(32) unsigned char bounce_a[BULK_MAX];
+        gather(bounce_a, src, size, data_mem, heap);
+        scatter(bounce_a, dst, size, data_mem, heap);
+    }
+    return 0;
+}
+
+static int bulk_memset(int dst, int value, int size, char *data_mem, struct heap *heap) {
+    int valid;
+    char *d = guest_range(dst, size, data_mem, heap, &valid);
+    if (!valid) {
+        return 1;
+    }
+    mark_written(dst, size, heap);
+    if (d != NULL) {
+        memset(d, value & 0xFF, size);
+    } else {
+        _Alignas(32) unsigned char bounce_a[BULK_MAX];
+        memset(bounce_a, value & 0xFF, size);
+        scatter(bounce_a, dst, size, data_mem, heap);
+    }
+    return 0;
+}
+
+static int bulk_memcmp(int a, int b, int size, int *result, char *data_mem, struct heap *heap) {
+    int a_valid, b_valid;
+    const unsigned char *x = (const unsigned char *)guest_range(a, size, data_mem, heap, &a_valid);
+    const unsigned char *y = (const unsigned char *)guest_range(b, size, data_mem, heap, &b_valid);
+    if (!a_valid || !b_valid) {
+        return 1;
+    }
+    _Alignas(32) unsigned char bounce_a[BULK_MAX];
+    _Alignas(32) unsigned char bounce_b[BULK_MAX];
+    if (x == NULL) {
+        gather(bounce_a, a, size, data_mem, heap);
+        x = bounce_a;
+    }
+    if (y == NULL) {
+        gather(bounce_b, b, size, data_mem, heap);
+        y = bounce_b;
+    }
+    int i = mismatch(x, y, size);
+    *result = (i == size) ? 0 : (x[i] < y[i] ? -1 : 1);
+    return 0;
+}
+
+// Whether the host ranges at p and q partly overlap. The same range is
+// not an overlap: the kernels can add in place
+static int overlaps(const char *p, const char *q, int size) {
+    uintptr_t x = (uintptr_t)p;
+    uintptr_t y = (uintptr_t)q;
+    return x != y && x < y + size && y < x + size;
+}
+
+static int bulk_vadd(int dst, int a, int b, int n, char *data_mem, struct heap *heap) {
+    if (n < 0 || n > BULK_MAX / 4) {
+        return 1;
+    }
+    int size = n * 4;
+    int d_valid, a_valid, b_valid;
+    char *d = guest_range(dst, size, data_mem, heap, &d_valid);
+    char *x = guest_range(a, size, data_mem, heap, &a_valid);
+    char *y = guest_range(b, size, data_mem, heap, &b_valid);
+    if (!d_valid || !a_valid || !b_valid) {
+        return 1;
+    }
+    mark_written(dst, size, heap);
+    if (d != NULL && x != NULL && y != NULL && !overlaps(d, x, size) && !overlaps(d, y, size)) {
+        vadd((unsigned char *)d, (const unsigned char *)x, (const unsigned char *)y, n);
+        return 0;
+    }
+    // ranges spanning several heap banks, or a destination partly
+    // overlapping a source, go through bounce buffers
+    _Alignas(32) unsigned char bounce_a[BULK_MAX];
+    _Alignas(32) unsigned char bounce_b[BULK_MAX];
+    _Alignas(32) unsigned char bounce_c[BULK_MAX];
+    gather(bounce_a, a, size, data_mem, heap);
+    gather(bounce_b, b, size, data_mem, heap);
+    vadd(bounce_c, bounce_a, bounce_b, n);
+    scatter(bounce_c, dst, size, data_mem, heap);
+    return 0;
+}
+
+int bulk_routine_handling(int address, int *reg_bank, char *data_mem, struct heap *heap) {
+    switch (address) {
+        case BULK_MEMCPY:
+            return bulk_memcpy(reg_bank[10], reg_bank[11], reg_bank[12], data_mem, heap);
+        case BULK_MEMSET:
+            return bulk_memset(reg_bank[10], reg_bank[11], reg_bank[12], data_mem, heap);
+        case BULK_MEMCMP:
+            return bulk_memcmp(reg_bank[10], reg_bank[11], reg_bank[12], &reg_bank[28], data_mem, heap);
+        case BULK_VADD:
+            return bulk_vadd(reg_bank[10], reg_bank[11], reg_bank[12], reg_bank[13], data_mem, heap);
+    }
+    return 1;
+}
@@ -0,0 +1,29 @@
+#ifndef BULK_H
+#define BULK_H
+
+#include "memory_handling.h"
+
+/*
+    Bulk memory virtual routines. A store of any value to one of these
+    addresses runs the routine on arguments held in registers:
+
+    0x0838 memcpy:  copy R[12] bytes from R[11] to R[10]
+    0x083C memset:  set R[12] bytes at R[10] to the low byte of R[11]
+    0x0840 memcmp:  compare R[12] bytes at R[10] and R[11],
+                    R[28] = -1, 0 or 1
+    0x0844 vadd:    R[13] int32 elements, R[10][i] = R[11][i] + R[12][i]
+
+    Every range must lie entirely in data memory or in allocated heap
+    banks, otherwise the access is illegal. Ranges may overlap: memcpy
+    copies as memmove does, and vadd reads both sources whole before
+    writing R[10], whichever kernel the host runs.
+*/
+#define BULK_MEMCPY 0x0838
+#define BULK_MEMSET 0x083C
+#define BULK_MEMCMP 0x0840
+#define BULK_VADD 0x0844
+
+// Runs the bulk routine at address. Returns 1 if a range is invalid
+int bulk_routine_handling(int address, int *reg_bank, char *data_mem, struct heap *heap);
+
+#endif // BULK_H
@@ -0,0 +1,120 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "helper.h"
+#include "program.h"
+#include "bundle.h"
+
+// Whether every offset in the bundle lies inside the file
+static int bundle_valid(const struct bundle *b) {
+    const struct bundle_header *h = b->header;
+    uint64_t entries_end = sizeof(struct bundle_header) + (uint64_t)h->entry_count * sizeof(struct bundle_entry);
+    if (h->magic != BUNDLE_MAGIC || entries_end > b->size || h->images_offset > b->size ||
+        (b->size - h->images_offset) / sizeof(struct bundle_image) < h->image_count ||
+        h->images_offset % sizeof(uint64_t) != 0)
+    {
+        return 0;
+    }
+    for (uint32_t i = 0; i < h->image_count; i++) {
+        if (b->images[i].offset > b->size || b->size - b->images[i].offset < sizeof(struct blob)) {
+            return 0;
+        }
+    }
+    for (uint32_t i = 0; i < h->entry_count; i++) {
+        const struct bundle_entry *e = &b->entries[i];
+        if (e->image >= h->image_count ||
+            (uint64_t)e->name_offset + e->name_size > b->size ||
+            e->input_offset > b->size || b->size - e->input_offset < e->input_size)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int bundle_open(struct bundle *b, const char *path) {
+    memset(b, 0, sizeof(struct bundle));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return BUNDLE_OPEN_FAILED;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct bundle_header)) {
+        close(fd);
+        return BUNDLE_INVALID;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping stays valid without the descriptor
+    close(fd);
+    if (data == MAP_FAILED) {
+        return BUNDLE_OPEN_FAILED;
+    }
+    // entries are run in order, let the kernel read ahead
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    b->data = (const char *)data;
+    b->size = st.st_size;
+    b->header = (const struct bundle_header *)data;
+    b->entries = (const struct bundle_entry *)(b->data + sizeof(struct bundle_header));
+    b->images = (const struct bundle_image *)(b->data + b->header->images_offset);
+    if (!bundle_valid(b)) {
+        munmap(data, st.st_size);
+        b->data = NULL;
+        return BUNDLE_INVALID;
+    }
+    b->programs = (struct program **)calloc(b->header->image_count + 1, sizeof(struct program *));
+    return BUNDLE_OK;
+}
+
+int bundle_find(const struct bundle *b, const char *name) {
+    size_t size = strlen(name);
+    for (uint32_t i = 0; i < b->header->entry_count; i++) {
+        const struct bundle_entry *e = &b->entries[i];
+        if (e->name_size == size && memcmp(b->data + e->name_offset, name, size) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const struct program *bundle_program(struct bundle *b, int i) {
+    uint32_t image = b->entries[i].image;
+    if (b->programs[image] == NULL) {
+        b->programs[image] = (struct program *)malloc(sizeof(struct program));
+        program_from_image(b->programs[image], (const struct blob *)(b->data + b->images[image].offset));
+    }
+    return b->programs[image];
+}
+
+static void free_program(struct bundle *b, uint32_t image) {
+    if (b->programs[image] != NULL) {
+        program_free(b->programs[image]);
+        free(b->programs[image]);
+        b->programs[image] = NULL;
+    }
+}
+
+void bundle_release(struct bundle *b, int i) {
+    free_program(b, b->entries[i].image);
+}
+
+const char *bundle_input(const struct bundle *b, int i, size_t *size) {
+    *size = b->entries[i].input_size;
+    return b->data + b->entries[i].input_offset;
+}
+
+void bundle_close(struct bundle *b) {
+    if (b->data == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i < b->header->image_count; i++) {
+        free_program(b, i);
+    }
+    free(b->programs);
+    munmap((void *)b->data, b->size);
+    b->data = NULL;
+}
@@ -0,0 +1,82 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "program.h"
+
+/*
+    Image bundles: a corpus of images and inputs packed into one file by
+    riskxvii-pack, so running it costs one mmap instead of a few calls
+    per file. Identical images are stored once and every entry using
+    them shares a single pre-decoded program.
+
+    Layout, in host byte order:
+        bundle_header
+        bundle_entry[entry_count]       name, image and input of each run
+        images and inputs               images are whole struct blobs
+        names                           not terminated, see name_size
+        bundle_image[image_count]       at images_offset
+    Every offset is from the start of the file, and sections may be
+    followed by unused space.
+*/
+#define BUNDLE_MAGIC 0x32425852         // "RXB2"
+
+struct bundle_header {
+    uint32_t magic;
+    uint32_t entry_count;
+    uint32_t image_count;
+    uint32_t reserved;
+    uint64_t images_offset;
+};
+
+struct bundle_entry {
+    uint64_t name_offset;
+    uint64_t input_offset;
+    uint32_t name_size;
+    uint32_t input_size;
+    uint32_t image;                     // index into the image table
+    uint32_t reserved;
+};
+
+struct bundle_image {
+    uint64_t hash;                      // hash_bytes of the blob
+    uint64_t offset;
+};
+
+// Error codes returned by bundle_open
+#define BUNDLE_OK 0
+#define BUNDLE_OPEN_FAILED 1
+#define BUNDLE_INVALID 2
+
+struct bundle {
+    const char *data;                   // the whole file, mapped
+    size_t size;
+    const struct bundle_header *header;
+    const struct bundle_entry *entries;
+    const struct bundle_image *images;
+    struct program **programs;          // by image, decoded on first use
+                                        // until bundle_release
+};
+
+// Maps and checks the bundle at path
+int bundle_open(struct bundle *b, const char *path);
+
+// Index of the entry called name, -1 if there is none
+int bundle_find(const struct bundle *b, const char *name);
+
+// Decoded program of entry i, shared with every entry of the same image
+const struct program *bundle_program(struct bundle *b, int i);
+
+// Frees the decoded program of entry i, once no more entries of its
+// image are to run. A later bundle_program decodes it again
+void bundle_release(struct bundle *b, int i);
+
+// Input of entry i, pointing into the mapping
+const char *bundle_input(const struct bundle *b, int i, size_t *size);
+
+// Unmaps the bundle and frees its programs
+void bundle_close(struct bundle *b);
+
+#endif // BUNDLE_H
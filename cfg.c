@@ -0,0 +1,120 @@
+#include <string.h>
+
+#include "helper.h"
+#include "block_opt.h"
+#include "cfg.h"
+#include "opcodes.h"
+
+// beq ... bgeu, jal, jalr
+static int is_terminator(int op) {
+    return op >= OP_BEQ && op <= OP_JALR;
+}
+
+// pc of a static target if a block can start there, -1 otherwise
+static int block_target(int pc, const struct decoded_instruction *inst) {
+    int target = pc + inst->imm;
+    if (inst->imm % 4 != 0 || target < 0 || target >= INST_MEM_SIZE) {
+        return -1;
+    }
+    return target;
+}
+
+// Successors of block b: static target, fall through and, after a call,
+// the return address. Returns how many were written to next
+static int successors(const struct cfg *cfg, const struct cfg_block *b,
+                      const struct decoded_instruction *decoded, int *next) {
+    int n = 0;
+    const struct decoded_instruction *last = &decoded[b->end_pc / 4];
+    if (b->taken_pc >= 0 && block_target(b->end_pc, last) >= 0) {
+        next[n++] = cfg->block_of[b->taken_pc / 4];
+    }
+    if (b->fallthrough_pc >= 0) {
+        next[n++] = cfg->block_of[b->fallthrough_pc / 4];
+    } else if (b->terminator == OP_JAL && last->rd != 0 && b->end_pc + 4 < INST_MEM_SIZE) {
+        next[n++] = cfg->block_of[(b->end_pc + 4) / 4];
+    }
+    return n;
+}
+
+// Depth-first walk marking reachable blocks; an edge back to a block
+// still on the walk's stack closes a loop
+static void walk(struct cfg *cfg, const struct decoded_instruction *decoded, int index, char *on_stack) {
+    struct cfg_block *b = &cfg->blocks[index];
+    b->flags |= CFG_REACHABLE;
+    on_stack[index] = 1;
+    int next[3];
+    int n = successors(cfg, b, decoded, next);
+    for (int i = 0; i < n; i++) {
+        struct cfg_block *s = &cfg->blocks[next[i]];
+        if (on_stack[next[i]]) {
+            s->flags |= CFG_LOOP_HEADER;
+        } else if (!(s->flags & CFG_REACHABLE)) {
+            walk(cfg, decoded, next[i], on_stack);
+        }
+    }
+    on_stack[index] = 0;
+}
+
+void cfg_build(struct cfg *cfg, const struct decoded_instruction *decoded) {
+    memset(cfg, 0, sizeof(struct cfg));
+
+    // block starts
+    char leader[NUM_INSTRUCTIONS] = {1};
+    char function[NUM_INSTRUCTIONS] = {0};
+    for (int i = 0; i < NUM_INSTRUCTIONS; i++) {
+        const struct decoded_instruction *inst = &decoded[i];
+        if (!is_terminator(inst->operation)) {
+            continue;
+        }
+        if (i + 1 < NUM_INSTRUCTIONS) {
+            leader[i + 1] = 1;
+        }
+        if (inst->operation != OP_JALR) {
+            int target = block_target(i * 4, inst);
+            if (target >= 0) {
+                leader[target / 4] = 1;
+                function[target / 4] |= inst->operation == OP_JAL && inst->rd != 0;
+            }
+        }
+    }
+
+    // blocks, and the instructions of each run through the optimiser
+    memcpy(cfg->insts, decoded, sizeof(cfg->insts));
+    for (int i = 0; i < NUM_INSTRUCTIONS; i++) {
+        if (leader[i]) {
+            struct cfg_block *b = &cfg->blocks[cfg->num_blocks++];
+            b->start_pc = i * 4;
+            b->flags = function[i] ? CFG_FUNCTION : 0;
+        }
+        struct cfg_block *b = &cfg->blocks[cfg->num_blocks - 1];
+        cfg->block_of[i] = cfg->num_blocks - 1;
+        b->end_pc = i * 4;
+        b->count++;
+    }
+    for (int i = 0; i < cfg->num_blocks; i++) {
+        struct cfg_block *b = &cfg->blocks[i];
+        const struct decoded_instruction *last = &decoded[b->end_pc / 4];
+        b->terminator = last->operation;
+        b->taken_pc = -1;
+        b->fallthrough_pc = b->end_pc + 4 < INST_MEM_SIZE ? b->end_pc + 4 : -1;
+        if (is_terminator(b->terminator) && b->terminator != OP_JALR) {
+            b->taken_pc = b->end_pc + last->imm;
+        }
+        if (b->terminator == OP_JAL || b->terminator == OP_JALR) {
+            b->fallthrough_pc = -1;
+        }
+        block_optimise(&cfg->insts[b->start_pc / 4], &cfg->hints[b->start_pc / 4],
+                       b->count, b->start_pc, &cfg->opt);
+    }
+
+    char on_stack[NUM_INSTRUCTIONS] = {0};
+    walk(cfg, decoded, 0, on_stack);
+}
+
+const struct cfg_block *cfg_block_at(const struct cfg *cfg, int pc) {
+    return &cfg->blocks[cfg->block_of[pc / 4]];
+}
+
+int cfg_is_leader(const struct cfg *cfg, int pc) {
+    return pc >= 0 && pc < INST_MEM_SIZE && pc % 4 == 0 && cfg_block_at(cfg, pc)->start_pc == pc;
+}
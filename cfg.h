@@ -0,0 +1,50 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include "helper.h"
+#include "block_opt.h"
+
+// Block flags
+#define CFG_REACHABLE 1         // reachable from pc 0 (jalr targets aside)
+#define CFG_LOOP_HEADER 2       // target of a back edge
+#define CFG_FUNCTION 4          // target of a jal that saves the return address
+
+/*
+    Control-flow graph of instruction memory, built once per program and
+    shared by the block cache, the AOT translator and riskxvii-objdump.
+
+    Blocks start at pc 0, at every static branch or jal target and after
+    every branch or jump, and end before the next start. A call (jal with
+    rd != x0) is taken to return to the instruction after it.
+*/
+struct cfg_block {
+    int start_pc;
+    int end_pc;                 // pc of the last instruction
+    int count;                  // number of instructions
+    int terminator;             // operation number of the last instruction
+    int taken_pc;               // static branch or jal target, -1 otherwise
+    int fallthrough_pc;         // next block if execution can fall into it, -1 otherwise
+    int flags;
+};
+
+struct cfg {
+    int num_blocks;
+    struct cfg_block blocks[NUM_INSTRUCTIONS];      // in pc order
+    int block_of[NUM_INSTRUCTIONS];                 // block holding each pc / 4
+    // every block run through block_optimise, valid when a block is
+    // entered at its start
+    struct decoded_instruction insts[NUM_INSTRUCTIONS];
+    struct block_hint hints[NUM_INSTRUCTIONS];
+    struct block_opt_stats opt;
+};
+
+// Builds the graph of the pre-decoded instruction memory
+void cfg_build(struct cfg *cfg, const struct decoded_instruction *decoded);
+
+// Block holding pc, which must be word aligned and in instruction memory
+const struct cfg_block *cfg_block_at(const struct cfg *cfg, int pc);
+
+// Returns 1 if a block starts at pc
+int cfg_is_leader(const struct cfg *cfg, int pc);
+
+#endif // CFG_H
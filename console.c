@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "console.h"
+
+#define LOG_MAGIC "RXI1"
+
+// Entry kinds
+#define ENTRY_CHAR 0
+#define ENTRY_CHAR_EOF 1
+#define ENTRY_INT 2
+#define ENTRY_INT_NONE 3
+
+void console_init(struct console *con, const uint64_t *instret) {
+    memset(con, 0, sizeof(struct console));
+    con->mode = CONSOLE_STDIO;
+    con->instret = instret;
+}
+
+int console_record(struct console *con, const char *path) {
+    con->log = fopen(path, "wb");
+    if (con->log == NULL) {
+        return 1;
+    }
+    fwrite(LOG_MAGIC, 1, 4, con->log);
+    con->mode = CONSOLE_RECORD;
+    return 0;
+}
+
+int console_replay(struct console *con, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return 1;
+    }
+    // Read the whole log up front, so replaying costs no syscalls
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    con->replay = (unsigned char *)malloc(size > 0 ? size : 1);
+    if (size < 4 || fread(con->replay, 1, size, file) != (size_t)size ||
+        memcmp(con->replay, LOG_MAGIC, 4) != 0) 
+    {
+        free(con->replay);
+        con->replay = NULL;
+        fclose(file);
+        return 1;
+    }
+    fclose(file);
+    con->replay_size = size;
+    con->replay_pos = 4;
+    con->mode = CONSOLE_REPLAY;
+    return 0;
+}
+
+void console_buffer(struct console *con, const char *input, size_t size) {
+    con->input = input;
+    con->input_size = size;
+    con->input_pos = 0;
+    con->mode = CONSOLE_BUFFER;
+}
+
+static void put_varint(FILE *log, uint64_t value) {
+    while (value >= 0x80) {
+        fputc((int)(value & 0x7F) | 0x80, log);
+        value >>= 7;
+    }
+    fputc((int)value, log);
+}
+
+static uint64_t get_varint(struct console *con) {
+    uint64_t value = 0;
+    int shift = 0;
+    while (con->replay_pos < con->replay_size && shift < 64) {
+        unsigned char byte = con->replay[con->replay_pos++];
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            break;
+        }
+        shift += 7;
+    }
+    return value;
+}
+
+static void record_entry(struct console *con, int kind) {
+    put_varint(con->log, *con->instret - con->last_index);
+    con->last_index = *con->instret;
+    fputc(kind, con->log);
+}
+
+// Returns the kind of the next replayed entry, -1 once the log is exhausted
+static int replay_entry(struct console *con) {
+    if (con->replay_pos >= con->replay_size) {
+        return -1;
+    }
+    uint64_t index = con->last_index + get_varint(con);
+    con->last_index = index;
+    if (index != *con->instret && !con->diverged) {
+        fprintf(stderr, "Replay diverged: input recorded at instruction %llu, consumed at %llu\n",
+                (unsigned long long)index, (unsigned long long)*con->instret);
+        con->diverged = 1;
+    }
+    if (con->replay_pos >= con->replay_size) {
+        return -1;
+    }
+    return con->replay[con->replay_pos++];
+}
+
+// Buffer mode counterparts of getchar and scanf("%d")
+static int buffer_read_char(struct console *con) {
+    if (con->input_pos >= con->input_size) {
+        return EOF;
+    }
+    return (unsigned char)con->input[con->input_pos++];
+}
+
+static int buffer_read_int(struct console *con, int *value) {
+    const char *in = con->input;
+    size_t pos = con->input_pos;
+    while (pos < con->input_size && isspace((unsigned char)in[pos])) {
+        pos++;
+    }
+    int negative = 0;
+    if (pos < con->input_size && (in[pos] == '-' || in[pos] == '+')) {
+        negative = in[pos] == '-';
+        pos++;
+    }
+    if (pos >= con->input_size || !isdigit((unsigned char)in[pos])) {
+        con->input_pos = pos;
+        return 0;
+    }
+    uint32_t result = 0;
+    while (pos < con->input_size && isdigit((unsigned char)in[pos])) {
+        result = result * 10 + (uint32_t)(in[pos] - '0');
+        pos++;
+    }
+    con->input_pos = pos;
+    *value = (int)(negative ? 0u - result : result);
+    return 1;
+}
+
+static int read_char(struct console *con) {
+    if (con == NULL || con->mode == CONSOLE_STDIO) {
+        return getchar();
+    }
+    if (con->mode == CONSOLE_BUFFER) {
+        return buffer_read_char(con);
+    }
+    if (con->mode == CONSOLE_REPLAY) {
+        if (replay_entry(con) != ENTRY_CHAR || con->replay_pos >= con->replay_size) {
+            return EOF;
+        }
+        return con->replay[con->replay_pos++];
+    }
+    int c = getchar();
+    if (c == EOF) {
+        record_entry(con, ENTRY_CHAR_EOF);
+    } else {
+        record_entry(con, ENTRY_CHAR);
+        fputc(c, con->log);
+    }
+    return c;
+}
+
+// Reads an integer and the number of input bytes it took up, which in
+// replay mode is the length of its decimal form
+static int read_int(struct console *con, int *value, int *size) {
+    *size = 0;
+    if (con == NULL || con->mode == CONSOLE_STDIO) {
+        return scanf("%d%n", value, size) == 1;
+    }
+    if (con->mode == CONSOLE_BUFFER) {
+        size_t start = con->input_pos;
+        int read = buffer_read_int(con, value);
+        // as scanf's %n, nothing when no integer was read
+        *size = read ? (int)(con->input_pos - start) : 0;
+        return read;
+    }
+    if (con->mode == CONSOLE_REPLAY) {
+        if (replay_entry(con) != ENTRY_INT) {
+            return 0;
+        }
+        uint32_t zigzag = (uint32_t)get_varint(con);
+        *value = (int)((zigzag >> 1) ^ -(zigzag & 1));
+        *size = snprintf(NULL, 0, "%d", *value);
+        return 1;
+    }
+    if (scanf("%d%n", value, size) != 1) {
+        record_entry(con, ENTRY_INT_NONE);
+        return 0;
+    }
+    record_entry(con, ENTRY_INT);
+    put_varint(con->log, ((uint32_t)*value << 1) ^ (uint32_t)(*value >> 31));
+    return 1;
+}
+
+int console_read_char(struct console *con) {
+    int c = read_char(con);
+    if (con != NULL && c != EOF) {
+        con->bytes_read++;
+    }
+    return c;
+}
+
+int console_read_int(struct console *con, int *value) {
+    int size;
+    int read = read_int(con, value, &size);
+    if (con != NULL) {
+        con->bytes_read += size;
+    }
+    return read;
+}
+
+void console_capture(struct console *con) {
+    con->capture = 1;
+    con->output_size = 0;
+    con->output_truncated = 0;
+}
+
+void console_capture_spilling(struct console *con) {
+    console_capture(con);
+    con->spill = 1;
+}
+
+// The file output goes to once con->output is full, NULL while it is not
+// or if the output is not spilled. Output is only truncated if the file
+// cannot be created
+static FILE *spill_file(struct console *con, size_t size) {
+    if (con->spill_file == NULL && con->spill && con->output_size + size > CONSOLE_MAX_OUTPUT) {
+        con->spill_file = tmpfile();
+        con->output_truncated = con->spill_file == NULL;
+    }
+    return con->spill_file;
+}
+
+// Makes room for size more bytes of captured output, 0 if over the limit
+static int reserve_output(struct console *con, size_t size) {
+    if (con->output_size + size > CONSOLE_MAX_OUTPUT) {
+        con->output_truncated = 1;
+        return 0;
+    }
+    if (con->output_size + size > con->output_capacity) {
+        size_t capacity = con->output_capacity > 0 ? con->output_capacity : 256;
+        while (capacity < con->output_size + size) {
+            capacity *= 2;
+        }
+        con->output = (char *)realloc(con->output, capacity);
+        con->output_capacity = capacity;
+    }
+    return 1;
+}
+
+void console_printf(struct console *con, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    if (con == NULL || !con->capture) {
+        int size = vprintf(format, args);
+        if (con != NULL && size > 0) {
+            con->bytes_written += size;
+        }
+        va_end(args);
+        return;
+    }
+    va_list copy;
+    va_copy(copy, args);
+    int size = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+    if (size > 0) {
+        con->bytes_written += size;
+    }
+    FILE *spill = size > 0 ? spill_file(con, size + 1) : NULL;
+    if (spill != NULL) {
+        vfprintf(spill, format, args);
+    }
+    // room for the terminator vsnprintf writes, which is not kept
+    else if (size > 0 && reserve_output(con, size + 1)) {
+        vsnprintf(con->output + con->output_size, size + 1, format, args);
+        con->output_size += size;
+    }
+    va_end(args);
+}
+
+void console_putchar(struct console *con, int c) {
+    if (con != NULL) {
+        con->bytes_written++;
+    }
+    FILE *spill;
+    if (con == NULL || !con->capture) {
+        putchar(c);
+    } else if ((spill = spill_file(con, 1)) != NULL) {
+        fputc(c, spill);
+    } else if (reserve_output(con, 1)) {
+        con->output[con->output_size++] = (char)c;
+    }
+}
+
+void console_write_output(struct console *con, FILE *out) {
+    if (con->output_size > 0) {
+        fwrite(con->output, 1, con->output_size, out);
+    }
+    if (con->spill_file != NULL) {
+        char buffer[8192];
+        size_t size;
+        rewind(con->spill_file);
+        while ((size = fread(buffer, 1, sizeof(buffer), con->spill_file)) > 0) {
+            fwrite(buffer, 1, size, out);
+        }
+    }
+}
+
+void console_close(struct console *con) {
+    if (con->log != NULL) {
+        fclose(con->log);
+        con->log = NULL;
+    }
+    if (con->spill_file != NULL) {
+        fclose(con->spill_file);
+        con->spill_file = NULL;
+    }
+    con->spill = 0;
+    free(con->replay);
+    con->replay = NULL;
+    free(con->output);
+    con->output = NULL;
+    con->output_size = 0;
+    con->output_capacity = 0;
+    con->capture = 0;
+    con->mode = CONSOLE_STDIO;
+}
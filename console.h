@@ -0,0 +1,87 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define CONSOLE_STDIO 0     // read stdin directly
+#define CONSOLE_RECORD 1    // read stdin and log every value consumed
+#define CONSOLE_REPLAY 2    // feed values from a log held in memory
+#define CONSOLE_BUFFER 3    // parse input text held in memory
+
+// Captured output beyond this is dropped, or spilled to a temporary
+// file, see console_capture and console_capture_spilling
+#define CONSOLE_MAX_OUTPUT (16 << 20)
+
+/*
+    Console input of one VM instance (virtual routines 0x0812, 0x0816),
+    and its output, which goes to stdout unless it is being captured.
+
+    A record log starts with the 4 byte magic "RXI1", followed by one
+    entry per value consumed:
+        - varint: retired-instruction index, as a delta from the previous entry
+        - 1 byte: entry kind (see console.c)
+        - payload: 1 byte for characters, zigzag varint for integers
+*/
+struct console {
+    int mode;
+    FILE *log;                  // record mode
+    unsigned char *replay;      // replay mode, whole log in memory
+    size_t replay_size;
+    size_t replay_pos;
+    const char *input;          // buffer mode, not owned
+    size_t input_size;
+    size_t input_pos;
+    uint64_t last_index;
+    char diverged;              // replay index mismatch already reported
+    const uint64_t *instret;    // retired-instruction counter of the instance
+    uint64_t bytes_read;        // input consumed, for --metrics
+    uint64_t bytes_written;
+    char capture;               // collect output in output instead of stdout
+    char output_truncated;      // output reached CONSOLE_MAX_OUTPUT
+    char *output;
+    size_t output_size;
+    size_t output_capacity;
+    char spill;                 // output past CONSOLE_MAX_OUTPUT goes to spill_file
+    FILE *spill_file;           // everything written once output was full
+};
+
+// Initialises con to read stdin directly
+void console_init(struct console *con, const uint64_t *instret);
+
+// Switches con to record mode, logging to path. Returns 1 on error
+int console_record(struct console *con, const char *path);
+
+// Switches con to replay mode, loading the log at path. Returns 1 on error
+int console_replay(struct console *con, const char *path);
+
+// Switches con to read the size bytes at input, as if they were stdin
+void console_buffer(struct console *con, const char *input, size_t size);
+
+// Reads a character, EOF if there is none (like getchar)
+int console_read_char(struct console *con);
+
+// Reads a signed integer into value, returns 0 if nothing was read (like scanf)
+int console_read_int(struct console *con, int *value);
+
+// Collects con's output in con->output from now on, until console_close
+void console_capture(struct console *con);
+
+// console_capture without the limit: once con->output holds
+// CONSOLE_MAX_OUTPUT bytes, the rest goes to a temporary file
+void console_capture_spilling(struct console *con);
+
+// Writes the captured output, spilled part included, to out
+void console_write_output(struct console *con, FILE *out);
+
+// Writes output like printf. con may be NULL, which writes stdout
+void console_printf(struct console *con, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+// Writes one character of output, like putchar
+void console_putchar(struct console *con, int c);
+
+// Flushes and releases the log and any captured output
+void console_close(struct console *con);
+
+#endif // CONSOLE_H
@@ -0,0 +1,393 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "arena.h"
+#include "console.h"
+#include "daemon.h"
+#include "helper.h"
+#include "metrics.h"
+#include "program.h"
+#include "vm.h"
+
+// A decoded image, shared by every job running it
+struct cached_image {
+    uint64_t hash;
+    struct program *prog;
+    int refs;                   // jobs running it, it is only evicted at 0
+    uint64_t last_used;
+};
+
+// An instance of the pool
+struct pool_slot {
+    struct vm vm;
+    struct console console;
+    char busy;
+};
+
+struct daemon {
+    int listen_fd;
+    pthread_mutex_t lock;       // guards the cache and the pool
+    pthread_cond_t slot_freed;
+    struct cached_image *cache;
+    int cache_size;
+    int cached;
+    uint64_t clock;             // orders cache uses, for eviction
+    struct pool_slot *pool;
+    int pool_size;
+    struct arena arena;         // state of the pool's instances
+    int arena_mapped;
+    // --metrics, rewritten after every job. NULL if not wanted
+    const char *metrics;
+    const char *metrics_prometheus;
+    pthread_mutex_t metrics_lock;   // guards report and the files
+    struct metrics_report report;
+};
+
+struct connection {
+    struct daemon *d;
+    int fd;
+};
+
+int daemon_read_full(int fd, void *buf, size_t size) {
+    char *p = (char *)buf;
+    while (size > 0) {
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 1;
+        }
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+int daemon_write_full(int fd, const void *buf, size_t size) {
+    const char *p = (const char *)buf;
+    while (size > 0) {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return 1;
+        }
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+// Reads the image at path into image, with program_load's error codes
+static int read_image(const char *path, struct blob *image) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return PROGRAM_OPEN_FAILED;
+    }
+    int error = PROGRAM_OK;
+    if (fread(image->inst_mem, 1, INST_MEM_SIZE, file) != INST_MEM_SIZE) {
+        error = PROGRAM_SHORT_INST_MEM;
+    } else if (fread(image->data_mem, 1, DATA_MEM_SIZE, file) != DATA_MEM_SIZE) {
+        error = PROGRAM_SHORT_DATA_MEM;
+    }
+    fclose(file);
+    return error;
+}
+
+static int find_image(const struct daemon *d, uint64_t hash, const struct blob *image) {
+    for (int i = 0; i < d->cached; i++) {
+        if (d->cache[i].hash == hash && memcmp(d->cache[i].prog->image, image, sizeof(struct blob)) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Returns the decoded program for image and its cache slot, -1 if it
+// could not be cached (the caller then frees it). Sets *hit if it was
+// already decoded
+static struct program *acquire_image(struct daemon *d, const struct blob *image, int *slot, int *hit) {
+    uint64_t hash = hash_bytes(image, sizeof(struct blob));
+    pthread_mutex_lock(&d->lock);
+    *slot = find_image(d, hash, image);
+    *hit = *slot >= 0;
+    if (*hit) {
+        d->cache[*slot].refs++;
+        d->cache[*slot].last_used = ++d->clock;
+        struct program *prog = d->cache[*slot].prog;
+        pthread_mutex_unlock(&d->lock);
+        return prog;
+    }
+    pthread_mutex_unlock(&d->lock);
+
+    // decoded outside the lock, so other jobs are not held up
+    struct program *prog = (struct program *)malloc(sizeof(struct program));
+    program_from_image(prog, image);
+
+    pthread_mutex_lock(&d->lock);
+    *slot = find_image(d, hash, image);
+    if (*slot >= 0) {
+        // another job decoded it meanwhile
+        program_free(prog);
+        free(prog);
+        d->cache[*slot].refs++;
+        d->cache[*slot].last_used = ++d->clock;
+        prog = d->cache[*slot].prog;
+        pthread_mutex_unlock(&d->lock);
+        return prog;
+    }
+    if (d->cached < d->cache_size) {
+        *slot = d->cached++;
+    } else {
+        // evict the least recently used image nobody is running
+        for (int i = 0; i < d->cached; i++) {
+            if (d->cache[i].refs == 0 && (*slot < 0 || d->cache[i].last_used < d->cache[*slot].last_used)) {
+                *slot = i;
+            }
+        }
+        if (*slot >= 0) {
+            program_free(d->cache[*slot].prog);
+            free(d->cache[*slot].prog);
+        }
+    }
+    if (*slot >= 0) {
+        d->cache[*slot].hash = hash;
+        d->cache[*slot].prog = prog;
+        d->cache[*slot].refs = 1;
+        d->cache[*slot].last_used = ++d->clock;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return prog;
+}
+
+static void release_image(struct daemon *d, struct program *prog, int slot) {
+    if (slot < 0) {
+        program_free(prog);
+        free(prog);
+        return;
+    }
+    pthread_mutex_lock(&d->lock);
+    d->cache[slot].refs--;
+    pthread_mutex_unlock(&d->lock);
+}
+
+// Waits for a free instance and turns it into a fresh instance of prog
+static struct pool_slot *acquire_slot(struct daemon *d, const struct program *prog) {
+    pthread_mutex_lock(&d->lock);
+    struct pool_slot *slot = NULL;
+    while (slot == NULL) {
+        for (int i = 0; i < d->pool_size && slot == NULL; i++) {
+            if (!d->pool[i].busy) {
+                slot = &d->pool[i];
+            }
+        }
+        if (slot == NULL) {
+            pthread_cond_wait(&d->slot_freed, &d->lock);
+        }
+    }
+    slot->busy = 1;
+    pthread_mutex_unlock(&d->lock);
+
+    vm_reset(&slot->vm, prog);
+    return slot;
+}
+
+static void release_slot(struct daemon *d, struct pool_slot *slot) {
+    pthread_mutex_lock(&d->lock);
+    slot->busy = 0;
+    pthread_cond_signal(&d->slot_freed);
+    pthread_mutex_unlock(&d->lock);
+}
+
+static int send_response(int fd, uint32_t stop, const struct vm *vm, uint64_t nanoseconds,
+                         uint32_t flags, const char *output, size_t output_size) {
+    struct daemon_response response = {0};
+    response.magic = DAEMON_MAGIC;
+    response.stop = stop;
+    response.instret = vm != NULL ? vm->instret : 0;
+    response.nanoseconds = nanoseconds;
+    response.flags = flags;
+    response.output_size = (uint32_t)output_size;
+    return daemon_write_full(fd, &response, sizeof(response)) ||
+           daemon_write_full(fd, output, output_size);
+}
+
+// Runs one job whose header has been read. Returns 1 if the connection
+// should be dropped
+static int serve_job(struct daemon *d, int fd, const struct daemon_request *request) {
+    if (request->magic != DAEMON_MAGIC ||
+        (request->image_kind == DAEMON_IMAGE_PATH && request->image_size >= DAEMON_MAX_PATH) ||
+        (request->image_kind == DAEMON_IMAGE_BYTES && request->image_size != sizeof(struct blob)) ||
+        request->image_kind > DAEMON_IMAGE_BYTES || request->input_size > DAEMON_MAX_INPUT)
+    {
+        // the rest of the request cannot be trusted
+        send_response(fd, DAEMON_BAD_REQUEST, NULL, 0, 0, NULL, 0);
+        return 1;
+    }
+
+    struct blob *image = (struct blob *)malloc(sizeof(struct blob));
+    char *reference = (char *)malloc(request->image_size + 1);
+    char *input = (char *)malloc(request->input_size + 1);
+    int error = daemon_read_full(fd, reference, request->image_size) ||
+                daemon_read_full(fd, input, request->input_size);
+    if (error) {
+        free(image);
+        free(reference);
+        free(input);
+        return 1;
+    }
+
+    int load_error = PROGRAM_OK;
+    if (request->image_kind == DAEMON_IMAGE_PATH) {
+        reference[request->image_size] = '\0';
+        load_error = read_image(reference, image);
+    } else {
+        memcpy(image, reference, sizeof(struct blob));
+    }
+    if (load_error != PROGRAM_OK) {
+        char message[128];
+        int size = snprintf(message, sizeof(message), "%s\n", program_error_message(load_error));
+        error = send_response(fd, DAEMON_BAD_IMAGE, NULL, 0, 0, message, size);
+        free(reference);
+        free(image);
+        free(input);
+        return error;
+    }
+
+    int cache_slot, hit;
+    struct program *prog = acquire_image(d, image, &cache_slot, &hit);
+    free(image);
+    struct pool_slot *slot = acquire_slot(d, prog);
+    console_buffer(&slot->console, input, request->input_size);
+    console_capture(&slot->console);
+    slot->vm.instret_limit = request->step_budget > 0 ? request->step_budget : UINT64_MAX;
+
+    // a job is named after its image path, images sent inline go unnamed
+    int measured = d->metrics != NULL || d->metrics_prometheus != NULL;
+    struct metrics job;
+    if (measured) {
+        metrics_start(&job, &slot->vm, request->image_kind == DAEMON_IMAGE_PATH ? reference : "", 1);
+        job.has_classes = 1;
+    }
+    free(reference);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int status = vm_run(&slot->vm);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t nanoseconds = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000 + end.tv_nsec - start.tv_nsec;
+    if (measured) {
+        metrics_stop(&job, &slot->vm, status, 1);
+        pthread_mutex_lock(&d->metrics_lock);
+        metrics_report_add(&d->report, &job);
+        if (d->metrics != NULL) {
+            metrics_write_json(&d->report, d->metrics);
+        }
+        if (d->metrics_prometheus != NULL) {
+            metrics_write_prometheus(&d->report, d->metrics_prometheus);
+        }
+        pthread_mutex_unlock(&d->metrics_lock);
+    }
+
+    uint32_t flags = (hit ? DAEMON_CACHE_HIT : 0) | (slot->console.output_truncated ? DAEMON_TRUNCATED : 0);
+    error = send_response(fd, status, &slot->vm, nanoseconds, flags,
+                          slot->console.output, slot->console.output_size);
+    release_slot(d, slot);
+    release_image(d, prog, cache_slot);
+    free(input);
+    return error;
+}
+
+static void *serve_connection(void *arg) {
+    struct connection *conn = (struct connection *)arg;
+    struct daemon_request request;
+    while (!daemon_read_full(conn->fd, &request, sizeof(request))) {
+        if (serve_job(conn->d, conn->fd, &request)) {
+            break;
+        }
+    }
+    close(conn->fd);
+    free(conn);
+    return NULL;
+}
+
+int daemon_run(const char *path, int pool_size, int cache_size,
+               const char *metrics, const char *metrics_prometheus) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+
+    struct daemon d;
+    memset(&d, 0, sizeof(d));
+    d.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (d.listen_fd < 0) {
+        return 1;
+    }
+    unlink(path);
+    if (bind(d.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(d.listen_fd, 64) != 0) {
+        close(d.listen_fd);
+        return 1;
+    }
+    // a client going away must not take the daemon with it
+    signal(SIGPIPE, SIG_IGN);
+
+    pthread_mutex_init(&d.lock, NULL);
+    pthread_cond_init(&d.slot_freed, NULL);
+    d.cache_size = cache_size;
+    d.cache = (struct cached_image *)calloc(cache_size, sizeof(struct cached_image));
+    d.pool_size = pool_size;
+    d.pool = (struct pool_slot *)calloc(pool_size, sizeof(struct pool_slot));
+    d.metrics = metrics;
+    d.metrics_prometheus = metrics_prometheus;
+    pthread_mutex_init(&d.metrics_lock, NULL);
+    metrics_report_init(&d.report);
+    // the instances are allocated up front, side by side in an arena if
+    // possible, on a blank image every job replaces through vm_reset
+    struct blob *blank = (struct blob *)calloc(1, sizeof(struct blob));
+    struct program *blank_prog = (struct program *)malloc(sizeof(struct program));
+    program_from_image(blank_prog, blank);
+    d.arena_mapped = arena_init(&d.arena, pool_size, -1) == 0;
+    for (int i = 0; i < pool_size; i++) {
+        if (d.arena_mapped) {
+            vm_init_context(&d.pool[i].vm, blank_prog, arena_alloc(&d.arena));
+        } else {
+            vm_init(&d.pool[i].vm, blank_prog);
+        }
+        console_init(&d.pool[i].console, &d.pool[i].vm.instret);
+        d.pool[i].vm.console = &d.pool[i].console;
+    }
+    program_free(blank_prog);
+    free(blank_prog);
+    free(blank);
+
+    for (;;) {
+        int fd = accept(d.listen_fd, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        struct connection *conn = (struct connection *)malloc(sizeof(struct connection));
+        conn->d = &d;
+        conn->fd = fd;
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serve_connection, conn) != 0) {
+            close(fd);
+            free(conn);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Daemon mode (vm_riskxvii --daemon <socket>). Jobs arrive over a Unix
+    socket, every connection is served by its own thread and may send
+    any number of jobs one after another. A job is a daemon_request
+    followed by image_size bytes of image reference (a path the daemon
+    reads, or the image itself) and input_size bytes of guest input. The
+    reply is a daemon_response followed by output_size bytes of guest
+    output, exactly what vm_riskxvii would have printed.
+
+    Images are kept pre-decoded in a cache keyed by a hash of their
+    content, so a path is only read, not decoded again, unless the file
+    changed. Jobs run on a fixed pool of instances which are reset, not
+    reallocated, between jobs; a job waits for a free instance.
+
+    Both ends run on the same host, fields are in host byte order.
+*/
+#define DAEMON_MAGIC 0x31445852     // "RXD1"
+
+// Image references
+#define DAEMON_IMAGE_PATH 0
+#define DAEMON_IMAGE_BYTES 1
+
+#define DAEMON_MAX_PATH 4096
+#define DAEMON_MAX_INPUT (16 << 20)
+
+// Stop reasons, besides the vm statuses (see vm.h). VM_RUNNING means
+// the step budget ran out
+#define DAEMON_BAD_IMAGE 16     // the output holds the load error
+#define DAEMON_BAD_REQUEST 17
+
+// Response flags
+#define DAEMON_CACHE_HIT 1      // the image was already decoded
+#define DAEMON_TRUNCATED 2      // output stopped at CONSOLE_MAX_OUTPUT
+
+#define DAEMON_DEFAULT_POOL 4
+#define DAEMON_DEFAULT_CACHE 32
+
+struct daemon_request {
+    uint32_t magic;
+    uint32_t image_kind;        // DAEMON_IMAGE_PATH or DAEMON_IMAGE_BYTES
+    uint32_t image_size;
+    uint32_t input_size;
+    uint64_t step_budget;       // instructions, 0 for no limit
+};
+
+struct daemon_response {
+    uint32_t magic;
+    uint32_t stop;
+    uint64_t instret;
+    uint64_t nanoseconds;       // time running the guest
+    uint32_t flags;
+    uint32_t output_size;
+};
+
+// Serves jobs on a Unix socket at path until killed, running at most
+// pool_size guests at once and caching cache_size decoded images. The
+// metrics of the jobs so far are rewritten after each to the files
+// metrics (JSON) and metrics_prometheus, either of which may be NULL
+// (see metrics.h). Returns 1 if the socket cannot be set up
+int daemon_run(const char *path, int pool_size, int cache_size,
+               const char *metrics, const char *metrics_prometheus);
+
+// Reads or writes exactly size bytes, retrying short transfers.
+// Return 1 on error or end of file
+int daemon_read_full(int fd, void *buf, size_t size);
+int daemon_write_full(int fd, const void *buf, size_t size);
+
+#endif // DAEMON_H
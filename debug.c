@@ -0,0 +1,346 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "helper.h"
+#include "memory_handling.h"
+#include "program.h"
+#include "vm.h"
+#include "debug.h"
+#include "bulk.h"
+#include "opcodes.h"
+
+static void debug_init(struct debugger *dbg) {
+    memset(dbg, 0, sizeof(struct debugger));
+    dbg->listen_fd = -1;
+}
+
+int debug_open_socket(struct debugger *dbg, const char *path) {
+    debug_init(dbg);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+
+    dbg->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (dbg->listen_fd < 0) {
+        return 1;
+    }
+    unlink(path);
+    if (bind(dbg->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(dbg->listen_fd, 1) != 0) {
+        close(dbg->listen_fd);
+        dbg->listen_fd = -1;
+        return 1;
+    }
+    dbg->socket_path = strdup(path);
+
+    fprintf(stderr, "Waiting for a debugger on %s\n", path);
+    int fd = accept(dbg->listen_fd, NULL, NULL);
+    if (fd < 0) {
+        debug_close(dbg);
+        return 1;
+    }
+    dbg->in = fdopen(fd, "r");
+    dbg->out = fdopen(dup(fd), "w");
+    return 0;
+}
+
+int debug_open_script(struct debugger *dbg, const char *path) {
+    debug_init(dbg);
+    dbg->in = fopen(path, "r");
+    dbg->out = stderr;
+    return dbg->in == NULL;
+}
+
+void debug_close(struct debugger *dbg) {
+    if (dbg->in != NULL) {
+        fclose(dbg->in);
+        dbg->in = NULL;
+    }
+    if (dbg->out != NULL && dbg->out != stderr) {
+        fclose(dbg->out);
+    }
+    dbg->out = NULL;
+    if (dbg->listen_fd >= 0) {
+        close(dbg->listen_fd);
+        unlink(dbg->socket_path);
+        dbg->listen_fd = -1;
+    }
+    free(dbg->socket_path);
+    dbg->socket_path = NULL;
+}
+
+// Keeps replies in order with the guest's own output
+static void reply(struct debugger *dbg, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void reply(struct debugger *dbg, const char *format, ...) {
+    fflush(stdout);
+    va_list args;
+    va_start(args, format);
+    vfprintf(dbg->out, format, args);
+    va_end(args);
+    fflush(dbg->out);
+}
+
+// Whether operation may write memory: the stores, bulk routines
+// included, and every atomic but lr.w
+static int writes_memory(int operation) {
+    return (operation >= OP_SB && operation <= OP_SW) ||
+           operation == OP_SC_W || operation == OP_AMOSWAP_W || operation == OP_AMOADD_W;
+}
+
+// Restores instruction index from the program, then patches it in if
+// the debugger needs to see it
+static void patch(struct debugger *dbg, const struct vm *vm, int index) {
+    dbg->decoded[index] = vm->program->decoded[index];
+    int op = dbg->decoded[index].operation;
+    if (dbg->breakpoint[index] || (dbg->num_watch > 0 && writes_memory(op))) {
+        dbg->decoded[index].operation = VM_TRAP_OPERATION;
+    }
+}
+
+static void patch_all(struct debugger *dbg, const struct vm *vm) {
+    for (int i = 0; i < NUM_INSTRUCTIONS; i++) {
+        patch(dbg, vm, i);
+    }
+}
+
+// Index of the watchpoint the instruction at pc stores to, -1 if none
+static int watched_store(const struct debugger *dbg, const struct vm *vm) {
+    int pc = vm->pc;
+    if (dbg->num_watch == 0 || pc < 0 || pc >= INST_MEM_SIZE || pc % 4 != 0) {
+        return -1;
+    }
+    const struct decoded_instruction *inst = &vm->program->decoded[pc / 4];
+    if (!writes_memory(inst->operation)) {
+        return -1;
+    }
+    const int *R = vm->reg_bank;
+    int address, size;
+    if (inst->operation >= OP_SC_W) {
+        // an atomic's word, reported even if sc.w then fails
+        address = R[inst->rs1];
+        size = 4;
+    } else {
+        address = R[inst->rs1] + inst->imm;
+        size = 1 << (inst->operation - OP_SB);
+        // a bulk routine writes its destination instead (see bulk.h)
+        if (address == BULK_MEMCPY || address == BULK_MEMSET) {
+            address = R[10];
+            size = R[12];
+        } else if (address == BULK_VADD) {
+            address = R[10];
+            size = R[13] * 4;
+        }
+    }
+    for (int i = 0; i < dbg->num_watch; i++) {
+        const struct watchpoint *w = &dbg->watch[i];
+        if (address < w->address + w->size && w->address < address + size) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Executes the instruction at pc as the program has it. *hit is set to
+// the watchpoint it stores to, -1 if none
+static int execute_one(struct debugger *dbg, struct vm *vm, int *hit) {
+    *hit = watched_store(dbg, vm);
+    int pc = vm->pc;
+    if (pc < 0 || pc >= INST_MEM_SIZE || pc % 4 != 0 || dbg->decoded[pc / 4].operation != VM_TRAP_OPERATION) {
+        return vm_step(vm);
+    }
+    dbg->decoded[pc / 4] = vm->program->decoded[pc / 4];
+    int status = vm_step(vm);
+    patch(dbg, vm, pc / 4);
+    return status;
+}
+
+// Reads the guest byte at address, returns 0 if it is not mapped
+static int read_byte(const struct vm *vm, int address, unsigned char *value) {
+    if (address >= 0 && address < 0x0400) {
+        *value = (unsigned char)vm->blob->inst_mem[address];
+        return 1;
+    }
+    if (address >= 0x0400 && address < 0x0800) {
+        *value = (unsigned char)vm->blob->data_mem[address - 0x0400];
+        return 1;
+    }
+    MemoryBank *bank = heap_get_ptr(vm->heap, address);
+    if (bank == NULL) {
+        return 0;
+    }
+    *value = (unsigned char)bank->data[address % BANK_SIZE];
+    return 1;
+}
+
+static void print_memory(struct debugger *dbg, const struct vm *vm, int address, int size) {
+    for (int line = 0; line < size; line += 16) {
+        char text[16 * 3 + 1] = "";
+        for (int i = line; i < size && i < line + 16; i++) {
+            unsigned char value;
+            if (read_byte(vm, address + i, &value)) {
+                sprintf(text + (i - line) * 3, " %02x", value);
+            } else {
+                strcpy(text + (i - line) * 3, " --");
+            }
+        }
+        reply(dbg, "0x%04x:%s\n", address + line, text);
+    }
+}
+
+static const char *status_name(int status) {
+    switch (status) {
+        case VM_HALTED: return "halted";
+        case VM_FINISHED: return "finished";
+        case VM_ERROR: return "error";
+    }
+    return "unknown";
+}
+
+// Reports where the guest stopped, or that it has finished
+static void report_stop(struct debugger *dbg, const struct vm *vm, int status, const char *reason, int hit) {
+    if (status != VM_RUNNING) {
+        reply(dbg, "exited %s\n", status_name(status));
+    } else if (hit >= 0) {
+        reply(dbg, "stopped watchpoint 0x%04x pc 0x%08x\n", dbg->watch[hit].address, vm->pc);
+    } else {
+        reply(dbg, "stopped %s pc 0x%08x\n", reason, vm->pc);
+    }
+}
+
+// Runs until a breakpoint, a watched store or the end of the guest
+static int resume(struct debugger *dbg, struct vm *vm) {
+    int hit;
+    // the current instruction may be patched, so it is stepped over first
+    int status = execute_one(dbg, vm, &hit);
+    while (status == VM_RUNNING && hit < 0) {
+        status = vm_run(vm);
+        if (status != VM_TRAP) {
+            break;
+        }
+        if (dbg->breakpoint[vm->pc / 4]) {
+            status = VM_RUNNING;
+            break;
+        }
+        status = execute_one(dbg, vm, &hit);
+    }
+    report_stop(dbg, vm, status, "breakpoint", hit);
+    return status;
+}
+
+static int parse_number(const char *text, int *value) {
+    if (text == NULL) {
+        return 0;
+    }
+    char *end;
+    long number = strtol(text, &end, 0);
+    *value = (int)number;
+    return end != text && *end == '\0';
+}
+
+// Runs one command line, returns the vm status afterwards
+static int command(struct debugger *dbg, struct vm *vm, char *line) {
+    char *name = strtok(line, " \t\r\n");
+    char *arg1 = strtok(NULL, " \t\r\n");
+    char *arg2 = strtok(NULL, " \t\r\n");
+    int value, size;
+    if (name == NULL) {
+        return VM_RUNNING;
+    }
+
+    if (strcmp(name, "break") == 0 || strcmp(name, "delete") == 0) {
+        if (!parse_number(arg1, &value) || value < 0 || value >= INST_MEM_SIZE || value % 4 != 0) {
+            reply(dbg, "error expected an instruction address\n");
+            return VM_RUNNING;
+        }
+        dbg->breakpoint[value / 4] = strcmp(name, "break") == 0;
+        patch(dbg, vm, value / 4);
+    } else if (strcmp(name, "watch") == 0) {
+        size = 4;
+        if (!parse_number(arg1, &value) || (arg2 != NULL && (!parse_number(arg2, &size) || size <= 0))) {
+            reply(dbg, "error expected an address and a size\n");
+            return VM_RUNNING;
+        }
+        if (dbg->num_watch == MAX_WATCHPOINTS) {
+            reply(dbg, "error too many watchpoints\n");
+            return VM_RUNNING;
+        }
+        dbg->watch[dbg->num_watch].address = value;
+        dbg->watch[dbg->num_watch].size = size;
+        dbg->num_watch++;
+        patch_all(dbg, vm);
+    } else if (strcmp(name, "unwatch") == 0) {
+        if (!parse_number(arg1, &value)) {
+            reply(dbg, "error expected an address\n");
+            return VM_RUNNING;
+        }
+        for (int i = 0; i < dbg->num_watch; i++) {
+            if (dbg->watch[i].address == value) {
+                dbg->watch[i--] = dbg->watch[--dbg->num_watch];
+            }
+        }
+        patch_all(dbg, vm);
+    } else if (strcmp(name, "step") == 0) {
+        int count = 1;
+        if (arg1 != NULL && (!parse_number(arg1, &count) || count <= 0)) {
+            reply(dbg, "error expected a number of instructions\n");
+            return VM_RUNNING;
+        }
+        int status = VM_RUNNING, hit = -1;
+        for (int i = 0; i < count && status == VM_RUNNING && hit < 0; i++) {
+            status = execute_one(dbg, vm, &hit);
+        }
+        report_stop(dbg, vm, status, "step", hit);
+        return status;
+    } else if (strcmp(name, "continue") == 0) {
+        return resume(dbg, vm);
+    } else if (strcmp(name, "regs") == 0) {
+        reply(dbg, "PC = 0x%08x;\n", vm->pc);
+        for (int i = 0; i < REG_BANK_SIZE; i++) {
+            reply(dbg, "R[%d] = 0x%08x;\n", i, vm->reg_bank[i]);
+        }
+    } else if (strcmp(name, "mem") == 0) {
+        size = 16;
+        if (!parse_number(arg1, &value) || (arg2 != NULL && (!parse_number(arg2, &size) || size <= 0))) {
+            reply(dbg, "error expected an address and a size\n");
+            return VM_RUNNING;
+        }
+        print_memory(dbg, vm, value, size);
+    } else if (strcmp(name, "quit") == 0) {
+        reply(dbg, "ok\n");
+        return VM_HALTED;
+    } else {
+        reply(dbg, "error unknown command %s\n", name);
+        return VM_RUNNING;
+    }
+    reply(dbg, "ok\n");
+    return VM_RUNNING;
+}
+
+int debug_run(struct debugger *dbg, struct vm *vm) {
+    memcpy(dbg->decoded, vm->program->decoded, sizeof(dbg->decoded));
+    vm->decoded = dbg->decoded;
+    report_stop(dbg, vm, VM_RUNNING, "entry", -1);
+
+    int status = VM_RUNNING;
+    char line[256];
+    while (status == VM_RUNNING && fgets(line, sizeof(line), dbg->in) != NULL) {
+        status = command(dbg, vm, line);
+    }
+
+    // out of commands, finish without the patches
+    vm->decoded = vm->program->decoded;
+    if (status == VM_RUNNING) {
+        status = vm_run(vm);
+    }
+    return status;
+}
@@ -0,0 +1,70 @@
+#ifndef DEBUG_H
+#define DEBUG_H
+
+#include <stdio.h>
+
+#include "helper.h"
+#include "vm.h"
+
+#define MAX_WATCHPOINTS 16
+
+/*
+    Debugger for one VM instance, driven by text commands, one per line:
+
+        break <pc>              stop before the instruction at pc
+        delete <pc>             remove that breakpoint
+        watch <address> [size]  stop after a store or atomic write to any
+                                of size bytes (default 4) of data memory
+                                or the heap
+        unwatch <address>
+        step [n]                execute n instructions (default 1)
+        continue                run until a breakpoint, watchpoint or exit
+        regs                    print pc and registers
+        mem <address> [size]    print size bytes (default 16)
+        quit                    stop the guest
+
+    Each command is answered by its output, if any, then "ok" or
+    "error <reason>", except step and continue: they are answered by
+    "stopped <reason> pc <pc>" (reason: step, breakpoint or watchpoint
+    <address>), or "exited <status>" once the guest has finished. The
+    session opens with "stopped entry pc 0x00000000". When the
+    commands run out the guest runs to completion without stopping.
+
+    Breakpoints patch the vm's private copy of the pre-decoded
+    instructions with VM_TRAP_OPERATION, and watchpoints patch every
+    store and every atomic but lr.w (sc.w stops even if it fails), so
+    nothing is checked per instruction: with no breakpoints or
+    watchpoints set the guest runs in vm_run at full interpreter speed.
+    The bulk routines (see bulk.h) that write memory are watched over
+    their destination range, other virtual routines are not watched.
+*/
+
+struct watchpoint {
+    int address;
+    int size;
+};
+
+struct debugger {
+    FILE *in;
+    FILE *out;
+    int listen_fd;              // socket mode, -1 otherwise
+    char *socket_path;
+    struct decoded_instruction decoded[NUM_INSTRUCTIONS];   // patched copy
+    char breakpoint[NUM_INSTRUCTIONS];
+    struct watchpoint watch[MAX_WATCHPOINTS];
+    int num_watch;
+};
+
+// Waits for a client on a Unix socket at path. Returns 1 on error
+int debug_open_socket(struct debugger *dbg, const char *path);
+
+// Reads commands from the file at path (e.g. a pipe), answering on stderr.
+// Returns 1 on error
+int debug_open_script(struct debugger *dbg, const char *path);
+
+// Runs vm under the debugger, returns its final status
+int debug_run(struct debugger *dbg, struct vm *vm);
+
+void debug_close(struct debugger *dbg);
+
+#endif // DEBUG_H
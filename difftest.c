@@ -0,0 +1,358 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "aot.h"
+#include "block_cache.h"
+#include "console.h"
+#include "disasm.h"
+#include "gen.h"
+#include "program.h"
+#include "tier.h"
+#include "vm.h"
+
+/*
+    Differential testing of the execution engines.
+
+    Every engine runs the image in lockstep with the reference interpreter
+    (vm_step): the engine runs one block, the reference steps until it has
+    retired as many instructions, and the two instances must then agree on
+    their status, pc, registers, memory and heap. The first divergence is
+    reported with a disassembly of the block that caused it.
+
+    Guest output goes to /dev/null, both instances read the same input
+    from memory.
+*/
+
+#define ENGINE_BLOCK 0
+#define ENGINE_AOT 1
+#define ENGINE_TIERED 2
+
+// Promotes blocks almost at once, so every tier and switch between them runs
+#define TIER_THRESHOLD 2
+
+// Input generated for each random program
+#define RANDOM_INPUT (1 << 16)
+
+// Images that never stop are cut off, and count as agreeing
+#define MAX_INSTRUCTIONS 10000000
+
+static const char *engine_names[] = {"block", "aot", "tiered"};
+
+struct engine {
+    int kind;
+    struct block_cache *bc;
+    struct aot_module *aot;
+    struct tier_manager *tm;
+};
+
+// Runs one block of the engine under test
+static int engine_step(struct engine *e, struct vm *vm) {
+    if (e->kind == ENGINE_BLOCK) {
+        return block_cache_step(e->bc, vm);
+    }
+    if (e->kind == ENGINE_TIERED) {
+        return tier_step(e->tm, vm);
+    }
+    vm->instret_limit = vm->instret + 1;
+    return e->aot->run(vm);
+}
+
+static const char *status_name(int status) {
+    switch (status) {
+        case VM_RUNNING: return "running";
+        case VM_HALTED: return "halted";
+        case VM_FINISHED: return "finished";
+        case VM_ERROR: return "error";
+    }
+    return "unknown";
+}
+
+// Prints the count instructions retired from pc (straight-line by
+// construction: a block only branches at its end)
+static void print_block(const struct vm *vm, int pc, uint64_t count) {
+    for (uint64_t i = 0; i < count && pc >= 0 && pc < INST_MEM_SIZE; i++, pc += 4) {
+        struct decoded_instruction inst;
+        int raw;
+        if (pc % 4 == 0) {
+            inst = vm->program->decoded[pc / 4];
+            raw = vm->program->raw[pc / 4];
+        } else {
+            raw = get_instruction(vm->blob->inst_mem, pc);
+            inst = decode_instruction(raw);
+        }
+        char text[64];
+        disassemble(&inst, pc, text, sizeof(text));
+        fprintf(stderr, "    %08x:  %08x  %s\n", pc, (uint32_t)raw, text);
+    }
+}
+
+static void difference(FILE *report, const char *format, ...) {
+    if (report != NULL) {
+        va_list args;
+        va_start(args, format);
+        vfprintf(report, format, args);
+        va_end(args);
+    }
+}
+
+// Returns how many differences there are between the two instances,
+// printing each of them to report unless it is NULL
+static int compare(const struct vm *ref, const struct vm *test, const char *engine, FILE *report) {
+    int differences = 0;
+    if (ref->pc != test->pc) {
+        difference(report, "  pc: reference 0x%08x, %s 0x%08x\n", ref->pc, engine, test->pc);
+        differences++;
+    }
+    for (int i = 0; i < REG_BANK_SIZE; i++) {
+        if (ref->reg_bank[i] != test->reg_bank[i]) {
+            difference(report, "  x%d: reference 0x%08x, %s 0x%08x\n",
+                       i, ref->reg_bank[i], engine, test->reg_bank[i]);
+            differences++;
+        }
+    }
+    for (int i = 0; i < DATA_MEM_SIZE; i++) {
+        if (ref->blob->data_mem[i] != test->blob->data_mem[i]) {
+            difference(report, "  memory 0x%04x: reference 0x%02x, %s 0x%02x\n", 0x0400 + i,
+                       (unsigned char)ref->blob->data_mem[i], engine, (unsigned char)test->blob->data_mem[i]);
+            differences++;
+        }
+    }
+    if (memcmp(ref->blob->inst_mem, test->blob->inst_mem, INST_MEM_SIZE) != 0) {
+        difference(report, "  instruction memory differs\n");
+        differences++;
+    }
+    if (memcmp(ref->virt_mem, test->virt_mem, VIRT_MEM_SIZE) != 0) {
+        difference(report, "  virtual routine memory differs\n");
+        differences++;
+    }
+    const MemoryBank *a = ref->heap->head, *b = test->heap->head;
+    for (; a != NULL && b != NULL; a = a->next, b = b->next) {
+        if (a->start_address != b->start_address || a->allocated != b->allocated ||
+            a->next_in_chunk != b->next_in_chunk)
+        {
+            difference(report, "  heap bank 0x%04x: allocation state differs\n", a->start_address);
+            differences++;
+        } else if (memcmp(a->data, b->data, BANK_SIZE) != 0) {
+            for (int i = 0; i < BANK_SIZE; i++) {
+                if (a->data[i] != b->data[i]) {
+                    difference(report, "  heap 0x%04x: reference 0x%02x, %s 0x%02x\n", a->start_address + i,
+                               (unsigned char)a->data[i], engine, (unsigned char)b->data[i]);
+                    differences++;
+                }
+            }
+        }
+    }
+    if (a != NULL || b != NULL) {
+        difference(report, "  heap bank lists differ in length\n");
+        differences++;
+    }
+    return differences;
+}
+
+// Runs prog under e and the reference in lockstep. Returns 1 on divergence
+static int lockstep(const struct program *prog, const char *input, size_t input_size,
+                    struct engine *e, const char *name)
+{
+    struct vm ref, test;
+    struct console ref_console, test_console;
+    vm_init(&ref, prog);
+    vm_init(&test, prog);
+    console_init(&ref_console, &ref.instret);
+    console_init(&test_console, &test.instret);
+    console_buffer(&ref_console, input, input_size);
+    console_buffer(&test_console, input, input_size);
+    ref.console = &ref_console;
+    test.console = &test_console;
+
+    const char *engine = engine_names[e->kind];
+    int diverged = 0;
+    int status = VM_RUNNING;
+    while (status == VM_RUNNING && test.instret < MAX_INSTRUCTIONS) {
+        int block_pc = test.pc;
+        uint64_t block_start = test.instret;
+        status = engine_step(e, &test);
+
+        // the reference catches up
+        int ref_status = VM_RUNNING;
+        while (ref_status == VM_RUNNING && ref.instret < test.instret) {
+            ref_status = vm_step(&ref);
+        }
+
+        fflush(stdout);
+        if (ref_status != status || ref.instret != test.instret) {
+            fprintf(stderr, "%s: %s diverged after instruction %llu\n",
+                    name, engine, (unsigned long long)block_start);
+            fprintf(stderr, "  status: reference %s at instruction %llu, %s %s at instruction %llu\n",
+                    status_name(ref_status), (unsigned long long)ref.instret,
+                    engine, status_name(status), (unsigned long long)test.instret);
+            diverged = 1;
+        } else if (compare(&ref, &test, engine, NULL) != 0) {
+            fprintf(stderr, "%s: %s diverged after instruction %llu\n",
+                    name, engine, (unsigned long long)block_start);
+            compare(&ref, &test, engine, stderr);
+            diverged = 1;
+        }
+        if (diverged) {
+            fprintf(stderr, "  block:\n");
+            print_block(&test, block_pc, test.instret - block_start);
+            break;
+        }
+    }
+
+    console_close(&ref_console);
+    console_close(&test_console);
+    vm_free(&ref);
+    vm_free(&test);
+    return diverged;
+}
+
+// Runs prog under the block engine, its AOT translation if given, and
+// the tiered engine
+static int difftest(const struct program *prog, const char *input, size_t input_size,
+                    struct aot_module *aot, const char *name)
+{
+    int failed = 0;
+
+    struct block_cache *bc = (struct block_cache *)malloc(sizeof(struct block_cache));
+    block_cache_init(bc, prog);
+    struct engine block = {ENGINE_BLOCK, bc, NULL, NULL};
+    failed |= lockstep(prog, input, input_size, &block, name);
+    block_cache_free(bc);
+    free(bc);
+
+    if (aot != NULL) {
+        struct engine translated = {ENGINE_AOT, NULL, aot, NULL};
+        failed |= lockstep(prog, input, input_size, &translated, name);
+    }
+
+    // the tiers in turn, with aot (if given) as the native tier
+    struct tier_manager *tm = (struct tier_manager *)malloc(sizeof(struct tier_manager));
+    tier_init(tm, prog, aot, TIER_AUTO, TIER_THRESHOLD);
+    struct engine tiered = {ENGINE_TIERED, NULL, NULL, tm};
+    failed |= lockstep(prog, input, input_size, &tiered, name);
+    tier_free(tm);
+    free(tm);
+    return failed;
+}
+
+static char *read_file(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *data = (char *)malloc(length > 0 ? length : 1);
+    *size = fread(data, 1, length > 0 ? length : 0, file);
+    fclose(file);
+    return data;
+}
+
+static void usage(void) {
+    printf("Usage: ./riskxvii-difftest [--aot <image.so>] [--input <file>] <image>\n");
+    printf("       ./riskxvii-difftest --random <seed> <count>\n");
+}
+
+// Checks the image (and its AOT translation) against the reference
+static int difftest_image(const char *path, const char *input_path, const char *aot_path) {
+    struct program *prog = (struct program *)malloc(sizeof(struct program));
+    int error = program_load(prog, path);
+    if (error != PROGRAM_OK) {
+        program_print_error(error);
+        free(prog);
+        return 1;
+    }
+    size_t input_size = 0;
+    char *input = NULL;
+    struct aot_module aot = {0};
+    if (input_path != NULL && (input = read_file(input_path, &input_size)) == NULL) {
+        printf("Could not open file.\n");
+        error = 1;
+    } else if (aot_path != NULL && (error = aot_load(&aot, aot_path, prog)) != AOT_OK) {
+        printf(error == AOT_IMAGE_MISMATCH ? "Error: %s was translated from a different image.\n"
+                                           : "Error: Unable to load %s.\n", aot_path);
+    }
+    if (error) {
+        free(input);
+        program_free(prog);
+        free(prog);
+        return 1;
+    }
+
+    // guest output is not compared, keep it out of the report
+    fflush(stdout);
+    FILE *guest_stdout = freopen("/dev/null", "w", stdout);
+    int failed = guest_stdout == NULL ||
+                 difftest(prog, input != NULL ? input : "", input_size, aot_path != NULL ? &aot : NULL, path);
+    if (!failed) {
+        fprintf(stderr, "%s: engines agree\n", path);
+    }
+
+    aot_unload(&aot);
+    free(input);
+    program_free(prog);
+    free(prog);
+    return failed;
+}
+
+// Checks count generated programs (see gen.h), from seed to seed + count - 1.
+// Sizes, loop shapes and instruction mixes vary with the seed
+static int difftest_random(uint32_t seed, int count) {
+    struct program *prog = (struct program *)malloc(sizeof(struct program));
+    struct blob *image = (struct blob *)malloc(sizeof(struct blob));
+    char *input = (char *)malloc(RANDOM_INPUT);
+    int failed = freopen("/dev/null", "w", stdout) == NULL;
+    for (int i = 0; i < count && !failed; i++) {
+        struct gen_options opts;
+        gen_default_options(&opts);
+        opts.seed = seed + i;
+        opts.size = 32 + (int)(opts.seed * 37 % (NUM_INSTRUCTIONS - 31));
+        opts.loops = 1 + (int)(opts.seed % 5);
+        opts.iterations = 1 + (int)(opts.seed * 7 % 13);
+        opts.repeat = 1 + (int)(opts.seed % 3);
+        opts.mix.branch = (int)(opts.seed % 6);
+        size_t input_size = gen_image(image, &opts, input, RANDOM_INPUT);
+
+        char name[32];
+        snprintf(name, sizeof(name), "random seed %u", opts.seed);
+        program_from_image(prog, image);
+        failed |= difftest(prog, input, input_size, NULL, name);
+        program_free(prog);
+    }
+    if (!failed) {
+        fprintf(stderr, "%d random programs: engines agree\n", count);
+    }
+    free(input);
+    free(image);
+    free(prog);
+    return failed;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 4 && strcmp(argv[1], "--random") == 0) {
+        return difftest_random((uint32_t)strtoul(argv[2], NULL, 10), atoi(argv[3]));
+    }
+
+    const char *aot_path = NULL;
+    const char *input_path = NULL;
+    int argi = 1;
+    while (argi + 1 < argc && strncmp(argv[argi], "--", 2) == 0) {
+        if (strcmp(argv[argi], "--aot") == 0) {
+            aot_path = argv[++argi];
+        } else if (strcmp(argv[argi], "--input") == 0) {
+            input_path = argv[++argi];
+        } else {
+            break;
+        }
+        argi++;
+    }
+    if (argi + 1 != argc) {
+        usage();
+        return 1;
+    }
+    return difftest_image(argv[argi], input_path, aot_path);
+}
@@ -0,0 +1,44 @@
+#!/bin/bash
+
+# Runs every testcase image under each fast engine in lockstep with the
+# reference interpreter (see difftest.c), then generated programs (see gen.h):
+# a few translated ahead of time, and a larger batch checked in memory
+random_seed=1
+random_count=200
+aot_count=10
+tmp_dir="$(mktemp -d)"
+trap 'rm -rf "${tmp_dir}"' EXIT
+
+failed=0
+for ((seed = random_seed; seed < random_seed + aot_count; seed++)); do
+    ./riskxvii-gen --seed "${seed}" "${tmp_dir}/gen_${seed}.mi" "${tmp_dir}/gen_${seed}.in"
+done
+
+for mi_file in testcases/*.mi "${tmp_dir}"/gen_*.mi; do
+    filename="$(basename "${mi_file}" .mi)"
+    input_file="in/${filename}.in"
+    if [ ! -f "${input_file}" ]; then
+        input_file="$(dirname "${mi_file}")/${filename}.in"
+    fi
+    if [ ! -f "${input_file}" ]; then
+        input_file="/dev/null"
+    fi
+
+    # the host clocks it reads differ between the instances (see vm.h),
+    # its instruction counts are checked by test.sh
+    if [ "${filename}" = "counters" ]; then
+        echo "${mi_file}: reads the host clocks, skipped"
+        continue
+    fi
+
+    # images the loader rejects are covered by test.sh
+    if ! ./riskxvii-aot "${mi_file}" "${tmp_dir}/${filename}.c" > /dev/null; then
+        echo "${mi_file}: not a loadable image, skipped"
+        continue
+    fi
+    gcc -O2 -shared -fPIC -I. -o "${tmp_dir}/${filename}.so" "${tmp_dir}/${filename}.c"
+    ./riskxvii-difftest --aot "${tmp_dir}/${filename}.so" --input "${input_file}" "${mi_file}" || failed=1
+done
+
+./riskxvii-difftest --random "${random_seed}" "${random_count}" || failed=1
+exit ${failed}
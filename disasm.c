@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdint.h>
+
+#include "helper.h"
+#include "disasm.h"
+#include "opcodes.h"
+
+static const char *operation_names[OP_LIMIT] = {
+#define X(number, name, mnemonic, handler, syntax, class, major, funct3, funct7) [OP_##name] = mnemonic,
+    RV32_OPERATIONS(X)
+#undef X
+};
+
+static const enum operation_syntax operation_syntaxes[OP_LIMIT] = {
+#define X(number, name, mnemonic, handler, syntax, class, major, funct3, funct7) [OP_##name] = syntax,
+    RV32_OPERATIONS(X)
+#undef X
+};
+
+const char *operation_name(int operation) {
+    if (operation >= 0 && operation < OP_LIMIT && operation_names[operation] != NULL) {
+        return operation_names[operation];
+    }
+    return "unknown";
+}
+
+void disassemble(const struct decoded_instruction *inst, int pc, char *buf, size_t size) {
+    int op = inst->operation;
+    const char *name = operation_name(op);
+    if (op < 0 || op >= OP_LIMIT || operation_names[op] == NULL) {
+        snprintf(buf, size, "%s", name);
+        return;
+    }
+    switch (operation_syntaxes[op]) {
+        case SYNTAX_R:
+            snprintf(buf, size, "%s x%u, x%u, x%u", name, inst->rd, inst->rs1, inst->rs2);
+            break;
+        case SYNTAX_I:
+            snprintf(buf, size, "%s x%u, x%u, %d", name, inst->rd, inst->rs1, inst->imm);
+            break;
+        case SYNTAX_U:
+            snprintf(buf, size, "%s x%u, 0x%x", name, inst->rd, (uint32_t)inst->imm >> 12);
+            break;
+        case SYNTAX_MEM_RD:
+            snprintf(buf, size, "%s x%u, %d(x%u)", name, inst->rd, inst->imm, inst->rs1);
+            break;
+        case SYNTAX_MEM_RS2:
+            snprintf(buf, size, "%s x%u, %d(x%u)", name, inst->rs2, inst->imm, inst->rs1);
+            break;
+        case SYNTAX_BRANCH:
+            snprintf(buf, size, "%s x%u, x%u, 0x%x", name, inst->rs1, inst->rs2, pc + inst->imm);
+            break;
+        case SYNTAX_JUMP:
+            snprintf(buf, size, "%s x%u, 0x%x", name, inst->rd, pc + inst->imm);
+            break;
+        case SYNTAX_LR:
+            snprintf(buf, size, "%s x%u, (x%u)", name, inst->rd, inst->rs1);
+            break;
+        case SYNTAX_AMO:
+            snprintf(buf, size, "%s x%u, x%u, (x%u)", name, inst->rd, inst->rs2, inst->rs1);
+            break;
+    }
+}
+
+const char *virtual_routine_name(int address) {
+    switch (address) {
+        case 0x0800: return "console write character";
+        case 0x0804: return "console write signed integer";
+        case 0x0808: return "console write unsigned integer (hex)";
+        case 0x080C: return "halt";
+        case 0x0812: return "console read character";
+        case 0x0816: return "console read signed integer";
+        case 0x0820: return "dump pc";
+        case 0x0824: return "dump register banks";
+        case 0x0828: return "dump memory word";
+        case 0x0830: return "malloc";
+        case 0x0834: return "free";
+        case 0x0838: return "memcpy";
+        case 0x083C: return "memset";
+        case 0x0840: return "memcmp";
+        case 0x0844: return "vadd";
+        case 0x0848: return "hart id";
+        case 0x084C: return "barrier";
+        case 0x0850: return "instret counter";
+        case 0x0854: return "instret counter, high word";
+        case 0x0858: return "time counter";
+        case 0x085C: return "time counter, high word";
+        case 0x0860: return "cycle counter";
+        case 0x0864: return "cycle counter, high word";
+    }
+    return NULL;
+}
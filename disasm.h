@@ -0,0 +1,19 @@
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stddef.h>
+
+#include "helper.h"
+
+// Mnemonic of a decoded operation number (see opcodes.h), "unknown"
+// otherwise
+const char *operation_name(int operation);
+
+// Writes the assembly of inst at pc to buf, e.g. "addi x5, x6, -4".
+// Branch and jump targets are printed as absolute addresses
+void disassemble(const struct decoded_instruction *inst, int pc, char *buf, size_t size);
+
+// Name of the virtual routine at address, NULL if there is none
+const char *virtual_routine_name(int address);
+
+#endif // DISASM_H
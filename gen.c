@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "helper.h"
+#include "program.h"
+#include "gen.h"
+
+#define REG_LAST_RANDOM 25
+#define REG_INNER 26
+#define REG_OUTER 27
+#define REG_HEAP 28
+#define REG_SCRATCH 29
+#define REG_VIRTUAL 30
+#define REG_DATA 31
+
+#define HEAP_CHUNK 256
+
+// Instructions around loop bodies: decrement and back branch per loop
+// (plus setting the counter), the same for the outer loop, and the halt
+#define LOOP_OVERHEAD 2
+#define TAIL_OVERHEAD (LOOP_OVERHEAD + 1)
+
+#define OPCODE_OP 0b0110011
+#define OPCODE_OP_IMM 0b0010011
+#define OPCODE_LOAD 0b0000011
+
+struct writer {
+    char *code;
+    int n;              // next instruction index
+    uint32_t state;     // random number generator
+    int reads;          // console reads emitted
+};
+
+static uint32_t rng_next(struct writer *w) {
+    // xorshift32
+    uint32_t x = w->state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    w->state = x;
+    return x;
+}
+
+static uint32_t enc_r(int funct7, int rs2, int rs1, int funct3, int rd) {
+    return (uint32_t)funct7 << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | OPCODE_OP;
+}
+
+static uint32_t enc_i(int opcode, int imm, int rs1, int funct3, int rd) {
+    return ((uint32_t)imm & 0xFFF) << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | opcode;
+}
+
+static uint32_t enc_s(int imm, int rs2, int rs1, int funct3) {
+    return ((uint32_t)imm >> 5 & 0x7F) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 |
+           (imm & 0x1F) << 7 | 0b0100011;
+}
+
+static uint32_t enc_b(int imm, int rs2, int rs1, int funct3) {
+    uint32_t u = (uint32_t)imm;
+    return (u >> 12 & 1) << 31 | (u >> 5 & 0x3F) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 |
+           (u >> 1 & 0xF) << 8 | (u >> 11 & 1) << 7 | 0b1100011;
+}
+
+static uint32_t enc_u(uint32_t imm20, int rd) {
+    return imm20 << 12 | rd << 7 | 0b0110111;
+}
+
+static uint32_t enc_j(int imm, int rd) {
+    uint32_t u = (uint32_t)imm;
+    return (u >> 20 & 1) << 31 | (u >> 1 & 0x3FF) << 21 | (u >> 11 & 1) << 20 |
+           (u >> 12 & 0xFF) << 12 | rd << 7 | 0b1101111;
+}
+
+static void emit(struct writer *w, uint32_t word) {
+    for (int i = 0; i < 4; i++) {
+        w->code[w->n * 4 + i] = (char)(word >> (i * 8));
+    }
+    w->n++;
+}
+
+// Instructions emit_li needs for value
+static int li_length(int value) {
+    return value >= -2048 && value < 2048 ? 1 : 2;
+}
+
+// rd = value, in one or two instructions
+static void emit_li(struct writer *w, int rd, int value) {
+    if (li_length(value) == 1) {
+        emit(w, enc_i(OPCODE_OP_IMM, value, 0, 0b000, rd));
+        return;
+    }
+    // addi sign-extends, so round the upper part
+    uint32_t upper = ((uint32_t)value + 0x800) >> 12;
+    emit(w, enc_u(upper & 0xFFFFF, rd));
+    emit(w, enc_i(OPCODE_OP_IMM, value - (int)(upper << 12), rd, 0b000, rd));
+}
+
+static void emit_alu(struct writer *w, int rd, int rs1, int rs2) {
+    // RV32I register operations, then RV32M (funct7 1, every funct3)
+    static const int r_funct3[] = {0b000, 0b000, 0b100, 0b110, 0b111, 0b001, 0b101, 0b101, 0b010, 0b011,
+                                   0b000, 0b001, 0b010, 0b011, 0b100, 0b101, 0b110, 0b111};
+    static const int r_funct7[] = {0x00, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00,
+                                   0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01};
+    static const int i_funct3[] = {0b000, 0b100, 0b110, 0b111, 0b010, 0b011};
+    uint32_t r = rng_next(w) % 16;
+    int imm = (int)(rng_next(w) & 0xFFF) - 0x800;
+    if (r < 9) {
+        int k = (int)(rng_next(w) % 18);
+        emit(w, enc_r(r_funct7[k], rs2, rs1, r_funct3[k], rd));
+    } else if (r < 15) {
+        int k = (int)(rng_next(w) % 6);
+        if (k >= 4) {
+            // slti/sltiu go through the program-flow check: pc + imm must be
+            // a word in instruction memory
+            imm = (int)(rng_next(w) % (NUM_INSTRUCTIONS + 1)) * 4 - w->n * 4;
+        }
+        emit(w, enc_i(OPCODE_OP_IMM, imm, rs1, i_funct3[k], rd));
+    } else {
+        emit(w, enc_u(rng_next(w) & 0xFFFFF, rd));
+    }
+}
+
+// Aligned load or store at base + [0, limit)
+static void emit_memory(struct writer *w, int base, int limit, int rd, int rs2) {
+    static const int load_funct3[] = {0b000, 0b001, 0b010, 0b100, 0b101};
+    if (rng_next(w) & 1) {
+        int funct3 = load_funct3[rng_next(w) % 5];
+        int size = 1 << (funct3 & 3);
+        int offset = (int)(rng_next(w) % limit) & ~(size - 1);
+        emit(w, enc_i(OPCODE_LOAD, offset, base, funct3, rd));
+    } else {
+        int funct3 = (int)(rng_next(w) % 3);
+        int offset = (int)(rng_next(w) % limit) & ~((1 << funct3) - 1);
+        emit(w, enc_s(offset, rs2, base, funct3));
+    }
+}
+
+// Console write (char, int, hex) or read (char, int)
+static void emit_virtual(struct writer *w, int rd, int rs2) {
+    uint32_t r = rng_next(w) % 5;
+    if (r < 3) {
+        emit(w, enc_s((int)r * 4, rs2, REG_VIRTUAL, 0b010));
+    } else {
+        emit(w, enc_i(OPCODE_LOAD, r == 3 ? 0x12 : 0x16, REG_VIRTUAL, 0b010, rd));
+        w->reads++;
+    }
+}
+
+// Forward branch or jump, landing at most at end
+static void emit_forward(struct writer *w, int end, int rd, int rs1, int rs2) {
+    static const int branch_funct3[] = {0b000, 0b001, 0b100, 0b101, 0b110, 0b111};
+    int skip = 1 + (int)(rng_next(w) % 6);
+    if (w->n + skip > end) {
+        skip = end - w->n;
+    }
+    if (rng_next(w) % 4 != 0) {
+        emit(w, enc_b(skip * 4, rs2, rs1, branch_funct3[rng_next(w) % 6]));
+    } else {
+        emit(w, enc_j(skip * 4, rng_next(w) & 1 ? rd : 0));
+    }
+}
+
+// Random instructions up to (not including) index end
+static void emit_body(struct writer *w, const struct gen_mix *mix, int end) {
+    int alu = mix->alu;
+    int total = alu + mix->data + mix->heap + mix->virt + mix->branch;
+    if (total <= 0) {
+        // nothing selected, plain arithmetic
+        total = alu = 1;
+    }
+    while (w->n < end) {
+        int rd = 1 + (int)(rng_next(w) % REG_LAST_RANDOM);
+        int rs1 = (int)(rng_next(w) % 32);
+        int rs2 = (int)(rng_next(w) % 32);
+        int pick = (int)(rng_next(w) % (uint32_t)total);
+        if ((pick -= alu) < 0) {
+            emit_alu(w, rd, rs1, rs2);
+        } else if ((pick -= mix->data) < 0) {
+            emit_memory(w, REG_DATA, DATA_MEM_SIZE, rd, rs2);
+        } else if ((pick -= mix->heap) < 0) {
+            emit_memory(w, REG_HEAP, HEAP_CHUNK, rd, rs2);
+        } else if ((pick -= mix->virt) < 0) {
+            emit_virtual(w, rd, rs2);
+        } else {
+            emit_forward(w, end, rd, rs1, rs2);
+        }
+    }
+}
+
+void gen_default_options(struct gen_options *opts) {
+    opts->seed = 1;
+    opts->size = NUM_INSTRUCTIONS;
+    opts->loops = 4;
+    opts->iterations = 10;
+    opts->repeat = 1;
+    opts->mix.alu = 8;
+    opts->mix.data = 3;
+    opts->mix.heap = 2;
+    opts->mix.virt = 1;
+    opts->mix.branch = 2;
+}
+
+size_t gen_image(struct blob *image, const struct gen_options *opts, char *input, size_t input_size) {
+    struct writer w = {image->inst_mem, 0, opts->seed != 0 ? opts->seed : 1, 0};
+    memset(image, 0, sizeof(struct blob));
+    for (int i = 0; i < DATA_MEM_SIZE; i++) {
+        image->data_mem[i] = (char)rng_next(&w);
+    }
+
+    // base registers and the heap chunk
+    emit(&w, enc_i(OPCODE_OP_IMM, 0x400, 0, 0b000, REG_DATA));
+    emit(&w, enc_u(1, REG_VIRTUAL));
+    emit(&w, enc_i(OPCODE_OP_IMM, -2048, REG_VIRTUAL, 0b000, REG_VIRTUAL));
+    emit(&w, enc_i(OPCODE_OP_IMM, HEAP_CHUNK, 0, 0b000, REG_SCRATCH));
+    emit(&w, enc_s(0x30, REG_SCRATCH, REG_VIRTUAL, 0b010));     // malloc, pointer in x28
+    for (int r = 1; r <= 8; r++) {
+        emit(&w, enc_i(OPCODE_OP_IMM, (int)(rng_next(&w) & 0xFFF), 0, 0b000, r));
+    }
+    emit_li(&w, REG_OUTER, opts->repeat > 0 ? opts->repeat : 1);
+
+    int size = opts->size > 0 && opts->size < NUM_INSTRUCTIONS ? opts->size : NUM_INSTRUCTIONS;
+    int loops = opts->loops > 0 ? opts->loops : 1;
+    int iterations = opts->iterations > 0 ? opts->iterations : 1;
+    int loop_overhead = LOOP_OVERHEAD + li_length(iterations);
+    int outer_start = w.n;
+    int space = size - w.n - TAIL_OVERHEAD - loops * loop_overhead;
+    if (space < loops) {
+        // too small for the requested loops, fall back to a single one
+        loops = 1;
+        space = size - w.n - TAIL_OVERHEAD - loop_overhead;
+    }
+    for (int i = 0; i < loops; i++) {
+        emit_li(&w, REG_INNER, iterations);
+        int body_start = w.n;
+        int body_size = space / loops + (i < space % loops);
+        // forward branches may land on the decrement, never past it
+        emit_body(&w, &opts->mix, body_start + (body_size > 0 ? body_size : 0));
+        emit(&w, enc_i(OPCODE_OP_IMM, -1, REG_INNER, 0b000, REG_INNER));
+        emit(&w, enc_b((body_start - w.n) * 4, 0, REG_INNER, 0b001));       // bne x26, x0
+    }
+    emit(&w, enc_i(OPCODE_OP_IMM, -1, REG_OUTER, 0b000, REG_OUTER));
+    emit(&w, enc_b((outer_start - w.n) * 4, 0, REG_OUTER, 0b001));         // bne x27, x0
+    emit(&w, enc_s(0x0C, 0, REG_VIRTUAL, 0b010));                           // halt
+
+    // one integer per line for every console read that can execute
+    size_t length = 0;
+    uint64_t values = (uint64_t)w.reads * iterations * (opts->repeat > 0 ? opts->repeat : 1);
+    for (uint64_t i = 0; i < values && input_size > 0; i++) {
+        int written = snprintf(input + length, input_size - length, "%d\n",
+                               (int)(rng_next(&w) % 2001) - 1000);
+        if (written < 0 || length + written >= input_size) {
+            break;
+        }
+        length += written;
+    }
+    if (input_size > 0) {
+        input[length] = '\0';
+    }
+    return length;
+}
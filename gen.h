@@ -0,0 +1,54 @@
+#ifndef GEN_H
+#define GEN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "helper.h"
+
+/*
+    Random guest programs, for stress and throughput testing.
+
+    A generated image sets up its base registers, runs `loops` counted
+    loops of random instructions (`iterations` times each), repeats the
+    whole sequence `repeat` times and halts at 0x080C. Branches and jumps
+    inside a loop body only go forward and never past the loop counter
+    update, so the iteration counts are exact and every image terminates.
+
+    Register use:
+        x1-x25  random instructions
+        x26     inner loop counter
+        x27     outer (repeat) counter
+        x28     256 byte heap chunk, allocated on entry
+        x29     scratch
+        x30     0x0800, virtual routines
+        x31     0x0400, data memory
+*/
+
+// Relative weights of each kind of instruction in loop bodies
+struct gen_mix {
+    int alu;        // register and immediate arithmetic, lui
+    int data;       // loads and stores to data memory
+    int heap;       // loads and stores to the heap chunk
+    int virt;       // console reads and writes
+    int branch;     // forward branches and jumps
+};
+
+struct gen_options {
+    uint32_t seed;
+    int size;           // instructions in the image, at most NUM_INSTRUCTIONS
+    int loops;
+    int iterations;     // per loop
+    int repeat;         // of the whole sequence of loops
+    struct gen_mix mix;
+};
+
+// Fills opts with a full-size image of 4 loops, 10 iterations each, and a mixed workload
+void gen_default_options(struct gen_options *opts);
+
+// Generates the image described by opts, and writes the text it reads from
+// stdin to input (at most input_size bytes, NUL terminated).
+// Returns the length of the input
+size_t gen_image(struct blob *image, const struct gen_options *opts, char *input, size_t input_size);
+
+#endif // GEN_H
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "block_cache.h"
+#include "console.h"
+#include "hart.h"
+#include "metrics.h"
+
+struct hart {
+    struct vm vm;
+    struct console console;
+    struct metrics *metrics;    // counted apart and merged into hart 0's
+    int block;
+    int status;
+    pthread_t thread;
+    char started;
+};
+
+// Lets the harts in the current barrier go. Called with the lock held
+static void release(struct hart_group *group) {
+    group->waiting = 0;
+    group->generation++;
+    pthread_cond_broadcast(&group->released);
+}
+
+void hart_barrier(struct hart_group *group) {
+    pthread_mutex_lock(&group->lock);
+    unsigned generation = group->generation;
+    if (++group->waiting == group->live) {
+        release(group);
+    } else {
+        while (generation == group->generation) {
+            pthread_cond_wait(&group->released, &group->lock);
+        }
+    }
+    pthread_mutex_unlock(&group->lock);
+}
+
+// A stopped hart no longer holds up barriers
+static void hart_exit(struct hart_group *group) {
+    pthread_mutex_lock(&group->lock);
+    group->live--;
+    if (group->waiting > 0 && group->waiting == group->live) {
+        release(group);
+    }
+    pthread_mutex_unlock(&group->lock);
+}
+
+static int run_hart(struct vm *vm, int block) {
+    int status;
+    if (block) {
+        struct block_cache *bc = (struct block_cache *)malloc(sizeof(struct block_cache));
+        block_cache_init(bc, vm->program);
+        status = block_cache_run(bc, vm);
+        if (vm->metrics != NULL && vm->metrics->has_classes) {
+            block_cache_count_classes(bc, vm, status, vm->metrics->classes);
+        }
+        block_cache_free(bc);
+        free(bc);
+    } else {
+        status = vm_run(vm);
+    }
+    hart_exit(vm->harts);
+    return status;
+}
+
+static void *hart_thread(void *arg) {
+    struct hart *hart = (struct hart *)arg;
+    hart->status = run_hart(&hart->vm, hart->block);
+    return NULL;
+}
+
+int harts_run(struct vm *vm, int num_harts, int block) {
+    struct hart_group group;
+    group.num_harts = num_harts;
+    group.live = num_harts;
+    group.waiting = 0;
+    group.generation = 0;
+    pthread_mutex_init(&group.lock, NULL);
+    pthread_cond_init(&group.released, NULL);
+    vm->harts = &group;
+
+    struct hart *harts = (struct hart *)calloc(num_harts, sizeof(struct hart));
+    for (int i = 1; i < num_harts; i++) {
+        vm_init_hart(&harts[i].vm, vm, i, &group);
+        console_init(&harts[i].console, &harts[i].vm.instret);
+        console_buffer(&harts[i].console, "", 0);
+        harts[i].vm.console = &harts[i].console;
+        if (vm->metrics != NULL) {
+            harts[i].metrics = (struct metrics *)calloc(1, sizeof(struct metrics));
+            harts[i].metrics->has_classes = vm->metrics->has_classes;
+            harts[i].vm.metrics = harts[i].metrics;
+        }
+        harts[i].block = block;
+        harts[i].started = pthread_create(&harts[i].thread, NULL, hart_thread, &harts[i]) == 0;
+        if (!harts[i].started) {
+            fprintf(stderr, "Could not start hart %d.\n", i);
+            harts[i].status = VM_ERROR;
+            hart_exit(&group);
+        }
+    }
+
+    int status = run_hart(vm, block);
+    for (int i = 1; i < num_harts; i++) {
+        if (harts[i].started) {
+            pthread_join(harts[i].thread, NULL);
+        }
+        status = harts[i].status == VM_ERROR ? VM_ERROR : status;
+        vm->instret += harts[i].vm.instret;
+        // the memory is hart 0's, so are the lines the others wrote
+        vm->dirty_lines |= harts[i].vm.dirty_lines;
+        if (harts[i].metrics != NULL) {
+            for (int c = 0; c < METRIC_CLASSES; c++) {
+                vm->metrics->classes[c] += harts[i].metrics->classes[c];
+            }
+            for (int r = 0; r < METRIC_ROUTINES; r++) {
+                vm->metrics->routine_calls[r] += harts[i].metrics->routine_calls[r];
+            }
+            free(harts[i].metrics);
+        }
+        if (vm->console != NULL) {
+            vm->console->bytes_written += harts[i].console.bytes_written;
+        }
+        console_close(&harts[i].console);
+        vm_free(&harts[i].vm);
+    }
+    free(harts);
+
+    vm->harts = NULL;
+    pthread_mutex_destroy(&group.lock);
+    pthread_cond_destroy(&group.released);
+    return status;
+}
@@ -0,0 +1,44 @@
+#ifndef HART_H
+#define HART_H
+
+#include <pthread.h>
+
+#include "vm.h"
+
+/*
+    Multi-hart execution. Every hart is a vm with its own registers, pc
+    and host thread; data memory and the heap are hart 0's, shared by
+    all of them (see vm_init_hart). Harts coordinate through the RV32A
+    atomics (lr.w, sc.w, amoswap.w, amoadd.w) and two virtual routines:
+
+    0x0848 hart id: a load returns the id of the hart, 0 to num_harts - 1
+    0x084C barrier: a store waits until every running hart has stored to
+                    it. Harts that have stopped no longer count
+
+    Every hart starts at pc 0. Console input goes to hart 0 only, the
+    others read end of input.
+*/
+#define HART_ID_ROUTINE 0x0848
+#define HART_BARRIER 0x084C
+
+#define MAX_HARTS 64
+
+struct hart_group {
+    int num_harts;
+    int live;               // harts still running
+    int waiting;            // harts in the current barrier
+    unsigned generation;    // barriers released so far
+    pthread_mutex_t lock;
+    pthread_cond_t released;
+};
+
+// Waits for every live hart of group to reach the barrier
+void hart_barrier(struct hart_group *group);
+
+// Runs vm as hart 0 of num_harts harts, each on its own thread, with the
+// block engine if block is set and the switch interpreter otherwise.
+// Returns VM_ERROR if any hart failed, hart 0's status otherwise.
+// vm->instret becomes the total over all harts
+int harts_run(struct vm *vm, int num_harts, int block);
+
+#endif // HART_H
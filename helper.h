@@ -2,10 +2,12 @@
 #define HELPER_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 #include "memory_handling.h"
 
 #define INST_MEM_SIZE 1024 // bytes
+#define NUM_INSTRUCTIONS (INST_MEM_SIZE / 4)
 #define DATA_MEM_SIZE 1024 // bytes
 #define VIRT_MEM_SIZE 256 // bytes
 #define REG_BANK_SIZE 32 // ints
@@ -20,6 +22,18 @@ struct blob {
 
 // Struct to hold decoded instruction
 // func3, func7 are not needed
+#ifndef DECODED_WIDE
+// Packed into 8 bytes, so a pre-decoded program takes 2 KiB. operation
+// holds the handler number (-1 for unknown, up to VM_TRAP_OPERATION)
+struct decoded_instruction {
+    int operation : 11;
+    unsigned rd : 5;
+    unsigned rs1 : 5;
+    unsigned rs2 : 5;
+    int32_t imm;
+};
+#else
+// Unpacked 20-byte layout, only built by make layout-bench for comparison
 struct decoded_instruction {
     uint32_t rd;
     uint32_t rs1;
@@ -27,16 +41,17 @@ struct decoded_instruction {
     int32_t operation;
     int32_t imm;
 };
+#endif
 
 // Frees all memory banks in the linked list
 void heap_free_all(MemoryBank *head);
 
-//  Frees all malloc'd objects and exits with error code 1
-void error_and_free(int* reg_bank, struct blob *b, char* virt_mem, MemoryBank* head);
-
 // Returns the 32-bit instruction at the given pc
 int get_instruction(char *inst_mem, int pc);
 
+// 64-bit FNV-1a hash of size bytes
+uint64_t hash_bytes(const void *data, size_t size);
+
 // Decodes the given 32-bit instruction
 struct decoded_instruction decode_instruction(int instruction);
 
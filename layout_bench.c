@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "console.h"
+#include "gen.h"
+#include "program.h"
+#include "vm.h"
+
+/*
+    Interpreter throughput with many instances resident, for comparing
+    decoded instruction layouts (see helper.h). Every instance runs its
+    own generated program, and the instances take turns a slice at a
+    time, the way a host running many guests shares its caches.
+
+    make layout-bench builds this twice, packed and with -DDECODED_WIDE.
+*/
+
+#define DEFAULT_INSTANCES 64
+#define DEFAULT_ROUNDS 3
+
+// Instructions an instance runs before the next one takes over
+#define SLICE 256
+
+int main(int argc, char *argv[]) {
+    int instances = argc > 1 ? atoi(argv[1]) : DEFAULT_INSTANCES;
+    int rounds = argc > 2 ? atoi(argv[2]) : DEFAULT_ROUNDS;
+    if (instances <= 0 || rounds <= 0) {
+        printf("Usage: ./riskxvii-layout [instances] [rounds]\n");
+        return 1;
+    }
+
+    struct program *progs = (struct program *)malloc(instances * sizeof(struct program));
+    struct blob *image = (struct blob *)malloc(sizeof(struct blob));
+    for (int i = 0; i < instances; i++) {
+        struct gen_options opts;
+        gen_default_options(&opts);
+        opts.seed = i + 1;
+        opts.iterations = 100;
+        opts.repeat = 20;
+        opts.mix.virt = 0;      // console output would dominate
+        gen_image(image, &opts, NULL, 0);
+        program_from_image(&progs[i], image);
+    }
+    free(image);
+
+    // guests print "CPU Halt Requested", keep it out of the results
+    if (freopen("/dev/null", "w", stdout) == NULL) {
+        return 1;
+    }
+
+    struct vm *vms = (struct vm *)malloc(instances * sizeof(struct vm));
+    struct console *consoles = (struct console *)malloc(instances * sizeof(struct console));
+    int *status = (int *)malloc(instances * sizeof(int));
+    double best = 0;
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < instances; i++) {
+            vm_init(&vms[i], &progs[i]);
+            console_init(&consoles[i], &vms[i].instret);
+            console_buffer(&consoles[i], "", 0);
+            vms[i].console = &consoles[i];
+            status[i] = VM_RUNNING;
+        }
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        uint64_t instret = 0;
+        int running = instances;
+        while (running > 0) {
+            running = 0;
+            for (int i = 0; i < instances; i++) {
+                for (int n = 0; n < SLICE && status[i] == VM_RUNNING; n++) {
+                    status[i] = vm_step(&vms[i]);
+                }
+                running += status[i] == VM_RUNNING;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        for (int i = 0; i < instances; i++) {
+            instret += vms[i].instret;
+            console_close(&consoles[i]);
+            vm_free(&vms[i]);
+        }
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        double mips = seconds > 0 ? instret / seconds / 1e6 : 0;
+        best = mips > best ? mips : best;
+    }
+
+    fprintf(stderr, "%zu-byte decoded instructions (%zu KiB per program), %d instances: %.2f MIPS\n",
+           sizeof(struct decoded_instruction), sizeof(struct decoded_instruction) * NUM_INSTRUCTIONS / 1024,
+           instances, best);
+
+    for (int i = 0; i < instances; i++) {
+        program_free(&progs[i]);
+    }
+    free(progs);
+    free(vms);
+    free(consoles);
+    free(status);
+    return 0;
+}
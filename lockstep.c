@@ -0,0 +1,151 @@
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "lockstep.h"
+#include "opcodes.h"
+#include "operations.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LOCKSTEP_X86 1
+#endif
+
+void lockstep_init(struct lockstep *ls) {
+    memset(ls, 0, sizeof(*ls));
+}
+
+// RV32M operations without a vector instruction, for one lane, through
+// the interpreter's own handlers
+static int32_t multiply_divide(int operation, int32_t a, int32_t b) {
+    int reg[3] = {0, a, b};
+    switch (operation) {
+        case OP_MULH: mulh(reg, 0, 1, 2); break;
+        case OP_MULHSU: mulhsu(reg, 0, 1, 2); break;
+        case OP_MULHU: mulhu(reg, 0, 1, 2); break;
+        case OP_DIV: div_reg(reg, 0, 1, 2); break;
+        case OP_DIVU: divu(reg, 0, 1, 2); break;
+        case OP_REM: rem_reg(reg, 0, 1, 2); break;
+        case OP_REMU: remu(reg, 0, 1, 2); break;
+    }
+    return reg[0];
+}
+
+// Runs the instruction at pc of lane l through vm_step, with all its
+// registers copied out of the lanes and back
+static int lane_step(struct lockstep *ls, struct vm *vm, int l, int pc) {
+    for (int r = 0; r < REG_BANK_SIZE; r++) {
+        vm->reg_bank[r] = ls->regs[r][l];
+    }
+    vm->pc = pc;
+    int status = vm_step(vm);
+    for (int r = 0; r < REG_BANK_SIZE; r++) {
+        ls->regs[r][l] = vm->reg_bank[r];
+    }
+    ls->scalar_steps++;
+    return status;
+}
+
+// Adds steps instructions run as a group to the members' instret
+static void count_steps(struct lockstep *ls, struct vm *lanes, int count, uint32_t members, uint64_t steps) {
+    for (int l = 0; l < count; l++) {
+        if (members >> l & 1) {
+            lanes[l].instret += steps;
+        }
+    }
+    ls->group_steps += steps;
+    ls->lane_steps += steps * __builtin_popcount(members);
+}
+
+// A load or store of lane l to data memory or an allocated heap bank,
+// done with the interpreter's handlers on the two registers it reads.
+// Returns 0, having changed nothing, if it needs vm_step instead
+// (virtual routines, instruction memory, invalid accesses)
+static int lane_access(struct lockstep *ls, struct vm *vm, int l, struct decoded_instruction inst) {
+    int op = inst.operation;
+    int reg[3] = {0, ls->regs[inst.rs1][l], ls->regs[inst.rs2][l]};
+    int address = reg[1] + inst.imm;
+    if (address >= 0x0400 && address < 0x0800) {
+        char *data_mem = vm->blob->data_mem;
+        switch (op) {
+            case OP_LB: lb(reg, data_mem, 0, 1, inst.imm); break;
+            case OP_LH: lh(reg, data_mem, 0, 1, inst.imm); break;
+            case OP_LW: lw(reg, data_mem, 0, 1, inst.imm); break;
+            case OP_LBU: lbu(reg, data_mem, 0, 1, inst.imm); break;
+            case OP_LHU: lhu(reg, data_mem, 0, 1, inst.imm); break;
+            case OP_SB: sb(reg, data_mem, 1, 2, inst.imm); vm_mark_data(vm, address, 1); break;
+            case OP_SH: sh(reg, data_mem, 1, 2, inst.imm); vm_mark_data(vm, address, 2); break;
+            case OP_SW: sw(reg, data_mem, 1, 2, inst.imm); vm_mark_data(vm, address, 4); break;
+        }
+    } else if (address >= BASE_ADDR) {
+        int invalid = 1;
+        switch (op) {
+            case OP_LB: invalid = lb_heap(reg, vm->heap, 0, 1, inst.imm); break;
+            case OP_LH: invalid = lh_heap(reg, vm->heap, 0, 1, inst.imm); break;
+            case OP_LW: invalid = lw_heap(reg, vm->heap, 0, 1, inst.imm); break;
+            case OP_LBU: invalid = lbu_heap(reg, vm->heap, 0, 1, inst.imm); break;
+            case OP_LHU: invalid = lhu_heap(reg, vm->heap, 0, 1, inst.imm); break;
+            case OP_SB: invalid = sb_heap(reg, vm->heap, 1, 2, inst.imm); break;
+            case OP_SH: invalid = sh_heap(reg, vm->heap, 1, 2, inst.imm); break;
+            case OP_SW: invalid = sw_heap(reg, vm->heap, 1, 2, inst.imm); break;
+        }
+        if (invalid) {
+            return 0;
+        }
+    } else {
+        return 0;
+    }
+    if (op <= OP_LHU && inst.rd != 0) {
+        ls->regs[inst.rd][l] = reg[0];
+    }
+    vm->instret++;
+    return 1;
+}
+
+// The engine for each instruction set, picked at run time as for the
+// bulk routines (see bulk.c): 256-bit vectors with AVX2, 128-bit ones
+// otherwise (SSE2 on x86-64)
+#ifdef LOCKSTEP_X86
+#pragma GCC push_options
+#pragma GCC target("avx2")
+typedef int32_t lanes8_t __attribute__((vector_size(32)));
+typedef uint32_t ulanes8_t __attribute__((vector_size(32)));
+#define VEC lanes8_t
+#define UVEC ulanes8_t
+#define VEC_LANES 8
+#define LANES_NAME(name) name##_avx2
+#include "lockstep_lanes.h"
+#undef VEC
+#undef UVEC
+#undef VEC_LANES
+#undef LANES_NAME
+#pragma GCC pop_options
+#endif
+
+typedef int32_t lanes4_t __attribute__((vector_size(16)));
+typedef uint32_t ulanes4_t __attribute__((vector_size(16)));
+#define VEC lanes4_t
+#define UVEC ulanes4_t
+#define VEC_LANES 4
+#define LANES_NAME(name) name##_default
+#include "lockstep_lanes.h"
+#undef VEC
+#undef UVEC
+#undef VEC_LANES
+#undef LANES_NAME
+
+void lockstep_run(struct lockstep *ls, struct vm *lanes, int count, int *status) {
+#ifdef LOCKSTEP_X86
+    if (__builtin_cpu_supports("avx2")) {
+        run_lanes_avx2(ls, lanes, count, status);
+        return;
+    }
+#endif
+    run_lanes_default(ls, lanes, count, status);
+}
+
+void lockstep_print_stats(const struct lockstep *ls) {
+    fprintf(stderr, "Lockstep: %llu group instructions, %.2f lanes each, %llu splits, %llu lane-by-lane\n",
+            (unsigned long long)ls->group_steps,
+            ls->group_steps > 0 ? (double)ls->lane_steps / ls->group_steps : 0.0,
+            (unsigned long long)ls->splits, (unsigned long long)ls->scalar_steps);
+}
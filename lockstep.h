@@ -0,0 +1,47 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <stdint.h>
+
+#include "helper.h"
+#include "vm.h"
+
+/*
+    Lockstep engine (--engine lockstep, batch mode only). Runs several
+    instances of one program, one per lane, an instruction at a time:
+    the lanes at the same pc fetch and decode it once, and registers
+    are held as structure of arrays (regs[r][lane]), so an ALU
+    instruction is a single vector operation across all of them (AVX2
+    where the host has it, SSE2 otherwise).
+
+    A branch or jalr the lanes disagree on splits the group. Memory
+    accesses are done lane by lane, data memory and heap inline and
+    everything else (virtual routines, errors) through vm_step on the
+    lane's own vm. The lanes at the lowest pc always run next, and only
+    until they reach the pc of a waiting lane or pass it, so lanes that
+    went ahead wait for the others, which rejoin them where the paths
+    meet.
+*/
+#define LOCKSTEP_LANES 16
+#define LOCKSTEP_DEFAULT_LANES 8
+
+struct lockstep {
+    int32_t regs[REG_BANK_SIZE][LOCKSTEP_LANES] __attribute__((aligned(64)));
+    // statistics
+    uint64_t group_steps;       // instructions run for a whole group at once
+    uint64_t lane_steps;        // lane instructions those stood for
+    uint64_t scalar_steps;      // instructions run through vm_step
+    uint64_t splits;            // groups split by a branch or jalr
+};
+
+void lockstep_init(struct lockstep *ls);
+
+// Runs the count (at most LOCKSTEP_LANES) instances in lanes, all fresh
+// instances of the same program, until every one has stopped, and
+// stores their vm statuses in status
+void lockstep_run(struct lockstep *ls, struct vm *lanes, int count, int *status);
+
+// Prints the group and lane statistics to stderr
+void lockstep_print_stats(const struct lockstep *ls);
+
+#endif // LOCKSTEP_H
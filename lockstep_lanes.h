@@ -0,0 +1,293 @@
+/*
+    Body of the lockstep engine for one vector width, included by
+    lockstep.c once per instruction set. The includer defines
+
+        VEC             vector of VEC_LANES int32_t, one register of as
+                        many lanes
+        UVEC            its unsigned counterpart
+        VEC_LANES
+        LANES_NAME(n)   the name n given to this width's functions
+
+    and the functions take the target attributes in effect (#pragma GCC
+    target). A group register is LOCKSTEP_LANES / VEC_LANES vectors, of
+    which only those holding one of the count lanes are computed.
+*/
+
+#define VECTORS (LOCKSTEP_LANES / VEC_LANES)
+
+// Bits v * VEC_LANES.. of the lane mask: bit l set if lane l of x is true
+static inline __attribute__((always_inline)) uint32_t LANES_NAME(vector_bits)(VEC x, int v) {
+    uint32_t bits = 0;
+    for (int l = 0; l < VEC_LANES; l++) {
+        bits |= (uint32_t)(x[l] & 1) << l;
+    }
+    return bits << (v * VEC_LANES);
+}
+
+// Runs the group of lanes in members, all at the same pc, for as long as
+// they stay together and stay below the other running lanes. Leaves the
+// pc and status of every member in pc and status, and returns the number
+// of instructions run as a group not yet counted
+static uint64_t LANES_NAME(run_group)(
+    struct lockstep *ls,
+    struct vm *lanes,
+    int count,
+    uint32_t members,
+    int *pc,
+    int *status
+) {
+    VEC (*R)[VECTORS] = (VEC (*)[VECTORS])ls->regs;
+    const int vectors = (count + VEC_LANES - 1) / VEC_LANES;
+    const struct decoded_instruction *decoded = lanes[__builtin_ctz(members)].decoded;
+    VEC mask[VECTORS];
+    for (int v = 0; v < vectors; v++) {
+        for (int l = 0; l < VEC_LANES; l++) {
+            mask[v][l] = (members >> (v * VEC_LANES + l) & 1) ? -1 : 0;
+        }
+    }
+    int pc0 = pc[__builtin_ctz(members)];
+    uint64_t steps = 0;
+    // the lowest pc of the running lanes left waiting, above pc0
+    int waiting = INT_MAX;
+    for (int l = 0; l < count; l++) {
+        if (!(members >> l & 1) && status[l] == VM_RUNNING && pc[l] < waiting) {
+            waiting = pc[l];
+        }
+    }
+
+    for (;;) {
+        if (pc0 >= waiting) {
+            // reached or passed a waiting lane: back to run_lanes, which
+            // regroups the lanes at the lowest pc, so the group joins
+            // the waiting lanes at their pc or they catch up with it
+            for (int l = 0; l < count; l++) {
+                if (members >> l & 1) {
+                    pc[l] = pc0;
+                }
+            }
+            return steps;
+        }
+        struct decoded_instruction inst = {0};
+        int op = OP_ILLEGAL;    // lane by lane, through vm_step
+        if (pc0 >= 0 && pc0 % 4 == 0) {
+            inst = decoded[pc0 / 4];
+            op = inst.operation;
+        }
+        // vm_execute's program flow checks, the failures error in vm_step
+        if (op >= OP_SLT && op <= OP_JAL &&
+            (pc0 + inst.imm < 0 || pc0 + inst.imm > INST_MEM_SIZE || inst.imm % 4 != 0))
+        {
+            op = OP_ILLEGAL;
+        }
+
+        const VEC *A = R[inst.rs1];
+        const VEC *B = R[inst.rs2];
+        const VEC imm = (VEC){0} + inst.imm;
+        VEC result[VECTORS];
+        int next = pc0 + 4;
+        uint32_t taken = 0;
+
+// result = expr of a (rs1), b (rs2) and imm, a vector at a time
+#define EACH_VECTOR(expr)                               \
+        for (int v = 0; v < vectors; v++) {             \
+            VEC a = A[v], b = B[v];                     \
+            (void)a; (void)b;                           \
+            result[v] = (expr);                         \
+        }                                               \
+        break
+
+// taken = lanes for which cond of a and b holds
+#define EACH_VECTOR_BITS(cond)                          \
+        for (int v = 0; v < vectors; v++) {             \
+            VEC a = A[v], b = B[v];                     \
+            taken |= LANES_NAME(vector_bits)(cond, v);  \
+        }                                               \
+        break
+
+        switch (op) {
+            case OP_ADD: EACH_VECTOR((VEC)((UVEC)a + (UVEC)b));
+            case OP_ADDI: EACH_VECTOR((VEC)((UVEC)a + (UVEC)imm));
+            case OP_SUB: EACH_VECTOR((VEC)((UVEC)a - (UVEC)b));
+            case OP_LUI: EACH_VECTOR(imm);
+            case OP_XOR: EACH_VECTOR(a ^ b);
+            case OP_XORI: EACH_VECTOR(a ^ imm);
+            case OP_OR: EACH_VECTOR(a | b);
+            case OP_ORI: EACH_VECTOR(a | imm);
+            case OP_AND: EACH_VECTOR(a & b);
+            case OP_ANDI: EACH_VECTOR(a & imm);
+            case OP_SLL: EACH_VECTOR((VEC)((UVEC)a << (UVEC)(b & 0x1F)));
+            case OP_SRL: EACH_VECTOR((VEC)((UVEC)a >> (UVEC)(b & 0x1F)));
+            case OP_SRA: EACH_VECTOR(a >> (b & 0x1F));
+            case OP_SLT: EACH_VECTOR(-(a < b));
+            case OP_SLTI: EACH_VECTOR(-(a < imm));
+            case OP_SLTU: EACH_VECTOR(-((UVEC)a < (UVEC)b));
+            case OP_SLTIU: EACH_VECTOR(-((UVEC)a < (UVEC)imm));
+            case OP_MUL: EACH_VECTOR((VEC)((UVEC)a * (UVEC)b));
+            case OP_MULH:
+            case OP_MULHSU:
+            case OP_MULHU:
+            case OP_DIV:
+            case OP_DIVU:
+            case OP_REM:
+            case OP_REMU:
+                for (int v = 0; v < vectors; v++) {
+                    for (int l = 0; l < VEC_LANES; l++) {
+                        result[v][l] = mask[v][l] ? multiply_divide(op, A[v][l], B[v][l]) : 0;
+                    }
+                }
+                break;
+            case OP_BEQ:
+            case OP_BNE:
+            case OP_BLT:
+            case OP_BLTU:
+            case OP_BGE:
+            case OP_BGEU:
+                switch (op) {
+                    case OP_BEQ: EACH_VECTOR_BITS(a == b);
+                    case OP_BNE: EACH_VECTOR_BITS(a != b);
+                    case OP_BLT: EACH_VECTOR_BITS(a < b);
+                    case OP_BLTU: EACH_VECTOR_BITS((UVEC)a < (UVEC)b);
+                    case OP_BGE: EACH_VECTOR_BITS(a >= b);
+                    default: EACH_VECTOR_BITS((UVEC)a >= (UVEC)b);
+                }
+                taken &= members;
+                steps++;
+                if (taken != 0 && taken != members) {
+                    // the lanes part ways
+                    for (int l = 0; l < count; l++) {
+                        if (members >> l & 1) {
+                            pc[l] = (taken >> l & 1) ? pc0 + inst.imm : next;
+                        }
+                    }
+                    ls->splits++;
+                    return steps;
+                }
+                next = taken != 0 ? pc0 + inst.imm : next;
+                goto advance;
+            case OP_JAL:
+                EACH_VECTOR((VEC){0} + next);
+            case OP_JALR: // the target is read before rd is written
+            {
+                int target[LOCKSTEP_LANES];
+                int same = 1;
+                int first = (int)((uint32_t)ls->regs[inst.rs1][__builtin_ctz(members)] + (uint32_t)inst.imm);
+                for (int l = 0; l < count; l++) {
+                    target[l] = (int)((uint32_t)ls->regs[inst.rs1][l] + (uint32_t)inst.imm);
+                    same &= !(members >> l & 1) || target[l] == first;
+                }
+                if (inst.rd != 0) {
+                    for (int v = 0; v < vectors; v++) {
+                        R[inst.rd][v] = (((VEC){0} + next) & mask[v]) | (R[inst.rd][v] & ~mask[v]);
+                    }
+                }
+                steps++;
+                if (!same) {
+                    for (int l = 0; l < count; l++) {
+                        if (members >> l & 1) {
+                            pc[l] = target[l];
+                        }
+                    }
+                    ls->splits++;
+                    return steps;
+                }
+                next = first;
+                goto advance;
+            }
+            default:
+            {
+                // lane by lane: loads and stores inline where possible,
+                // everything else through vm_step
+                int stopped = 0;
+                int together = 1;
+                for (int l = 0; l < count; l++) {
+                    if (!(members >> l & 1)) {
+                        continue;
+                    }
+                    if (op >= OP_LB && op <= OP_SW && lane_access(ls, &lanes[l], l, inst)) {
+                        pc[l] = next;
+                        continue;
+                    }
+                    if (steps != 0) {
+                        // the routines may read instret
+                        count_steps(ls, lanes, count, members, steps);
+                        steps = 0;
+                    }
+                    status[l] = lane_step(ls, &lanes[l], l, pc0);
+                    pc[l] = lanes[l].pc;
+                    stopped |= status[l] != VM_RUNNING;
+                    together &= pc[l] == next;
+                }
+                if (stopped || !together) {
+                    return steps;
+                }
+                pc0 = next;
+                continue;
+            }
+        }
+#undef EACH_VECTOR
+#undef EACH_VECTOR_BITS
+        if (op == OP_JAL) {
+            next = pc0 + inst.imm;
+        }
+        if (inst.rd != 0) {
+            for (int v = 0; v < vectors; v++) {
+                R[inst.rd][v] = (result[v] & mask[v]) | (R[inst.rd][v] & ~mask[v]);
+            }
+        }
+        steps++;
+
+advance:
+        pc0 = next;
+        if (pc0 >= INST_MEM_SIZE) {
+            for (int l = 0; l < count; l++) {
+                if (members >> l & 1) {
+                    pc[l] = pc0;
+                    status[l] = VM_FINISHED;
+                }
+            }
+            return steps;
+        }
+    }
+}
+
+static void LANES_NAME(run_lanes)(struct lockstep *ls, struct vm *lanes, int count, int *status) {
+    int pc[LOCKSTEP_LANES];
+    memset(ls->regs, 0, sizeof(ls->regs));
+    for (int l = 0; l < count; l++) {
+        for (int r = 0; r < REG_BANK_SIZE; r++) {
+            ls->regs[r][l] = lanes[l].reg_bank[r];
+        }
+        pc[l] = lanes[l].pc;
+        status[l] = pc[l] >= INST_MEM_SIZE ? VM_FINISHED : VM_RUNNING;
+    }
+
+    for (;;) {
+        // the next group: the running lanes at the lowest pc
+        int pc0 = INT_MAX;
+        for (int l = 0; l < count; l++) {
+            if (status[l] == VM_RUNNING && pc[l] < pc0) {
+                pc0 = pc[l];
+            }
+        }
+        if (pc0 == INT_MAX) {
+            break;
+        }
+        uint32_t members = 0;
+        for (int l = 0; l < count; l++) {
+            if (status[l] == VM_RUNNING && pc[l] == pc0) {
+                members |= 1u << l;
+            }
+        }
+        uint64_t steps = LANES_NAME(run_group)(ls, lanes, count, members, pc, status);
+        count_steps(ls, lanes, count, members, steps);
+    }
+
+    for (int l = 0; l < count; l++) {
+        for (int r = 0; r < REG_BANK_SIZE; r++) {
+            lanes[l].reg_bank[r] = ls->regs[r][l];
+        }
+        lanes[l].pc = pc[l];
+    }
+}
+
+#undef VECTORS
@@ -4,9 +4,14 @@
 #include <string.h>
 
 #include "memory_handling.h"
+#include "helper.h"
+#include "bulk.h"
+#include "hart.h"
+#include "vm.h"
+#include "opcodes.h"
 
 // frees a chunk of heap banks starting at the given address
-static int heap_free(MemoryBank *head, int address);
+static int heap_free(struct heap *heap, int address);
 
 int memory_operation_handling(
     int address, 
@@ -16,90 +21,165 @@ int memory_operation_handling(
     int *pc, 
     char *virt_mem, 
     int *operation,
-    MemoryBank **head
+    struct heap *heap,
+    struct console *console
 ) {
     // VM Memory Layout:
     // 0x0000 - 0x03FF: Instruction Memory
     // 0x0400 - 0x07FF: Data Memory
-    // 0x0800 - 0x08FF: Virtual Routines
+    // 0x0800 - 0x08FF: Virtual Routines (bulk memory routines in bulk.h)
     // 0x0900 - 0xB6FF: Reserved
     // 0xB700+        : Heap Banks
 
     // // Debugging purposes
     // printf("Memory Operation: %d %08x\n", address, address);
 
-    int value = reg_bank[rs2];
     // CASE: Virtual Routines
+    if (virtual_routine_handling(address, reg_bank, data_mem, rs2, pc, virt_mem, operation, heap, console)) {
+        return 0;
+    }
+
+    return memory_region_handling(address, operation);
+}
+
+int virtual_routine_handling(
+    int address, 
+    int *reg_bank, 
+    char *data_mem, 
+    int rs2, 
+    int *pc, 
+    char *virt_mem, 
+    int *operation,
+    struct heap *heap,
+    struct console *console
+) {
+    int value = reg_bank[rs2];
     switch (address) {
         case 0x0800: // Console Write Character
-            putchar((char) value);
-            *operation = 100;
-            return 0;
+            console_putchar(console, (char) value);
+            *operation = OP_VIRTUAL_BASE;
+            return 1;
         case 0x0804: // Console Write Signed Integer
-            printf("%d", value);
-            *operation = 100;
-            return 0;
+            console_printf(console, "%d", value);
+            *operation = OP_VIRTUAL_BASE;
+            return 1;
         case 0x0808: // Console Write Unsigned Integer
-            printf("%x", (uint32_t) value);
-            *operation = 100;
-            return 0;
+            console_printf(console, "%x", (uint32_t) value);
+            *operation = OP_VIRTUAL_BASE;
+            return 1;
         case 0x080C: // Halt
-            printf("CPU Halt Requested\n");
-            return 0;
+            console_printf(console, "CPU Halt Requested\n");
+            return 1;
         case 0x0812: // Console Read Character
-            virt_mem[0x0012] = getchar();
-            *operation = *operation + 100;
-            return 0;
+            virt_mem[0x0012] = console_read_char(console);
+            *operation = *operation + OP_VIRTUAL_BASE;
+            return 1;
         case 0x0816: // Console Read Signed Integer
         {
             int *temp = (int *) &virt_mem[0x016];
-            scanf("%d", temp);
-            *operation = *operation + 100;
-            return 0;
+            console_read_int(console, temp);
+            *operation = *operation + OP_VIRTUAL_BASE;
+            return 1;
         }
         case 0x0820: // Dump PC
-            printf("%08x\n", *pc);
-            *operation = 100;
-            return 0;
+            console_printf(console, "%08x\n", *pc);
+            *operation = OP_VIRTUAL_BASE;
+            return 1;
         case 0x0824: // Dump Register Banks
             for (int i=0; i<32; i++) {
                 // Print format found in 'Invalid 1' test case
-                printf("R[%d] = 0x%08x;\n", i, reg_bank[i]);
+                console_printf(console, "R[%d] = 0x%08x;\n", i, reg_bank[i]);
             }
-            *operation = 100;
-            return 0;
+            *operation = OP_VIRTUAL_BASE;
+            return 1;
         case 0x0828: // Dump Memory Word
         {
             int32_t mem_word = *((int32_t *)&data_mem[value]);
-            printf("%08x\n", mem_word);
+            console_printf(console, "%08x\n", mem_word);
             int32_t *virt_mem_int = (int32_t *) &virt_mem[0x28];
             *virt_mem_int = mem_word;
-            *operation = 100;
-            return 0;
+            *operation = OP_VIRTUAL_BASE;
+            return 1;
         }
         case 0x0830: // Malloc
         {
             // R[28] stores the pointer
-            int starting_address = heap_malloc(head, reg_bank[rs2]);
+            int starting_address = heap_malloc(heap, reg_bank[rs2]);
             if (starting_address != 0) {
                 reg_bank[28] = starting_address;
             } else {
                 reg_bank[28] = 0;
             }
-            *operation = 400;
-            return 0;
+            *operation = OP_HEAP_BASE;
+            return 1;
         }
         case 0x0834: // Free
-            *operation = 400;
-            if (heap_free(*head, reg_bank[rs2])) {
+            *operation = OP_HEAP_BASE;
+            if (heap_free(heap, reg_bank[rs2])) {
                 // Error code
-                *operation = 500;
+                *operation = OP_ILLEGAL;
             }
-            return 0;
+            return 1;
+        case HART_ID_ROUTINE: // Hart ID, written by vm_init_hart
+            *operation = *operation + OP_VIRTUAL_BASE;
+            return 1;
+        case COUNTER_INSTRET: // Counters, snapshot by the vm (see vm.h)
+        case COUNTER_INSTRET + 4:
+        case COUNTER_TIME:
+        case COUNTER_TIME + 4:
+        case COUNTER_CYCLE:
+        case COUNTER_CYCLE + 4:
+            *operation = *operation + OP_VIRTUAL_BASE;
+            return 1;
+        case HART_BARRIER: // Barrier, waited on by the vm (see hart.h)
+            *operation = OP_VIRTUAL_BASE;
+            return 1;
+        case BULK_MEMCPY: // Bulk memory routines, see bulk.h
+        case BULK_MEMSET:
+        case BULK_MEMCMP:
+        case BULK_VADD:
+            *operation = OP_VIRTUAL_BASE;
+            if (bulk_routine_handling(address, reg_bank, data_mem, heap)) {
+                *operation = OP_ILLEGAL;
+            }
+            return 1;
         default:
             break;
     }
+    return 0;
+}
+
+int virtual_routine_exists(int address) {
+    switch (address) {
+        case 0x0800:
+        case 0x0804:
+        case 0x0808:
+        case 0x080C:
+        case 0x0812:
+        case 0x0816:
+        case 0x0820:
+        case 0x0824:
+        case 0x0828:
+        case 0x0830:
+        case 0x0834:
+        case HART_ID_ROUTINE:
+        case HART_BARRIER:
+        case COUNTER_INSTRET:
+        case COUNTER_INSTRET + 4:
+        case COUNTER_TIME:
+        case COUNTER_TIME + 4:
+        case COUNTER_CYCLE:
+        case COUNTER_CYCLE + 4:
+        case BULK_MEMCPY:
+        case BULK_MEMSET:
+        case BULK_MEMCMP:
+        case BULK_VADD:
+            return 1;
+    }
+    return 0;
+}
 
+int memory_region_handling(int address, int *operation) {
     // CASE: Error checks on address
     // out of bounds invalid
     if (address < 0x0000 || address >= 0xb700 + NUM_BANKS * BANK_SIZE) {
@@ -110,24 +190,152 @@ int memory_operation_handling(
         return 1;
     }
     // store operation to instruction memory invalid
-    else if (address < 0x0400 && *operation > 18) {
+    else if (address < 0x0400 && *operation >= OP_SB) {
         return 1;
     }
     // CASE: inst.operation modification (needed for main's switch)
     // load operation to instruction memory valid
     else if (address < 0x0400) {
-        *operation += 200;
+        *operation += OP_INST_LOAD_BASE;
     }
     // heap bank valid
-    else if (address >= 0xb700 && address < 0xb700 + NUM_BANKS * BANK_SIZE && *operation < 100) {
-        *operation += 400;
+    else if (address >= 0xb700 && address < 0xb700 + NUM_BANKS * BANK_SIZE && *operation < OP_VIRTUAL_BASE) {
+        *operation += OP_HEAP_BASE;
     }
     // address >= 0x0400 && address < 0x0800 (data memory)
     return 0;
 }
 
+void heap_init(struct heap *heap) {
+    heap->head = NULL;
+    heap->spare = NULL;
+    heap->storage = NULL;
+    heap->peak_banks = 0;
+    heap->failed_mallocs = 0;
+    for (int i = 0; i < NUM_BANKS; i++) {
+        atomic_init(&heap->index[i], NULL);
+    }
+    pthread_mutex_init(&heap->lock, NULL);
+}
+
+void heap_init_banks(struct heap *heap, MemoryBank *storage) {
+    heap_init(heap);
+    heap->storage = storage;
+    // spares are taken from the front, so banks are laid out in address order
+    for (int i = NUM_BANKS - 1; i >= 0; i--) {
+        atomic_init(&storage[i].dirty, 1);
+        storage[i].next = heap->spare;
+        heap->spare = &storage[i];
+    }
+}
+
+// Frees the banks of list that were malloc'd
+static void free_banks(struct heap *heap, MemoryBank *list) {
+    if (heap->storage == NULL) {
+        heap_free_all(list);
+        return;
+    }
+    while (list != NULL) {
+        MemoryBank *next = list->next;
+        if (list < heap->storage || list >= heap->storage + NUM_BANKS) {
+            free(list);
+        }
+        list = next;
+    }
+}
+
+void heap_reset(struct heap *heap) {
+    // the banks keep their dirty flags, so only the written ones are
+    // zeroed when they are handed out again
+    MemoryBank *bank = heap->head;
+    while (bank != NULL) {
+        MemoryBank *next = bank->next;
+        bank->next = heap->spare;
+        heap->spare = bank;
+        bank = next;
+    }
+    heap->head = NULL;
+    heap->peak_banks = 0;
+    heap->failed_mallocs = 0;
+    for (int i = 0; i < NUM_BANKS; i++) {
+        atomic_store_explicit(&heap->index[i], NULL, memory_order_relaxed);
+    }
+}
+
+void heap_destroy(struct heap *heap) {
+    free_banks(heap, heap->head);
+    free_banks(heap, heap->spare);
+    heap->head = NULL;
+    heap->spare = NULL;
+    pthread_mutex_destroy(&heap->lock);
+}
+
+static void publish(struct heap *heap, MemoryBank *bank, MemoryBank *value) {
+    atomic_store_explicit(&heap->index[(bank->start_address - BASE_ADDR) / BANK_SIZE], value,
+                          memory_order_release);
+}
+
+static int list_malloc(struct heap *heap, int size);
+
+int heap_malloc(struct heap *heap, int size) {
+    pthread_mutex_lock(&heap->lock);
+    int address = list_malloc(heap, size);
+    // the list is at most NUM_BANKS long, so the index is simply resynced
+    int allocated = 0;
+    for (MemoryBank *bank = heap->head; bank != NULL; bank = bank->next) {
+        publish(heap, bank, bank->allocated ? bank : NULL);
+        allocated += bank->allocated;
+    }
+    heap->peak_banks = allocated > heap->peak_banks ? allocated : heap->peak_banks;
+    heap->failed_mallocs += address == 0;
+    pthread_mutex_unlock(&heap->lock);
+    return address;
+}
+
+// A bank to append to the list, one kept by heap_reset if there is any
+static MemoryBank *take_bank(struct heap *heap) {
+    MemoryBank *bank = heap->spare;
+    if (bank != NULL) {
+        heap->spare = bank->next;
+    } else {
+        bank = (MemoryBank *)malloc(sizeof(MemoryBank));
+        atomic_init(&bank->dirty, 1);
+    }
+    return bank;
+}
 
-int heap_malloc(MemoryBank **head, int size) {
+// Zeroes a bank being allocated. Freeing leaves the data alone, so this
+// is the only place banks are cleared, and only if they were written
+static void clear_bank(MemoryBank *bank) {
+    if (atomic_load_explicit(&bank->dirty, memory_order_relaxed)) {
+        memset(bank->data, 0, BANK_SIZE);
+        atomic_store_explicit(&bank->dirty, 0, memory_order_relaxed);
+    }
+}
+
+// Allocates the bank after prev and returns it
+static MemoryBank *extend(struct heap *heap, MemoryBank *prev) {
+    MemoryBank *new_bank;
+    // end of LL
+    if (prev->next == NULL) {
+        new_bank = take_bank(heap);
+    } 
+    // previously allocated then freed
+    else {
+        new_bank = prev->next;
+    }
+    clear_bank(new_bank);
+    new_bank->start_address = prev->start_address + BANK_SIZE;
+    new_bank->allocated = 1;
+    new_bank->next = NULL;
+    new_bank->next_in_chunk = 1;
+    prev->next = new_bank;
+    return new_bank;
+}
+
+// Allocation in the bank list, the index is left to heap_malloc
+static int list_malloc(struct heap *heap, int size) {
+    MemoryBank **head = &heap->head;
     MemoryBank *current = *head;
     MemoryBank *prev = NULL;
     // eg (100 + 64 - 1) / 64 = 2
@@ -140,16 +348,16 @@ int heap_malloc(MemoryBank **head, int size) {
     // CASE: List is empty
     // will allocate and return if so
     if (*head == NULL) {
-        *head = (MemoryBank *)malloc(sizeof(MemoryBank));
-        memset((*head)->data, 0, BANK_SIZE);
+        *head = take_bank(heap);
+        clear_bank(*head);
         (*head)->start_address = BASE_ADDR;
         (*head)->allocated = 1;
         (*head)->next = NULL;
         (*head)->next_in_chunk = 1;
         prev = *head;
         for (int i = 1; i < required_banks; i++) {
-            current = (MemoryBank *)malloc(sizeof(MemoryBank));
-            memset(current->data, 0, BANK_SIZE);
+            current = take_bank(heap);
+            clear_bank(current);
             current->start_address = prev->start_address + BANK_SIZE;
             current->allocated = 1;
             current->next = NULL;
@@ -170,12 +378,14 @@ int heap_malloc(MemoryBank **head, int size) {
             consecutive_banks++;
             // There is an empty consecutive stretch, allocate
             if (consecutive_banks == required_banks) {
-                prev = prev->next;
+                // the stretch starts at the head if nothing before it is allocated
+                prev = prev != NULL ? prev->next : *head;
                 for (int i = 0; i < required_banks; i++) {
                     prev->allocated = 1;
                     prev->next_in_chunk = 1;
-                    // we already know prev->data will be filled with 0s,
-                    // since this was previously allocated then 'freed'
+                    // previously allocated then 'freed', the data is
+                    // whatever was last stored there
+                    clear_bank(prev);
                     prev = prev->next;
                 }
                 // now, current = prev
@@ -201,36 +411,36 @@ int heap_malloc(MemoryBank **head, int size) {
     // H - ... - A - N
     // H - ... - A - U - N
     // H - ... - A - U - U - U - N
-    if (prev->start_address + BANK_SIZE * required_banks < BASE_ADDR + NUM_BANKS * BANK_SIZE) {
+    if (prev != NULL && prev->start_address + BANK_SIZE * required_banks < BASE_ADDR + NUM_BANKS * BANK_SIZE) {
         // Allocate each bank
         for (int i = 0; i < required_banks; i++) {
-            MemoryBank *new_bank;
-            // end of LL
-            if (prev->next == NULL) {
-                new_bank = (MemoryBank *)malloc(sizeof(MemoryBank));
-            } 
-            // previously allocated then freed
-            else {
-                new_bank = prev->next;
-            }
-            memset(new_bank->data, 0, BANK_SIZE);
-            new_bank->start_address = prev->start_address + BANK_SIZE;
-            new_bank->allocated = 1;
-            new_bank->next = NULL;
-            new_bank->next_in_chunk = 1;
-            prev->next = new_bank;
-            prev = new_bank;
+            prev = extend(heap, prev);
         }
         prev->next_in_chunk = 0;
         return prev->start_address - (required_banks - 1) * BANK_SIZE;
     }
 
+    // CASE: every bank in the LL is free, but there are too few of them
+    // will take the head and extend from it, as for an empty LL
+    if (prev == NULL && required_banks <= NUM_BANKS) {
+        prev = *head;
+        clear_bank(prev);
+        prev->allocated = 1;
+        for (int i = 1; i < required_banks; i++) {
+            prev->next_in_chunk = 1;
+            prev = extend(heap, prev);
+        }
+        prev->next_in_chunk = 0;
+        return BASE_ADDR;
+    }
+
     // CASE: sufficient space does not exist, allocation failed
     return 0;
 }
 
-static int heap_free(MemoryBank *head, int address) {
-    MemoryBank *current = head;
+static int heap_free(struct heap *heap, int address) {
+    pthread_mutex_lock(&heap->lock);
+    MemoryBank *current = heap->head;
     address = address - (address % BANK_SIZE);
     // should be the start address of the bank
     while (current != NULL) {
@@ -238,44 +448,18 @@ static int heap_free(MemoryBank *head, int address) {
             // Found the starting bank
             while (current != NULL && current->allocated) {
                 current->allocated = 0;
-                // fill char array with 0s
-                memset(current->data, 0, BANK_SIZE);
+                publish(heap, current, NULL);
+                // zeroed when allocated again, see clear_bank
                 current = current->next;
                 if (current != NULL && current->next_in_chunk == 0) {
                     break;
                 }
             }
+            pthread_mutex_unlock(&heap->lock);
             return 0;
         }
         current = current->next;
     }
+    pthread_mutex_unlock(&heap->lock);
     return 1;
 }
-
-// Returns a pointer to the memory address
-MemoryBank *heap_get_ptr(MemoryBank* head, int address) {
-    if (address < BASE_ADDR || address >= BASE_ADDR + NUM_BANKS * BANK_SIZE) {
-        return NULL;
-    }
-
-    address = address - (address % BANK_SIZE);
-
-    MemoryBank *current = head;
-
-    if (head == NULL) {
-        return NULL;
-    }
-
-    while (current != NULL) {
-        if (address == current->start_address) {
-            if (!current->allocated) {
-                return NULL;
-            }
-            // return a pointer to the start of the chunk related in memory
-            return current;
-        }
-        current = current->next;
-    }
-
-    return NULL;
-}
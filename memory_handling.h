@@ -1,6 +1,11 @@
 #ifndef MEMORY_HANDLING_H
 #define MEMORY_HANDLING_H
 
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "console.h"
+
 #define NUM_BANKS 128
 #define BANK_SIZE 64
 #define BASE_ADDR 0xb700
@@ -11,9 +16,46 @@ typedef struct MemoryBank {
     char allocated;
     // next_in_chunk is 1 if the next bank is part of the same chunk
     char next_in_chunk;
+    // set by every store to data, banks are only zeroed again, on their
+    // next allocation, if it is set. Atomic as harts may store at once
+    _Atomic char dirty;
     struct MemoryBank *next;
 } MemoryBank;
 
+/*
+    The heap: banks in address order, linked from head, plus an index of
+    the allocated ones by bank number. Allocation and freeing take the
+    lock; lookups only read the index, so harts sharing a heap (see
+    hart.h) load and store to it in parallel without contending.
+*/
+struct heap {
+    MemoryBank *head;
+    MemoryBank *_Atomic index[NUM_BANKS];
+    pthread_mutex_t lock;
+    MemoryBank *spare;          // banks kept by heap_reset, used before malloc
+    MemoryBank *storage;        // NUM_BANKS banks owned by the caller, see heap_init_banks
+    // since the last reset, for --metrics
+    int peak_banks;             // most banks allocated at once
+    uint32_t failed_mallocs;    // mallocs that returned 0
+};
+
+void heap_init(struct heap *heap);
+
+// heap_init with room for every bank in storage (NUM_BANKS of them),
+// which the heap takes banks from instead of malloc and never frees
+void heap_init_banks(struct heap *heap, MemoryBank *storage);
+
+// Empties the heap as if it were fresh, keeping the banks for reuse
+void heap_reset(struct heap *heap);
+
+// Frees every bank not in the storage, and the lock
+void heap_destroy(struct heap *heap);
+
+// Records a store to bank
+static inline void heap_mark_dirty(MemoryBank *bank) {
+    atomic_store_explicit(&bank->dirty, 1, memory_order_relaxed);
+}
+
 /*
     Handles (in order): 
         - virtual routines
@@ -28,14 +70,44 @@ int memory_operation_handling(
     int *pc, 
     char *virt_mem, 
     int *operation,
-    MemoryBank **head
+    struct heap *heap,
+    struct console *console
 );
 
+// Executes the virtual routine at address, if there is one.
+// Returns 1 if address is a virtual routine, 0 otherwise
+int virtual_routine_handling(
+    int address, 
+    int *reg_bank, 
+    char *data_mem, 
+    int rs2, 
+    int *pc, 
+    char *virt_mem, 
+    int *operation,
+    struct heap *heap,
+    struct console *console
+);
+
+// Returns 1 if virtual_routine_handling handles address
+int virtual_routine_exists(int address);
+
+// Checks a non virtual routine address and adjusts operation for the
+// region it falls in (the OP_*_BASE offsets of opcodes.h). Returns 1 if
+// the access is invalid
+int memory_region_handling(int address, int *operation);
+
 // Malloc implementation for the heap bank
-int heap_malloc(MemoryBank **head, int size);
+int heap_malloc(struct heap *heap, int size);
 
-// Returns a pointer to the MemoryBank of that address
-MemoryBank *heap_get_ptr(MemoryBank *head, int address);
+// Returns a pointer to the allocated MemoryBank of that address, NULL if
+// there is none
+static inline MemoryBank *heap_get_ptr(struct heap *heap, int address) {
+    if (address < BASE_ADDR || address >= BASE_ADDR + NUM_BANKS * BANK_SIZE) {
+        return NULL;
+    }
+    // acquire pairs with the release publishing a freshly cleared bank
+    return atomic_load_explicit(&heap->index[(address - BASE_ADDR) / BANK_SIZE], memory_order_acquire);
+}
 
 
 #endif // MEMORY_HANDLING_H
\ No newline at end of file
@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "metrics.h"
+#include "vm.h"
+
+static const char *class_names[METRIC_CLASSES] = {
+    "alu", "muldiv", "load", "store", "branch", "jump", "atomic", "other"
+};
+
+// By vm status
+static const char *stop_names[METRIC_STOPS] = {
+    "budget", "halted", "finished", "error", "trap"
+};
+
+static uint64_t elapsed_ns(const struct timespec *start, const struct timespec *end) {
+    return (uint64_t)(end->tv_sec - start->tv_sec) * 1000000000 + end->tv_nsec - start->tv_nsec;
+}
+
+static clockid_t cpu_clock(int thread) {
+    return thread ? CLOCK_THREAD_CPUTIME_ID : CLOCK_PROCESS_CPUTIME_ID;
+}
+
+void metrics_start(struct metrics *m, struct vm *vm, const char *name, int thread) {
+    memset(m, 0, sizeof(*m));
+    snprintf(m->name, sizeof(m->name), "%s", name != NULL ? name : "");
+    if (vm->console != NULL) {
+        m->read_start = vm->console->bytes_read;
+        m->written_start = vm->console->bytes_written;
+    }
+    vm->metrics = m;
+    clock_gettime(cpu_clock(thread), &m->cpu_start);
+    clock_gettime(CLOCK_MONOTONIC, &m->wall_start);
+}
+
+void metrics_stop(struct metrics *m, struct vm *vm, int status, int thread) {
+    struct timespec wall_end, cpu_end;
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    clock_gettime(cpu_clock(thread), &cpu_end);
+    vm->metrics = NULL;
+    m->runs = 1;
+    m->wall_ns = elapsed_ns(&m->wall_start, &wall_end);
+    m->cpu_ns = elapsed_ns(&m->cpu_start, &cpu_end);
+    m->instret = vm->instret;
+    if (status >= 0 && status < METRIC_STOPS) {
+        m->stops[status] = 1;
+    }
+    if (m->has_classes) {
+        uint64_t counted = 0;
+        for (int i = 0; i < METRIC_CLASSES; i++) {
+            counted += m->classes[i];
+        }
+        m->classes[METRIC_OTHER] += vm->instret > counted ? vm->instret - counted : 0;
+    }
+    m->heap_peak = (uint64_t)vm->heap->peak_banks * BANK_SIZE;
+    m->heap_failures = vm->heap->failed_mallocs;
+    if (vm->console != NULL) {
+        m->console_read = vm->console->bytes_read - m->read_start;
+        m->console_written = vm->console->bytes_written - m->written_start;
+    }
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        m->peak_rss = (uint64_t)usage.ru_maxrss * 1024;    // kilobytes on Linux
+    }
+}
+
+void metrics_add(struct metrics *dst, const struct metrics *src) {
+    // the totals have classes only if every run had them
+    dst->has_classes = dst->runs == 0 ? src->has_classes : dst->has_classes && src->has_classes;
+    dst->runs += src->runs;
+    dst->instret += src->instret;
+    dst->wall_ns += src->wall_ns;
+    dst->cpu_ns += src->cpu_ns;
+    for (int i = 0; i < METRIC_STOPS; i++) {
+        dst->stops[i] += src->stops[i];
+    }
+    for (int i = 0; i < METRIC_CLASSES; i++) {
+        dst->classes[i] += src->classes[i];
+    }
+    for (int i = 0; i < METRIC_ROUTINES; i++) {
+        dst->routine_calls[i] += src->routine_calls[i];
+    }
+    dst->heap_peak = src->heap_peak > dst->heap_peak ? src->heap_peak : dst->heap_peak;
+    dst->heap_failures += src->heap_failures;
+    dst->console_read += src->console_read;
+    dst->console_written += src->console_written;
+    dst->peak_rss = src->peak_rss > dst->peak_rss ? src->peak_rss : dst->peak_rss;
+}
+
+void metrics_report_init(struct metrics_report *r) {
+    memset(r, 0, sizeof(*r));
+}
+
+void metrics_report_add(struct metrics_report *r, const struct metrics *job) {
+    if (r->jobs == NULL) {
+        r->jobs = (struct metrics *)malloc(METRICS_MAX_JOBS * sizeof(struct metrics));
+    }
+    r->jobs[r->count % METRICS_MAX_JOBS] = *job;
+    r->count++;
+    metrics_add(&r->total, job);
+}
+
+void metrics_report_free(struct metrics_report *r) {
+    free(r->jobs);
+    r->jobs = NULL;
+}
+
+// Index of the first job kept, and how many there are
+static uint64_t first_job(const struct metrics_report *r, uint64_t *kept) {
+    *kept = r->count < METRICS_MAX_JOBS ? r->count : METRICS_MAX_JOBS;
+    return r->count - *kept;
+}
+
+static double mips(const struct metrics *m) {
+    return m->wall_ns > 0 ? (double)m->instret / m->wall_ns * 1e3 : 0.0;
+}
+
+// s as the contents of a JSON string or Prometheus label value, which
+// escape the same characters here
+static void write_escaped(FILE *out, const char *s) {
+    for (; *s != '\0'; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c == '\n') {
+            fputs("\\n", out);
+        } else if (c < 0x20) {
+            fputc('?', out);
+        } else {
+            fputc(c, out);
+        }
+    }
+}
+
+static void write_json_metrics(FILE *out, const struct metrics *m, const char *indent) {
+    fprintf(out, "{\n");
+    if (m->name[0] != '\0') {
+        fprintf(out, "%s  \"name\": \"", indent);
+        write_escaped(out, m->name);
+        fprintf(out, "\",\n");
+    }
+    fprintf(out, "%s  \"runs\": %llu,\n", indent, (unsigned long long)m->runs);
+    fprintf(out, "%s  \"instructions\": %llu,\n", indent, (unsigned long long)m->instret);
+    fprintf(out, "%s  \"wall_seconds\": %.9f,\n", indent, m->wall_ns / 1e9);
+    fprintf(out, "%s  \"cpu_seconds\": %.9f,\n", indent, m->cpu_ns / 1e9);
+    fprintf(out, "%s  \"mips\": %.3f,\n", indent, mips(m));
+    fprintf(out, "%s  \"stops\": {", indent);
+    for (int i = 0; i < METRIC_STOPS; i++) {
+        fprintf(out, "%s\"%s\": %llu", i > 0 ? ", " : "", stop_names[i], (unsigned long long)m->stops[i]);
+    }
+    fprintf(out, "},\n");
+    fprintf(out, "%s  \"instruction_classes\": ", indent);
+    if (m->has_classes) {
+        fprintf(out, "{");
+        for (int i = 0; i < METRIC_CLASSES; i++) {
+            fprintf(out, "%s\"%s\": %llu", i > 0 ? ", " : "", class_names[i], (unsigned long long)m->classes[i]);
+        }
+        fprintf(out, "},\n");
+    } else {
+        fprintf(out, "null,\n");
+    }
+    fprintf(out, "%s  \"virtual_routine_calls\": {", indent);
+    int first = 1;
+    for (int i = 0; i < METRIC_ROUTINES; i++) {
+        if (m->routine_calls[i] != 0) {
+            fprintf(out, "%s\"0x%04x\": %llu", first ? "" : ", ", 0x0800 + i, (unsigned long long)m->routine_calls[i]);
+            first = 0;
+        }
+    }
+    fprintf(out, "},\n");
+    fprintf(out, "%s  \"heap_peak_bytes\": %llu,\n", indent, (unsigned long long)m->heap_peak);
+    fprintf(out, "%s  \"heap_failures\": %llu,\n", indent, (unsigned long long)m->heap_failures);
+    fprintf(out, "%s  \"console_bytes_read\": %llu,\n", indent, (unsigned long long)m->console_read);
+    fprintf(out, "%s  \"console_bytes_written\": %llu,\n", indent, (unsigned long long)m->console_written);
+    fprintf(out, "%s  \"peak_rss_bytes\": %llu\n", indent, (unsigned long long)m->peak_rss);
+    fprintf(out, "%s}", indent);
+}
+
+// Opens path's temporary file, which finish renames to path
+static FILE *open_temporary(const char *path, char **temporary) {
+    size_t size = strlen(path) + 5;
+    *temporary = (char *)malloc(size);
+    snprintf(*temporary, size, "%s.tmp", path);
+    FILE *out = fopen(*temporary, "w");
+    if (out == NULL) {
+        free(*temporary);
+    }
+    return out;
+}
+
+static int finish(FILE *out, char *temporary, const char *path) {
+    int failed = fclose(out) != 0 || rename(temporary, path) != 0;
+    if (failed) {
+        remove(temporary);
+    }
+    free(temporary);
+    return failed;
+}
+
+int metrics_write_json(const struct metrics_report *r, const char *path) {
+    char *temporary;
+    FILE *out = open_temporary(path, &temporary);
+    if (out == NULL) {
+        return 1;
+    }
+    uint64_t kept;
+    uint64_t first = first_job(r, &kept);
+    fprintf(out, "{\n  \"total\": ");
+    write_json_metrics(out, &r->total, "  ");
+    fprintf(out, ",\n  \"jobs_dropped\": %llu,\n  \"jobs\": [", (unsigned long long)first);
+    for (uint64_t i = first; i < r->count; i++) {
+        fprintf(out, "%s\n    ", i > first ? "," : "");
+        write_json_metrics(out, &r->jobs[i % METRICS_MAX_JOBS], "    ");
+    }
+    fprintf(out, "%s]\n}\n", kept > 0 ? "\n  " : "");
+    return finish(out, temporary, path);
+}
+
+// The labels of a sample: for a job (NULL for the totals) and extra
+static void write_labels(FILE *out, const struct metrics *job, uint64_t index, const char *extra) {
+    if (job == NULL) {
+        if (extra != NULL) {
+            fprintf(out, "{%s}", extra);
+        }
+        return;
+    }
+    fprintf(out, "{job_index=\"%llu\",name=\"", (unsigned long long)index);
+    write_escaped(out, job->name);
+    fprintf(out, "\"%s%s}", extra != NULL ? "," : "", extra != NULL ? extra : "");
+}
+
+// What a metric reads from a struct metrics, index selecting a class,
+// stop reason or routine
+typedef double (*metric_value)(const struct metrics *m, int index);
+
+static double get_runs(const struct metrics *m, int i) { (void)i; return (double)m->runs; }
+static double get_instret(const struct metrics *m, int i) { (void)i; return (double)m->instret; }
+static double get_wall(const struct metrics *m, int i) { (void)i; return m->wall_ns / 1e9; }
+static double get_cpu(const struct metrics *m, int i) { (void)i; return m->cpu_ns / 1e9; }
+static double get_mips(const struct metrics *m, int i) { (void)i; return mips(m); }
+static double get_stop(const struct metrics *m, int i) { return (double)m->stops[i]; }
+static double get_class(const struct metrics *m, int i) { return (double)m->classes[i]; }
+static double get_routine(const struct metrics *m, int i) { return (double)m->routine_calls[i]; }
+static double get_heap_peak(const struct metrics *m, int i) { (void)i; return (double)m->heap_peak; }
+static double get_heap_failures(const struct metrics *m, int i) { (void)i; return (double)m->heap_failures; }
+static double get_read(const struct metrics *m, int i) { (void)i; return (double)m->console_read; }
+static double get_written(const struct metrics *m, int i) { (void)i; return (double)m->console_written; }
+static double get_rss(const struct metrics *m, int i) { (void)i; return (double)m->peak_rss; }
+
+#define LABEL_NONE 0
+#define LABEL_STOP 1
+#define LABEL_CLASS 2
+#define LABEL_ROUTINE 3
+
+struct prometheus_metric {
+    const char *name;
+    const char *type;
+    const char *help;
+    metric_value value;
+    int label;
+};
+
+static const struct prometheus_metric prometheus_metrics[] = {
+    {"runs_total", "counter", "Guest runs.", get_runs, LABEL_NONE},
+    {"instructions_total", "counter", "Retired guest instructions.", get_instret, LABEL_NONE},
+    {"wall_seconds_total", "counter", "Wall-clock time running guests.", get_wall, LABEL_NONE},
+    {"cpu_seconds_total", "counter", "CPU time running guests.", get_cpu, LABEL_NONE},
+    {"mips", "gauge", "Million guest instructions per wall-clock second.", get_mips, LABEL_NONE},
+    {"stops_total", "counter", "Runs by stop reason.", get_stop, LABEL_STOP},
+    {"instructions_by_class_total", "counter", "Retired guest instructions by class.", get_class, LABEL_CLASS},
+    {"virtual_routine_calls_total", "counter", "Virtual routine calls by address.", get_routine, LABEL_ROUTINE},
+    {"heap_peak_bytes", "gauge", "Most heap bytes allocated at once.", get_heap_peak, LABEL_NONE},
+    {"heap_failures_total", "counter", "Guest mallocs that failed.", get_heap_failures, LABEL_NONE},
+    {"console_read_bytes_total", "counter", "Console input bytes consumed.", get_read, LABEL_NONE},
+    {"console_written_bytes_total", "counter", "Console output bytes written.", get_written, LABEL_NONE},
+    {"peak_rss_bytes", "gauge", "Peak resident set size of the process.", get_rss, LABEL_NONE},
+};
+
+// The samples of metric from m, the totals unless job is set
+static void write_samples(FILE *out, const struct prometheus_metric *metric,
+                          const struct metrics *m, int job, uint64_t index) {
+    char extra[64];
+    int count = 1;
+    switch (metric->label) {
+        case LABEL_STOP: count = METRIC_STOPS; break;
+        case LABEL_CLASS: count = m->has_classes ? METRIC_CLASSES : 0; break;
+        case LABEL_ROUTINE: count = METRIC_ROUTINES; break;
+    }
+    for (int i = 0; i < count; i++) {
+        switch (metric->label) {
+            case LABEL_STOP:
+                snprintf(extra, sizeof(extra), "stop=\"%s\"", stop_names[i]);
+                break;
+            case LABEL_CLASS:
+                snprintf(extra, sizeof(extra), "class=\"%s\"", class_names[i]);
+                break;
+            case LABEL_ROUTINE:
+                if (m->routine_calls[i] == 0) {
+                    continue;
+                }
+                snprintf(extra, sizeof(extra), "address=\"0x%04x\"", 0x0800 + i);
+                break;
+        }
+        fprintf(out, "riskxvii_%s", metric->name);
+        write_labels(out, job ? m : NULL, index, metric->label != LABEL_NONE ? extra : NULL);
+        fprintf(out, " %.17g\n", metric->value(m, i));
+    }
+}
+
+int metrics_write_prometheus(const struct metrics_report *r, const char *path) {
+    char *temporary;
+    FILE *out = open_temporary(path, &temporary);
+    if (out == NULL) {
+        return 1;
+    }
+    uint64_t kept;
+    uint64_t first = first_job(r, &kept);
+    int count = (int)(sizeof(prometheus_metrics) / sizeof(prometheus_metrics[0]));
+    for (int i = 0; i < count; i++) {
+        const struct prometheus_metric *metric = &prometheus_metrics[i];
+        fprintf(out, "# HELP riskxvii_%s %s\n", metric->name, metric->help);
+        fprintf(out, "# TYPE riskxvii_%s %s\n", metric->name, metric->type);
+        write_samples(out, metric, &r->total, 0, 0);
+        for (uint64_t j = first; j < r->count; j++) {
+            write_samples(out, metric, &r->jobs[j % METRICS_MAX_JOBS], 1, j);
+        }
+    }
+    return finish(out, temporary, path);
+}
@@ -0,0 +1,109 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "opcodes.h"
+
+/*
+    Run metrics for --metrics (a JSON document) and --metrics-prometheus
+    (a Prometheus textfile), written at exit, or after every job by the
+    daemon. Every run (a job of a batch, bundle or the daemon) gets its
+    own struct metrics, and a metrics_report adds them up.
+
+    Collection costs next to nothing when it is off: the vm only looks
+    at vm->metrics on virtual routine calls, the console and heap keep
+    plain counters, and instruction classes are counted by a separate
+    copy of the switch loop (vm_run) or from per-block execution counts
+    (block engine). Other engines leave the classes out.
+*/
+
+// Instruction classes
+#define METRIC_ALU 0            // arithmetic, logic, shifts, slt, lui
+#define METRIC_MULDIV 1         // RV32M
+#define METRIC_LOAD 2
+#define METRIC_STORE 3
+#define METRIC_BRANCH 4
+#define METRIC_JUMP 5           // jal, jalr
+#define METRIC_ATOMIC 6         // RV32A
+#define METRIC_OTHER 7          // illegal and unknown, and any the engine did not see decoded
+#define METRIC_CLASSES 8
+
+// Stop reasons, by vm status (see vm.h). VM_RUNNING: the step budget ran out
+#define METRIC_STOPS 5
+
+// Virtual routine calls are counted by address - 0x0800
+#define METRIC_ROUTINES 256
+
+// Jobs kept in a report, the oldest are dropped from the per-job part
+#define METRICS_MAX_JOBS 4096
+#define METRICS_NAME_SIZE 128
+
+struct metrics {
+    char name[METRICS_NAME_SIZE];   // input or entry the job ran, empty for totals
+    uint64_t runs;
+    uint64_t instret;
+    uint64_t wall_ns;
+    uint64_t cpu_ns;
+    uint64_t stops[METRIC_STOPS];
+    int has_classes;                // classes were counted
+    uint64_t classes[METRIC_CLASSES];
+    uint64_t routine_calls[METRIC_ROUTINES];
+    uint64_t heap_peak;             // bytes allocated at once
+    uint64_t heap_failures;         // mallocs that returned 0
+    uint64_t console_read;          // input bytes consumed
+    uint64_t console_written;
+    uint64_t peak_rss;              // bytes, of the whole process
+    // set by metrics_start
+    struct timespec wall_start;
+    struct timespec cpu_start;
+    uint64_t read_start;
+    uint64_t written_start;
+};
+
+struct metrics_report {
+    struct metrics total;
+    struct metrics *jobs;           // ring of the last METRICS_MAX_JOBS
+    uint64_t count;                 // jobs added
+};
+
+struct vm;
+
+// Operation number (decoded, before any rewriting) to instruction class,
+// from the class column of opcodes.h
+static inline int metrics_class(int operation) {
+    static const int8_t classes[OP_LIMIT] = {
+#define X(number, name, mnemonic, handler, syntax, class, major, funct3, funct7) [OP_##name] = METRIC_##class,
+        RV32_OPERATIONS(X)
+#undef X
+    };
+    return operation > 0 && operation < OP_LIMIT ? classes[operation] : METRIC_OTHER;
+}
+
+// Clears m and starts a run of vm: takes the clocks and points
+// vm->metrics at m. CPU time is the process's, or the calling thread's
+// if thread is set
+void metrics_start(struct metrics *m, struct vm *vm, const char *name, int thread);
+
+// Ends the run that stopped with status: the clocks, instret, heap and
+// console counters. Classes, if counted, must be in m already;
+// METRIC_OTHER gets whatever instret they leave over
+void metrics_stop(struct metrics *m, struct vm *vm, int status, int thread);
+
+// Adds src's counts to dst (peaks are maxima)
+void metrics_add(struct metrics *dst, const struct metrics *src);
+
+void metrics_report_init(struct metrics_report *r);
+
+// Adds a finished job to the totals and the per-job part
+void metrics_report_add(struct metrics_report *r, const struct metrics *job);
+
+void metrics_report_free(struct metrics_report *r);
+
+// Write the report to path through a temporary file renamed into place,
+// so readers never see it half written. Return 1 on error
+int metrics_write_json(const struct metrics_report *r, const char *path);
+int metrics_write_prometheus(const struct metrics_report *r, const char *path);
+
+#endif // METRICS_H
@@ -0,0 +1,137 @@
+#ifndef OPCODES_H
+#define OPCODES_H
+
+/*
+    The instruction set, in one place. The decoder (helper.c), the
+    handler switch (vm.c), the disassembler (disasm.c) and the metrics
+    classes (metrics.h) are all expanded from these two tables, so an
+    instruction of an existing class and syntax is added by adding its
+    line and its handler. The translator (aot.c) and the lockstep engine
+    (lockstep.c) emit code of their own for each operation and refer to
+    them by their OP_ names.
+
+    Major opcodes, bits 6:0 of an instruction:
+
+    X(name, bits, immediate format)
+*/
+#define RV32_MAJOR_OPCODES(X)                                           \
+    X(OP,       0x33, IMM_NONE)                                         \
+    X(OP_IMM,   0x13, IMM_I)                                            \
+    X(LOAD,     0x03, IMM_I)                                            \
+    X(STORE,    0x23, IMM_S)                                            \
+    X(BRANCH,   0x63, IMM_B)                                            \
+    X(LUI,      0x37, IMM_U)                                            \
+    X(AUIPC,    0x17, IMM_U)    /* not implemented, decodes as unknown */ \
+    X(JAL,      0x6F, IMM_J)                                            \
+    X(JALR,     0x67, IMM_I)                                            \
+    X(AMO,      0x2F, IMM_NONE)
+
+/*
+    Operations:
+
+    X(number, name, mnemonic, handler, syntax, metrics class, major opcode, funct3, funct7)
+
+    number      what decode_instruction produces and vm_execute switches
+                on. The handlers offset it for where a memory access
+                went (see below), so loads and stores keep their numbers
+                below OP_VIRTUAL_BASE
+    handler     function in operations.h that executes it, loads and
+                stores also have a handler_heap for heap banks
+    syntax      operand layout, see disasm.c. With the class it also
+                gives the handler's arguments, see vm.c
+    funct3      bits 14:12, and funct7 bits 31:25, each a value or a
+                range lo ... hi; ANY3 and ANY7 when not decoded
+
+    The RV32A aq/rl bits (funct7 bits 1:0) are ignored since every
+    atomic is sequentially consistent, and lr.w also needs rs2 = 0.
+*/
+#define ANY3 0 ... 7
+#define ANY7 0 ... 127
+
+#define RV32_OPERATIONS(X)                                                                      \
+    X(1,  ADD,       "add",       add,       SYNTAX_R,       ALU,    OP,     0,    0x00)        \
+    X(2,  ADDI,      "addi",      addi,      SYNTAX_I,       ALU,    OP_IMM, 0,    ANY7)        \
+    X(3,  SUB,       "sub",       sub,       SYNTAX_R,       ALU,    OP,     0,    0x20)        \
+    X(4,  LUI,       "lui",       lui,       SYNTAX_U,       ALU,    LUI,    ANY3, ANY7)        \
+    X(5,  XOR,       "xor",       xor_reg,   SYNTAX_R,       ALU,    OP,     4,    0x00)        \
+    X(6,  XORI,      "xori",      xori,      SYNTAX_I,       ALU,    OP_IMM, 4,    ANY7)        \
+    X(7,  OR,        "or",        or_reg,    SYNTAX_R,       ALU,    OP,     6,    0x00)        \
+    X(8,  ORI,       "ori",       ori,       SYNTAX_I,       ALU,    OP_IMM, 6,    ANY7)        \
+    X(9,  AND,       "and",       and_reg,   SYNTAX_R,       ALU,    OP,     7,    0x00)        \
+    X(10, ANDI,      "andi",      andi,      SYNTAX_I,       ALU,    OP_IMM, 7,    ANY7)        \
+    X(11, SLL,       "sll",       sll,       SYNTAX_R,       ALU,    OP,     1,    0x00)        \
+    X(12, SRL,       "srl",       srl,       SYNTAX_R,       ALU,    OP,     5,    0x00)        \
+    X(13, SRA,       "sra",       sra,       SYNTAX_R,       ALU,    OP,     5,    0x20)        \
+    X(14, LB,        "lb",        lb,        SYNTAX_MEM_RD,  LOAD,   LOAD,   0,    ANY7)        \
+    X(15, LH,        "lh",        lh,        SYNTAX_MEM_RD,  LOAD,   LOAD,   1,    ANY7)        \
+    X(16, LW,        "lw",        lw,        SYNTAX_MEM_RD,  LOAD,   LOAD,   2,    ANY7)        \
+    X(17, LBU,       "lbu",       lbu,       SYNTAX_MEM_RD,  LOAD,   LOAD,   4,    ANY7)        \
+    X(18, LHU,       "lhu",       lhu,       SYNTAX_MEM_RD,  LOAD,   LOAD,   5,    ANY7)        \
+    X(19, SB,        "sb",        sb,        SYNTAX_MEM_RS2, STORE,  STORE,  0,    ANY7)        \
+    X(20, SH,        "sh",        sh,        SYNTAX_MEM_RS2, STORE,  STORE,  1,    ANY7)        \
+    X(21, SW,        "sw",        sw,        SYNTAX_MEM_RS2, STORE,  STORE,  2,    ANY7)        \
+    X(22, SLT,       "slt",       slt,       SYNTAX_R,       ALU,    OP,     2,    0x00)        \
+    X(23, SLTI,      "slti",      slti,      SYNTAX_I,       ALU,    OP_IMM, 2,    ANY7)        \
+    X(24, SLTU,      "sltu",      sltu,      SYNTAX_R,       ALU,    OP,     3,    0x00)        \
+    X(25, SLTIU,     "sltiu",     sltiu,     SYNTAX_I,       ALU,    OP_IMM, 3,    ANY7)        \
+    X(26, BEQ,       "beq",       beq,       SYNTAX_BRANCH,  BRANCH, BRANCH, 0,    ANY7)        \
+    X(27, BNE,       "bne",       bne,       SYNTAX_BRANCH,  BRANCH, BRANCH, 1,    ANY7)        \
+    X(28, BLT,       "blt",       blt,       SYNTAX_BRANCH,  BRANCH, BRANCH, 4,    ANY7)        \
+    X(29, BLTU,      "bltu",      bltu,      SYNTAX_BRANCH,  BRANCH, BRANCH, 6,    ANY7)        \
+    X(30, BGE,       "bge",       bge,       SYNTAX_BRANCH,  BRANCH, BRANCH, 5,    ANY7)        \
+    X(31, BGEU,      "bgeu",      bgeu,      SYNTAX_BRANCH,  BRANCH, BRANCH, 7,    ANY7)        \
+    X(32, JAL,       "jal",       jal,       SYNTAX_JUMP,    JUMP,   JAL,    ANY3, ANY7)        \
+    X(33, JALR,      "jalr",      jalr,      SYNTAX_MEM_RD,  JUMP,   JALR,   ANY3, ANY7)        \
+    X(34, MUL,       "mul",       mul,       SYNTAX_R,       MULDIV, OP,     0,    0x01)        \
+    X(35, MULH,      "mulh",      mulh,      SYNTAX_R,       MULDIV, OP,     1,    0x01)        \
+    X(36, MULHSU,    "mulhsu",    mulhsu,    SYNTAX_R,       MULDIV, OP,     2,    0x01)        \
+    X(37, MULHU,     "mulhu",     mulhu,     SYNTAX_R,       MULDIV, OP,     3,    0x01)        \
+    X(38, DIV,       "div",       div_reg,   SYNTAX_R,       MULDIV, OP,     4,    0x01)        \
+    X(39, DIVU,      "divu",      divu,      SYNTAX_R,       MULDIV, OP,     5,    0x01)        \
+    X(40, REM,       "rem",       rem_reg,   SYNTAX_R,       MULDIV, OP,     6,    0x01)        \
+    X(41, REMU,      "remu",      remu,      SYNTAX_R,       MULDIV, OP,     7,    0x01)        \
+    X(42, LR_W,      "lr.w",      lr_w,      SYNTAX_LR,      ATOMIC, AMO,    2,    0x08 ... 0x0B) \
+    X(43, SC_W,      "sc.w",      sc_w,      SYNTAX_AMO,     ATOMIC, AMO,    2,    0x0C ... 0x0F) \
+    X(44, AMOSWAP_W, "amoswap.w", amoswap_w, SYNTAX_AMO,     ATOMIC, AMO,    2,    0x04 ... 0x07) \
+    X(45, AMOADD_W,  "amoadd.w",  amoadd_w,  SYNTAX_AMO,     ATOMIC, AMO,    2,    0x00 ... 0x03)
+
+// Operation numbers: OP_ADD, OP_ADDI, ... OP_UNKNOWN if not decoded
+enum operation {
+    OP_UNKNOWN = -1,
+#define X(number, name, mnemonic, handler, syntax, class, major, funct3, funct7) OP_##name = number,
+    RV32_OPERATIONS(X)
+#undef X
+    OP_LIMIT    // one past the highest
+};
+
+// What the memory handlers (memory_handling.h) add to a load or store's
+// number once they know where it goes, and leave as the whole number
+#define OP_VIRTUAL_BASE 100     // a virtual routine's load, alone a routine already run
+#define OP_INST_LOAD_BASE 200   // a load from instruction memory
+#define OP_HEAP_BASE 400        // a heap bank access, alone a malloc or free
+#define OP_ILLEGAL 500          // an invalid access or operation
+
+enum major_opcode {
+    MAJOR_NONE,     // not an implemented opcode
+#define X(name, bits, format) MAJOR_##name,
+    RV32_MAJOR_OPCODES(X)
+#undef X
+    NUM_MAJOR_OPCODES
+};
+
+enum immediate_format { IMM_NONE, IMM_I, IMM_S, IMM_B, IMM_U, IMM_J, NUM_IMM_FORMATS };
+
+// Operand layouts, for the disassembler
+enum operation_syntax {
+    SYNTAX_R,           // rd, rs1, rs2
+    SYNTAX_I,           // rd, rs1, imm
+    SYNTAX_U,           // rd, imm >> 12
+    SYNTAX_MEM_RD,      // rd, imm(rs1)
+    SYNTAX_MEM_RS2,     // rs2, imm(rs1)
+    SYNTAX_BRANCH,      // rs1, rs2, target
+    SYNTAX_JUMP,        // rd, target
+    SYNTAX_LR,          // rd, (rs1)
+    SYNTAX_AMO,         // rd, rs2, (rs1)
+};
+
+#endif // OPCODES_H
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "memory_handling.h"
 
@@ -20,7 +21,9 @@
 
     Note: the heap access operations that use more than 1 byte require 
     special implementations to handle the cases where the heap access 
-    overflows to the next chunk
+    overflows to the next chunk. Accesses within a single bank take a
+    fast path (one bank lookup and one memcpy), only accesses crossing
+    a bank boundary are assembled a byte at a time
 
 */
 
@@ -104,6 +107,84 @@ void sra(int *reg_bank, int rd, int rs1, int rs2) {
     reg[rd] = reg[rs1] >> (reg[rs2] & 0x1F);
 }
 
+/*
+
+    MULTIPLY AND DIVIDE OPERATIONS (RV32M)
+
+    Division never traps: dividing by zero gives all ones (quotient) or
+    the dividend (remainder), and INT32_MIN / -1 overflows to INT32_MIN
+    with remainder 0, as the RISC-V spec requires.
+
+*/
+
+// Multiply, low 32 bits
+void mul(int *reg_bank, int rd, int rs1, int rs2) {
+    int32_t *reg = (int32_t *) reg_bank;
+    reg[rd] = (int32_t)((uint32_t)reg[rs1] * (uint32_t)reg[rs2]);
+}
+
+// Multiply signed by signed, high 32 bits
+void mulh(int *reg_bank, int rd, int rs1, int rs2) {
+    int32_t *reg = (int32_t *) reg_bank;
+    reg[rd] = (int32_t)(((int64_t)reg[rs1] * (int64_t)reg[rs2]) >> 32);
+}
+
+// Multiply signed by unsigned, high 32 bits
+void mulhsu(int *reg_bank, int rd, int rs1, int rs2) {
+    int32_t *reg = (int32_t *) reg_bank;
+    reg[rd] = (int32_t)(((int64_t)reg[rs1] * (int64_t)(uint32_t)reg[rs2]) >> 32);
+}
+
+// Multiply unsigned by unsigned, high 32 bits
+void mulhu(int *reg_bank, int rd, int rs1, int rs2) {
+    int32_t *reg = (int32_t *) reg_bank;
+    reg[rd] = (int32_t)(((uint64_t)(uint32_t)reg[rs1] * (uint32_t)reg[rs2]) >> 32);
+}
+
+// Divide signed
+void div_reg(int *reg_bank, int rd, int rs1, int rs2) {
+    int32_t *reg = (int32_t *) reg_bank;
+    if (reg[rs2] == 0) {
+        reg[rd] = -1;
+    } else if (reg[rs1] == INT32_MIN && reg[rs2] == -1) {
+        reg[rd] = INT32_MIN;
+    } else {
+        reg[rd] = reg[rs1] / reg[rs2];
+    }
+}
+
+// Divide unsigned
+void divu(int *reg_bank, int rd, int rs1, int rs2) {
+    int32_t *reg = (int32_t *) reg_bank;
+    if (reg[rs2] == 0) {
+        reg[rd] = -1;
+    } else {
+        reg[rd] = (int32_t)((uint32_t)reg[rs1] / (uint32_t)reg[rs2]);
+    }
+}
+
+// Remainder signed
+void rem_reg(int *reg_bank, int rd, int rs1, int rs2) {
+    int32_t *reg = (int32_t *) reg_bank;
+    if (reg[rs2] == 0) {
+        reg[rd] = reg[rs1];
+    } else if (reg[rs1] == INT32_MIN && reg[rs2] == -1) {
+        reg[rd] = 0;
+    } else {
+        reg[rd] = reg[rs1] % reg[rs2];
+    }
+}
+
+// Remainder unsigned
+void remu(int *reg_bank, int rd, int rs1, int rs2) {
+    int32_t *reg = (int32_t *) reg_bank;
+    if (reg[rs2] == 0) {
+        reg[rd] = reg[rs1];
+    } else {
+        reg[rd] = (int32_t)((uint32_t)reg[rs1] % (uint32_t)reg[rs2]);
+    }
+}
+
 /*
 
     MEMORY ACCESS OPERATIONS
@@ -297,11 +378,70 @@ void jalr(int *reg_bank, int *pc, int rd, int rs1, int imm) {
 
 */
 
+// Slow path for accesses that cross into the next bank: every byte is
+// looked up separately, since consecutive banks need not be allocated
+static int heap_read_slow(struct heap *heap, int address, unsigned char *out, int size) {
+    for (int i = 0; i < size; i++) {
+        MemoryBank *chunk = heap_get_ptr(heap, address + i);
+        if (chunk == NULL) {
+            return 1;
+        }
+        out[i] = chunk->data[(address + i) % BANK_SIZE];
+    }
+    return 0;
+}
+
+static int heap_write_slow(struct heap *heap, int address, const unsigned char *in, int size) {
+    // validate every bank before writing so a failed store has no effect
+    for (int i = 0; i < size; i++) {
+        if (heap_get_ptr(heap, address + i) == NULL) {
+            return 1;
+        }
+    }
+    for (int i = 0; i < size; i++) {
+        MemoryBank *chunk = heap_get_ptr(heap, address + i);
+        chunk->data[(address + i) % BANK_SIZE] = in[i];
+        heap_mark_dirty(chunk);
+    }
+    return 0;
+}
+
+// Copies size bytes (little-endian) from the heap into out.
+// Fast path: the access lies within one bank, so a single bank
+// lookup and one memcpy are enough
+static int heap_read(struct heap *heap, int address, void *out, int size) {
+    MemoryBank *chunk = heap_get_ptr(heap, address);
+    if (chunk == NULL) {
+        return 1;
+    }
+    int offset = address % BANK_SIZE;
+    if (offset + size <= BANK_SIZE) {
+        memcpy(out, &chunk->data[offset], size);
+        return 0;
+    }
+    return heap_read_slow(heap, address, out, size);
+}
+
+// Copies size bytes from in to the heap, see heap_read
+static int heap_write(struct heap *heap, int address, const void *in, int size) {
+    MemoryBank *chunk = heap_get_ptr(heap, address);
+    if (chunk == NULL) {
+        return 1;
+    }
+    int offset = address % BANK_SIZE;
+    if (offset + size <= BANK_SIZE) {
+        memcpy(&chunk->data[offset], in, size);
+        heap_mark_dirty(chunk);
+        return 0;
+    }
+    return heap_write_slow(heap, address, in, size);
+}
+
 // Load byte
-int lb_heap(int *reg_bank, MemoryBank *head, int rd, int rs1, int imm) {
+int lb_heap(int *reg_bank, struct heap *heap, int rd, int rs1, int imm) {
     int32_t *reg = (int32_t *) reg_bank;
     int address = reg[rs1] + imm;
-    MemoryBank *chunk = heap_get_ptr(head, address);
+    MemoryBank *chunk = heap_get_ptr(heap, address);
     if (chunk == NULL) {
         return 1;
     }
@@ -310,61 +450,34 @@ int lb_heap(int *reg_bank, MemoryBank *head, int rd, int rs1, int imm) {
 }
 
 // Load half word
-int lh_heap(int *reg_bank, MemoryBank *head, int rd, int rs1, int imm) {
+int lh_heap(int *reg_bank, struct heap *heap, int rd, int rs1, int imm) {
     int32_t *reg = (int32_t *) reg_bank;
     int address = reg[rs1] + imm;
-    MemoryBank *chunk = heap_get_ptr(head, address);
-    if (chunk == NULL) {
+    int16_t value;
+    if (heap_read(heap, address, &value, sizeof(value))) {
         return 1;
     }
-    // if it overflows to the next chunk
-    if (address % BANK_SIZE + 1 == BANK_SIZE) {
-        MemoryBank *chunk2 = heap_get_ptr(head, address + 1);
-        if (chunk2 == NULL) {
-            return 1;
-        }
-        reg[rd] = 
-            (int16_t)(chunk->data[BANK_SIZE - 1] | 
-            (chunk2->data[0] << 8));
-    }
-    else {
-        reg[rd] = 
-            (chunk->data[address % BANK_SIZE] | 
-            (chunk->data[address % BANK_SIZE + 1] << 8));
-    }
+    reg[rd] = value;
     return 0;
 }
 
 // Load word
-int lw_heap(int *reg_bank, MemoryBank *head, int rd, int rs1, int imm) {
+int lw_heap(int *reg_bank, struct heap *heap, int rd, int rs1, int imm) {
     int32_t *reg = (int32_t *) reg_bank;
     int address = reg[rs1] + imm;
-    unsigned char *data_mem_unsigned;
-    uint32_t result = 0;
-    MemoryBank *current_chunk;
-    current_chunk = heap_get_ptr(head, address);
-    for (int i = 0; i < 4; i++) {
-        // if it overflows to the next chunk
-        if (address % BANK_SIZE + i == BANK_SIZE) {
-            current_chunk = heap_get_ptr(head, address + i);
-        }
-        if (current_chunk == NULL) {
-            return 1;
-        }
-        data_mem_unsigned = (unsigned char *)current_chunk->data;
-        result |= data_mem_unsigned[address % BANK_SIZE] << (8 * i);
-        address++;
+    int32_t value;
+    if (heap_read(heap, address, &value, sizeof(value))) {
+        return 1;
     }
-
-    reg[rd] = result;
+    reg[rd] = value;
     return 0;
 }
 
 // Load byte unsigned
-int lbu_heap(int *reg_bank, MemoryBank *head, int rd, int rs1, int imm) {
+int lbu_heap(int *reg_bank, struct heap *heap, int rd, int rs1, int imm) {
     int32_t *reg = (int32_t *) reg_bank;
     int address = reg[rs1] + imm;
-    MemoryBank *chunk = heap_get_ptr(head, address);
+    MemoryBank *chunk = heap_get_ptr(heap, address);
     if (chunk == NULL) {
         return 1;
     }
@@ -373,84 +486,127 @@ int lbu_heap(int *reg_bank, MemoryBank *head, int rd, int rs1, int imm) {
 }
 
 // Load half word unsigned
-int lhu_heap(int *reg_bank, MemoryBank *head, int rd, int rs1, int imm) {
+int lhu_heap(int *reg_bank, struct heap *heap, int rd, int rs1, int imm) {
     int32_t *reg = (int32_t *) reg_bank;
     int address = reg[rs1] + imm;
-    MemoryBank *chunk = heap_get_ptr(head, address);
-    if (chunk == NULL) {
+    uint16_t value;
+    if (heap_read(heap, address, &value, sizeof(value))) {
         return 1;
     }
-
-    // if it overflows to the next chunk
-    if (address % BANK_SIZE + 1 == BANK_SIZE) {
-        MemoryBank *chunk2 = heap_get_ptr(head, address + 1);
-        if (chunk2 == NULL) {
-            return 1;
-        }
-        reg[rd] = 
-            (int16_t)(chunk->data[BANK_SIZE - 1] | 
-            (chunk2->data[0] << 8));
-    }
-    else {
-        reg[rd] = 
-            (int16_t)(chunk->data[address % BANK_SIZE] | 
-            (chunk->data[address % BANK_SIZE + 1] << 8));
-    }
+    reg[rd] = value;
     return 0;
 }
 
 // Store byte
-int sb_heap(int *reg_bank, MemoryBank *head, int rs1, int rs2, int imm) {
+int sb_heap(int *reg_bank, struct heap *heap, int rs1, int rs2, int imm) {
     int32_t *reg = (int32_t *) reg_bank;
     uint16_t address = reg[rs1] + imm;
-    MemoryBank *chunk = heap_get_ptr(head, address);
+    MemoryBank *chunk = heap_get_ptr(heap, address);
     if (chunk == NULL) {
         return 1;
     }
     chunk->data[address % BANK_SIZE] = reg[rs2] & 0xFF;
+    heap_mark_dirty(chunk);
     return 0;
 }
 
 // Store half word
-int sh_heap(int *reg_bank, MemoryBank *head, int rs1, int rs2, int imm) {
+int sh_heap(int *reg_bank, struct heap *heap, int rs1, int rs2, int imm) {
     int32_t *reg = (int32_t *) reg_bank;
-    uint16_t address = reg[rs1] + imm;
-    MemoryBank *chunk = heap_get_ptr(head, address);
-    if (chunk == NULL) {
-        return 1;
+    int address = reg[rs1] + imm;
+    uint16_t value = reg[rs2] & 0xFFFF;
+    return heap_write(heap, address, &value, sizeof(value));
+}
+
+// Store word
+int sw_heap(int *reg_bank, struct heap *heap, int rs1, int rs2, int imm) {
+    int32_t *reg = (int32_t *) reg_bank;
+    int address = reg[rs1] + imm;
+    int32_t value = reg[rs2];
+    return heap_write(heap, address, &value, sizeof(value));
+}
+
+/*
+
+    ATOMIC MEMORY OPERATIONS (RV32A)
+
+    Harts (see hart.h) run on separate host threads, so these use the
+    host's atomics on the guest word. The word must be aligned, in data
+    memory or an allocated heap bank. sc.w succeeds if the word still
+    holds the value lr.w read, which also accepts a store of that same
+    value in between.
+
+*/
+
+// Host pointer to the aligned guest word at address, NULL if invalid.
+// Heap banks are marked dirty, lr.w included, which costs at most a
+// needless clear. Data memory is tracked by the vm
+static int32_t *atomic_word(char *data_mem, struct heap *heap, int address) {
+    if (address % 4 != 0) {
+        return NULL;
     }
-    // if it overflows to the next chunk
-    if (address % BANK_SIZE + 1 == BANK_SIZE) {
-        MemoryBank *chunk2 = heap_get_ptr(head, address + 1);
-        if (chunk2 == NULL) {
-            return 1;
-        }
-        chunk->data[63] = reg[rs2] & 0xFF;
-        chunk2->data[0] = (reg[rs2] >> 8) & 0xFF;
+    if (address >= 0x0400 && address < 0x0800) {
+        return (int32_t *)&data_mem[address - 0x0400];
     }
-    else {
-        chunk->data[address % BANK_SIZE] = reg[rs2] & 0xFF;
-        chunk->data[address % BANK_SIZE] = (reg[rs2] >> 8) & 0xFF;
+    MemoryBank *bank = heap_get_ptr(heap, address);
+    if (bank == NULL) {
+        return NULL;
     }
+    heap_mark_dirty(bank);
+    return (int32_t *)&bank->data[address % BANK_SIZE];
+}
+
+// Load reserved word
+int lr_w(int *reg_bank, char *data_mem, struct heap *heap, int rd, int rs1, int rs2,
+         int *reservation, int32_t *reserved_value) {
+    int32_t *reg = (int32_t *) reg_bank;
+    int32_t *word = atomic_word(data_mem, heap, reg[rs1]);
+    if (word == NULL) {
+        return 1;
+    }
+    *reservation = reg[rs1];
+    *reserved_value = __atomic_load_n(word, __ATOMIC_SEQ_CST);
+    reg[rd] = *reserved_value;
     return 0;
 }
 
-// Store word
-int sw_heap(int *reg_bank, MemoryBank *head, int rs1, int rs2, int imm) {
+// Store conditional word, rd is 0 on success and 1 on failure
+int sc_w(int *reg_bank, char *data_mem, struct heap *heap, int rd, int rs1, int rs2,
+         int *reservation, int32_t *reserved_value) {
     int32_t *reg = (int32_t *) reg_bank;
-    uint16_t address = reg[rs1] + imm;
-    MemoryBank *chunk = heap_get_ptr(head, address);
-    if (chunk == NULL) {
+    int32_t *word = atomic_word(data_mem, heap, reg[rs1]);
+    if (word == NULL) {
         return 1;
     }
-    int i=0;
-    while (i < 4) {
-        // if it overflows to the next chunk
-        if (address % BANK_SIZE + i == BANK_SIZE) {
-            chunk = heap_get_ptr(head, address + i);
-        }
-        chunk->data[address % BANK_SIZE + i] = (reg[rs2] >> (i*8)) & 0xFF;
-        i++;
+    int success = *reservation == reg[rs1] &&
+                  __atomic_compare_exchange_n(word, reserved_value, reg[rs2], 0,
+                                              __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    *reservation = -1;
+    reg[rd] = !success;
+    return 0;
+}
+
+// Atomic swap word
+int amoswap_w(int *reg_bank, char *data_mem, struct heap *heap, int rd, int rs1, int rs2,
+              int *reservation, int32_t *reserved_value) {
+    int32_t *reg = (int32_t *) reg_bank;
+    int32_t *word = atomic_word(data_mem, heap, reg[rs1]);
+    if (word == NULL) {
+        return 1;
     }
+    reg[rd] = __atomic_exchange_n(word, reg[rs2], __ATOMIC_SEQ_CST);
     return 0;
-}
\ No newline at end of file
+}
+
+// Atomic add word
+int amoadd_w(int *reg_bank, char *data_mem, struct heap *heap, int rd, int rs1, int rs2,
+             int *reservation, int32_t *reserved_value) {
+    int32_t *reg = (int32_t *) reg_bank;
+    int32_t *word = atomic_word(data_mem, heap, reg[rs1]);
+    if (word == NULL) {
+        return 1;
+    }
+    // wrapping add, done unsigned
+    reg[rd] = (int32_t)__atomic_fetch_add((uint32_t *)word, (uint32_t)reg[rs2], __ATOMIC_SEQ_CST);
+    return 0;
+}
@@ -3,14 +3,16 @@
 
 #include <stdint.h>
 
+#include "memory_handling.h"
+
 /*
     All functions in this file correspond to their RISK-XVII
     implementation, with a few exceptions:
         - xor_reg, or_reg, and_reg are simply xor, or, and.
+        - div_reg, rem_reg are div, rem (the names clash with stdlib).
         - *_heap functions are memory access operations used to
-        access the heap. Since they require a pointer to the head
-        of the linked list of the heap, they have a separate
-        implementation.
+        access the heap. Since they require a pointer to the heap
+        (see memory_handling.h), they have a separate implementation.
 
 
     M is memory
@@ -38,6 +40,15 @@ void andi(int *reg_bank, int rd, int rs1, int imm);
 void sll(int *reg_bank, int rd, int rs1, int rs2);
 void srl(int *reg_bank, int rd, int rs1, int rs2);
 void sra(int *reg_bank, int rd, int rs1, int rs2);
+/* MULTIPLY AND DIVIDE OPERATIONS (RV32M) */
+void mul(int *reg_bank, int rd, int rs1, int rs2);
+void mulh(int *reg_bank, int rd, int rs1, int rs2);
+void mulhsu(int *reg_bank, int rd, int rs1, int rs2);
+void mulhu(int *reg_bank, int rd, int rs1, int rs2);
+void div_reg(int *reg_bank, int rd, int rs1, int rs2);
+void divu(int *reg_bank, int rd, int rs1, int rs2);
+void rem_reg(int *reg_bank, int rd, int rs1, int rs2);
+void remu(int *reg_bank, int rd, int rs1, int rs2);
 /* MEMORY ACCESS OPERATIONS */
 void lb(int *reg_bank, char *data_mem, int rd, int rs1, int imm);
 void lh(int *reg_bank, char *data_mem, int rd, int rs1, int imm);
@@ -61,13 +72,23 @@ void bgeu(int *reg_bank, int *pc, int rs1, int rs2, int imm);
 void jal(int *reg_bank, int *pc, int rd, int imm);
 void jalr(int *reg_bank, int *pc, int rd, int rs1, int imm);
 /* HEAP ACCESS OPERATIONS */
-int lb_heap(int *reg_bank, MemoryBank *head, int rd, int rs1, int imm);
-int lh_heap(int *reg_bank, MemoryBank *head, int rd, int rs1, int imm);
-int lw_heap(int *reg_bank, MemoryBank *head, int rd, int rs1, int imm);
-int lbu_heap(int *reg_bank, MemoryBank *head, int rd, int rs1, int imm);
-int lhu_heap(int *reg_bank, MemoryBank *head, int rd, int rs1, int imm);
-int sb_heap(int *reg_bank, MemoryBank *head, int rs1, int rs2, int imm);
-int sh_heap(int *reg_bank, MemoryBank *head, int rs1, int rs2, int imm);
-int sw_heap(int *reg_bank, MemoryBank *head, int rs1, int rs2, int imm);
+int lb_heap(int *reg_bank, struct heap *heap, int rd, int rs1, int imm);
+int lh_heap(int *reg_bank, struct heap *heap, int rd, int rs1, int imm);
+int lw_heap(int *reg_bank, struct heap *heap, int rd, int rs1, int imm);
+int lbu_heap(int *reg_bank, struct heap *heap, int rd, int rs1, int imm);
+int lhu_heap(int *reg_bank, struct heap *heap, int rd, int rs1, int imm);
+int sb_heap(int *reg_bank, struct heap *heap, int rs1, int rs2, int imm);
+int sh_heap(int *reg_bank, struct heap *heap, int rs1, int rs2, int imm);
+int sw_heap(int *reg_bank, struct heap *heap, int rs1, int rs2, int imm);
+/* ATOMIC MEMORY OPERATIONS (RV32A), return 1 on an invalid address.
+   One signature for all, lr.w ignores rs2 and the amos the reservation */
+int lr_w(int *reg_bank, char *data_mem, struct heap *heap, int rd, int rs1, int rs2,
+         int *reservation, int32_t *reserved_value);
+int sc_w(int *reg_bank, char *data_mem, struct heap *heap, int rd, int rs1, int rs2,
+         int *reservation, int32_t *reserved_value);
+int amoswap_w(int *reg_bank, char *data_mem, struct heap *heap, int rd, int rs1, int rs2,
+              int *reservation, int32_t *reserved_value);
+int amoadd_w(int *reg_bank, char *data_mem, struct heap *heap, int rd, int rs1, int rs2,
+             int *reservation, int32_t *reserved_value);
 
 #endif // OPERATIONS_H
\ No newline at end of file
@@ -0,0 +1,145 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perf.h"
+
+#define PERF_EVENTS 4
+#define PERF_GROUPS (PERF_SECTIONS + 1)     // one per section plus the whole run
+#define PERF_GROUP_RUN PERF_SECTIONS
+
+static const char *event_names[PERF_EVENTS] = {
+    "cycles", "instructions", "branch-misses", "L1d-misses"
+};
+
+static const char *group_names[PERF_GROUPS] = {
+    "execution loop", "virtual routines", "heap", "whole run"
+};
+
+int perf_active = 0;
+
+static int fds[PERF_GROUPS][PERF_EVENTS];
+static int current_section;
+
+static int open_event(int event, int group_fd, int disabled) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.disabled = disabled;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    switch (event) {
+        case 0:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case 1:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case 2:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+            break;
+        case 3:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_L1D |
+                          (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+    }
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+static void group_ioctl(int group, unsigned long request) {
+    if (fds[group][0] >= 0) {
+        ioctl(fds[group][0], request, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+static void close_all(void) {
+    for (int g = 0; g < PERF_GROUPS; g++) {
+        for (int e = 0; e < PERF_EVENTS; e++) {
+            if (fds[g][e] >= 0) {
+                close(fds[g][e]);
+                fds[g][e] = -1;
+            }
+        }
+    }
+}
+
+int perf_counters_start(void) {
+    memset(fds, -1, sizeof(fds));
+    for (int g = 0; g < PERF_GROUPS; g++) {
+        // the leader (cycles) is required, the other events are optional
+        fds[g][0] = open_event(0, -1, 1);
+        if (fds[g][0] < 0) {
+            close_all();
+            fprintf(stderr, "Performance counters unavailable, continuing without them\n");
+            return 1;
+        }
+        for (int e = 1; e < PERF_EVENTS; e++) {
+            fds[g][e] = open_event(e, fds[g][0], 1);
+        }
+    }
+    current_section = PERF_SECTION_LOOP;
+    group_ioctl(PERF_GROUP_RUN, PERF_EVENT_IOC_RESET);
+    group_ioctl(PERF_SECTION_LOOP, PERF_EVENT_IOC_RESET);
+    group_ioctl(PERF_GROUP_RUN, PERF_EVENT_IOC_ENABLE);
+    group_ioctl(PERF_SECTION_LOOP, PERF_EVENT_IOC_ENABLE);
+    perf_active = 1;
+    return 0;
+}
+
+void perf_section_switch(int section) {
+    if (section == current_section) {
+        return;
+    }
+    group_ioctl(current_section, PERF_EVENT_IOC_DISABLE);
+    group_ioctl(section, PERF_EVENT_IOC_ENABLE);
+    current_section = section;
+}
+
+static uint64_t read_event(int group, int event) {
+    uint64_t value = 0;
+    if (fds[group][event] < 0 || read(fds[group][event], &value, sizeof(value)) != sizeof(value)) {
+        return 0;
+    }
+    return value;
+}
+
+void perf_counters_stop(uint64_t instret) {
+    if (!perf_active) {
+        return;
+    }
+    for (int g = 0; g < PERF_GROUPS; g++) {
+        group_ioctl(g, PERF_EVENT_IOC_DISABLE);
+    }
+    perf_active = 0;
+
+    fprintf(stderr, "%-18s", "");
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        fprintf(stderr, " %15s", event_names[e]);
+    }
+    fprintf(stderr, "\n");
+    for (int g = PERF_GROUP_RUN; g >= 0; g--) {
+        fprintf(stderr, "%-18s", group_names[g]);
+        for (int e = 0; e < PERF_EVENTS; e++) {
+            if (fds[g][e] < 0) {
+                fprintf(stderr, " %15s", "n/a");
+            } else {
+                fprintf(stderr, " %15llu", (unsigned long long)read_event(g, e));
+            }
+        }
+        fprintf(stderr, "\n");
+    }
+    if (instret > 0) {
+        fprintf(stderr, "Host cycles per guest instruction: %.2f\n",
+                (double)read_event(PERF_GROUP_RUN, 0) / instret);
+    }
+    close_all();
+}
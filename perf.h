@@ -0,0 +1,27 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdint.h>
+
+// Parts of the run measured separately by --perf-counters
+#define PERF_SECTION_LOOP 0         // execution loop (dispatch, ALU, data memory)
+#define PERF_SECTION_VIRTUAL 1      // virtual routines (console, dumps, bulk)
+#define PERF_SECTION_HEAP 2         // heap accesses, malloc and free
+#define PERF_SECTIONS 3
+
+// Non-zero while counters are being collected, checked before switching
+// sections so the hooks cost a single predictable branch otherwise
+extern int perf_active;
+
+// Opens and starts the counters. Returns 1 (after a warning on stderr)
+// if perf events are unavailable, in which case the run goes on without them
+int perf_counters_start(void);
+
+// Attributes the following work to section
+void perf_section_switch(int section);
+
+// Stops the counters and prints them to stderr, including host cycles
+// per guest instruction for instret retired instructions
+void perf_counters_stop(uint64_t instret);
+
+#endif // PERF_H
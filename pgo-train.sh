@@ -0,0 +1,18 @@
+#!/bin/bash
+
+# Training run for the profile-guided build: every testcase and benchmark image
+binary="$1"
+
+for mi_file in testcases/*.mi bench/*.mi; do
+    filename="$(basename "${mi_file}" .mi)"
+    input_file="in/${filename}.in"
+    if [ ! -f "${input_file}" ]; then
+        input_file="$(dirname "${mi_file}")/${filename}.in"
+    fi
+    if [ ! -f "${input_file}" ]; then
+        input_file="/dev/null"
+    fi
+    "${binary}" "${mi_file}" < "${input_file}" > /dev/null
+done
+
+exit 0
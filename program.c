@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "helper.h"
+#include "program.h"
+#include "cfg.h"
+
+// Source of program ids, 0 is never handed out
+static _Atomic uint64_t next_id = 1;
+
+static void program_predecode(struct program *prog) {
+    prog->id = atomic_fetch_add(&next_id, 1);
+    for (int i = 0; i < NUM_INSTRUCTIONS; i++) {
+        prog->raw[i] = get_instruction(prog->image->inst_mem, i * 4);
+        prog->decoded[i] = decode_instruction(prog->raw[i]);
+    }
+    prog->inst_hash = hash_bytes(prog->image->inst_mem, INST_MEM_SIZE);
+    cfg_build(&prog->cfg, prog->decoded);
+}
+
+int program_load(struct program *prog, const char *path) {
+    prog->fd = open(path, O_RDONLY);
+    if (prog->fd < 0) {
+        return PROGRAM_OPEN_FAILED;
+    }
+
+    struct stat st;
+    if (fstat(prog->fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        // mmap past the end of the file would fault on access,
+        // so short files are rejected before mapping
+        if (st.st_size < INST_MEM_SIZE) {
+            close(prog->fd);
+            return PROGRAM_SHORT_INST_MEM;
+        }
+        if (st.st_size < INST_MEM_SIZE + DATA_MEM_SIZE) {
+            close(prog->fd);
+            return PROGRAM_SHORT_DATA_MEM;
+        }
+        void *image = mmap(NULL, sizeof(struct blob), PROT_READ, MAP_PRIVATE, prog->fd, 0);
+        if (image != MAP_FAILED) {
+            prog->image = (struct blob *)image;
+            prog->image_mapped = 1;
+            program_predecode(prog);
+            return PROGRAM_OK;
+        }
+    }
+
+    // Not mappable (pipe, device...): read the image into memory instead
+    prog->image = (struct blob *)malloc(sizeof(struct blob));
+    prog->image_mapped = 0;
+    FILE *file = fdopen(prog->fd, "r");
+    size_t readCount = fread(prog->image->inst_mem, 1, INST_MEM_SIZE, file);
+    int error = PROGRAM_OK;
+    if (readCount != INST_MEM_SIZE) {
+        error = PROGRAM_SHORT_INST_MEM;
+    } else if (fread(prog->image->data_mem, 1, DATA_MEM_SIZE, file) != DATA_MEM_SIZE) {
+        error = PROGRAM_SHORT_DATA_MEM;
+    }
+    fclose(file);
+    prog->fd = -1;
+    if (error != PROGRAM_OK) {
+        free(prog->image);
+        return error;
+    }
+    program_predecode(prog);
+    return PROGRAM_OK;
+}
+
+void program_from_image(struct program *prog, const struct blob *image) {
+    prog->fd = -1;
+    prog->image = (struct blob *)malloc(sizeof(struct blob));
+    prog->image_mapped = 0;
+    memcpy(prog->image, image, sizeof(struct blob));
+    program_predecode(prog);
+}
+
+const char *program_error_message(int error) {
+    switch (error) {
+        case PROGRAM_OPEN_FAILED:
+            return "Could not open file.";
+        case PROGRAM_SHORT_INST_MEM:
+            return "Error: Unable to read instruction memory from file.";
+        case PROGRAM_SHORT_DATA_MEM:
+            return "Error: Unable to read data memory from file.";
+    }
+    return "";
+}
+
+void program_print_error(int error) {
+    if (error != PROGRAM_OK) {
+        printf("%s\n", program_error_message(error));
+    }
+}
+
+struct blob *program_map_blob(const struct program *prog, char *mapped) {
+    if (prog->fd >= 0) {
+        void *b = mmap(NULL, sizeof(struct blob), PROT_READ | PROT_WRITE, MAP_PRIVATE, prog->fd, 0);
+        if (b != MAP_FAILED) {
+            *mapped = 1;
+            return (struct blob *)b;
+        }
+    }
+    struct blob *b = (struct blob *)malloc(sizeof(struct blob));
+    memcpy(b, prog->image, sizeof(struct blob));
+    *mapped = 0;
+    return b;
+}
+
+void program_unmap_blob(struct blob *b, char mapped) {
+    if (mapped) {
+        munmap(b, sizeof(struct blob));
+    } else {
+        free(b);
+    }
+}
+
+void program_free(struct program *prog) {
+    program_unmap_blob(prog->image, prog->image_mapped);
+    if (prog->fd >= 0) {
+        close(prog->fd);
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include "helper.h"
+#include "cfg.h"
+
+/*
+    A loaded .mi image, shared read-only by every VM instance running it.
+    The image is mapped from the file, and each instance maps its own
+    MAP_PRIVATE view of the same file, so untouched pages stay shared
+    with the page cache and only pages the guest writes are copied.
+*/
+struct program {
+    uint64_t id;                // unique for the process, even if the memory is reused
+    int fd;                     // backing file, -1 if the image is not file-backed
+    struct blob *image;         // read-only template
+    char image_mapped;          // 1 if image is an mmap, 0 if malloc'd
+    // pre-decoded instruction memory, indexed by pc / 4
+    struct decoded_instruction decoded[NUM_INSTRUCTIONS];
+    int raw[NUM_INSTRUCTIONS];
+    uint64_t inst_hash;         // hash of instruction memory
+    struct cfg cfg;             // control-flow graph and optimised blocks
+};
+
+// Error codes returned by program_load
+#define PROGRAM_OK 0
+#define PROGRAM_OPEN_FAILED 1
+#define PROGRAM_SHORT_INST_MEM 2
+#define PROGRAM_SHORT_DATA_MEM 3
+
+// Loads, pre-decodes and analyses the image at path
+int program_load(struct program *prog, const char *path);
+
+// Makes a program from an image held in memory (copied)
+void program_from_image(struct program *prog, const struct blob *image);
+
+// Error message matching a program_load error code
+const char *program_error_message(int error);
+
+// Prints the error message matching a program_load error code
+void program_print_error(int error);
+
+// Returns a private copy-on-write view of the image for one instance
+struct blob *program_map_blob(const struct program *prog, char *mapped);
+
+// Releases a view returned by program_map_blob
+void program_unmap_blob(struct blob *b, char mapped);
+
+// Releases the template and closes the backing file
+void program_free(struct program *prog);
+
+#endif // PROGRAM_H
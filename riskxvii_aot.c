@@ -0,0 +1,36 @@
+#include <stdio.h>
+
+#include "program.h"
+#include "aot.h"
+
+// Translates a .mi image to C, see aot.h
+int main(int argc, char *argv[]) {
+    if (argc != 2 && argc != 3) {
+        printf("Usage: ./riskxvii-aot <image> [output.c]\n");
+        return 1;
+    }
+
+    struct program prog;
+    int error = program_load(&prog, argv[1]);
+    if (error != PROGRAM_OK) {
+        program_print_error(error);
+        return 1;
+    }
+
+    FILE *out = stdout;
+    if (argc == 3) {
+        out = fopen(argv[2], "w");
+        if (out == NULL) {
+            printf("Could not open file.\n");
+            program_free(&prog);
+            return 1;
+        }
+    }
+    aot_translate(&prog, out);
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    program_free(&prog);
+    return 0;
+}
@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "daemon.h"
+#include "helper.h"
+#include "program.h"
+#include "vm.h"
+
+/*
+    Client for vm_riskxvii --daemon: runs an image on the daemon with
+    stdin as the guest's input and prints the guest's output, like
+    vm_riskxvii would. The image is passed by path unless --send-image
+    is given, in which case the daemon need not be able to read it.
+*/
+
+static void usage(void) {
+    printf("Usage: ./riskxvii-client [--stats] [--budget <n>] [--repeat <n>] [--send-image] <socket> <image>\n");
+}
+
+// Reads all of stdin
+static char *read_input(size_t *size) {
+    size_t capacity = 4096;
+    char *input = (char *)malloc(capacity);
+    *size = 0;
+    size_t n;
+    while ((n = fread(input + *size, 1, capacity - *size, stdin)) > 0) {
+        *size += n;
+        if (*size == capacity) {
+            capacity *= 2;
+            input = (char *)realloc(input, capacity);
+        }
+    }
+    return input;
+}
+
+static int connect_daemon(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int main(int argc, char *argv[]) {
+    int stats = 0;
+    int send_image = 0;
+    int repeat = 1;
+    uint64_t budget = 0;
+    int argi = 1;
+    while (argi < argc && strncmp(argv[argi], "--", 2) == 0) {
+        if (strcmp(argv[argi], "--stats") == 0) {
+            stats = 1;
+        } else if (strcmp(argv[argi], "--send-image") == 0) {
+            send_image = 1;
+        } else if (strcmp(argv[argi], "--budget") == 0 && argi + 1 < argc) {
+            budget = strtoull(argv[++argi], NULL, 10);
+        } else if (strcmp(argv[argi], "--repeat") == 0 && argi + 1 < argc) {
+            repeat = atoi(argv[++argi]);
+        } else {
+            usage();
+            return 1;
+        }
+        argi++;
+    }
+    if (argc - argi != 2 || repeat < 1) {
+        usage();
+        return 1;
+    }
+
+    // the daemon resolves paths from its own directory
+    char *reference;
+    size_t reference_size;
+    if (send_image) {
+        struct program prog;
+        int error = program_load(&prog, argv[argi + 1]);
+        if (error != PROGRAM_OK) {
+            program_print_error(error);
+            return 1;
+        }
+        reference_size = sizeof(struct blob);
+        reference = (char *)malloc(reference_size);
+        memcpy(reference, prog.image, reference_size);
+        program_free(&prog);
+    } else {
+        reference = realpath(argv[argi + 1], NULL);
+        if (reference == NULL) {
+            printf("Could not open file.\n");
+            return 1;
+        }
+        reference_size = strlen(reference);
+    }
+    size_t input_size;
+    char *input = read_input(&input_size);
+
+    int fd = connect_daemon(argv[argi]);
+    if (fd < 0) {
+        fprintf(stderr, "Could not connect to %s.\n", argv[argi]);
+        return 1;
+    }
+
+    struct daemon_request request = {0};
+    request.magic = DAEMON_MAGIC;
+    request.image_kind = send_image ? DAEMON_IMAGE_BYTES : DAEMON_IMAGE_PATH;
+    request.image_size = (uint32_t)reference_size;
+    request.input_size = (uint32_t)input_size;
+    request.step_budget = budget;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    struct daemon_response response = {0};
+    uint64_t instret = 0, nanoseconds = 0;
+    int jobs = 0, hits = 0;
+    char *output = NULL;
+    int failed = 0;
+    // every job goes over the same connection
+    for (int i = 0; i < repeat && !failed; i++) {
+        if (daemon_write_full(fd, &request, sizeof(request)) ||
+            daemon_write_full(fd, reference, reference_size) ||
+            daemon_write_full(fd, input, input_size) ||
+            daemon_read_full(fd, &response, sizeof(response)) || response.magic != DAEMON_MAGIC)
+        {
+            fprintf(stderr, "Lost the connection to the daemon.\n");
+            failed = 1;
+            break;
+        }
+        output = (char *)realloc(output, response.output_size + 1);
+        if (daemon_read_full(fd, output, response.output_size)) {
+            fprintf(stderr, "Lost the connection to the daemon.\n");
+            failed = 1;
+            break;
+        }
+        fwrite(output, 1, response.output_size, stdout);
+        jobs++;
+        instret += response.instret;
+        nanoseconds += response.nanoseconds;
+        hits += (response.flags & DAEMON_CACHE_HIT) != 0;
+        if (response.flags & DAEMON_TRUNCATED) {
+            fprintf(stderr, "Output truncated.\n");
+        }
+        if (response.stop == VM_RUNNING) {
+            fprintf(stderr, "Step budget of %llu instructions exhausted.\n", (unsigned long long)budget);
+        } else if (response.stop == DAEMON_BAD_REQUEST) {
+            fprintf(stderr, "The daemon rejected the request.\n");
+        }
+        failed = response.stop != VM_HALTED && response.stop != VM_FINISHED;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    close(fd);
+
+    if (stats) {
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        fflush(stdout);
+        fprintf(stderr, "Jobs: %d (%d image cache hits)\n", jobs, hits);
+        fprintf(stderr, "Instructions: %llu\n", (unsigned long long)instret);
+        fprintf(stderr, "Guest time: %.6f s\n", nanoseconds / 1e9);
+        fprintf(stderr, "Round trip: %.6f s, %.1f us per job\n", seconds, jobs > 0 ? seconds / jobs * 1e6 : 0.0);
+    }
+
+    free(output);
+    free(input);
+    free(reference);
+    return failed;
+}
@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "helper.h"
+#include "gen.h"
+
+// Largest input file written, later reads see EOF
+#define MAX_INPUT (1 << 20)
+
+static void usage(void) {
+    printf("Usage: ./riskxvii-gen [options] <image.mi> [input.in]\n");
+    printf("Options: --seed <n>, --size <instructions>, --loops <n>, --iterations <n>, --repeat <n>,\n");
+    printf("         --mix <alu>,<data>,<heap>,<virtual>,<branch>\n");
+}
+
+static int write_file(const char *path, const void *data, size_t size) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        return 1;
+    }
+    int failed = fwrite(data, 1, size, file) != size;
+    return fclose(file) != 0 || failed;
+}
+
+// Generates a random image (and the input it reads), see gen.h
+int main(int argc, char *argv[]) {
+    struct gen_options opts;
+    gen_default_options(&opts);
+
+    int argi = 1;
+    while (argi + 1 < argc && strncmp(argv[argi], "--", 2) == 0) {
+        const char *value = argv[argi + 1];
+        if (strcmp(argv[argi], "--seed") == 0) {
+            opts.seed = (uint32_t)strtoul(value, NULL, 10);
+        } else if (strcmp(argv[argi], "--size") == 0) {
+            opts.size = atoi(value);
+        } else if (strcmp(argv[argi], "--loops") == 0) {
+            opts.loops = atoi(value);
+        } else if (strcmp(argv[argi], "--iterations") == 0) {
+            opts.iterations = atoi(value);
+        } else if (strcmp(argv[argi], "--repeat") == 0) {
+            opts.repeat = atoi(value);
+        } else if (strcmp(argv[argi], "--mix") == 0) {
+            struct gen_mix *mix = &opts.mix;
+            if (sscanf(value, "%d,%d,%d,%d,%d", &mix->alu, &mix->data, &mix->heap, &mix->virt, &mix->branch) != 5) {
+                usage();
+                return 1;
+            }
+        } else {
+            usage();
+            return 1;
+        }
+        argi += 2;
+    }
+    if (argc - argi != 1 && argc - argi != 2) {
+        usage();
+        return 1;
+    }
+
+    struct blob image;
+    char *input = (char *)malloc(MAX_INPUT);
+    size_t input_size = gen_image(&image, &opts, input, MAX_INPUT);
+    int failed = write_file(argv[argi], &image, sizeof(image));
+    if (!failed && argc - argi == 2) {
+        failed = write_file(argv[argi + 1], input, input_size);
+    }
+    if (failed) {
+        printf("Could not open file.\n");
+    }
+    free(input);
+    return failed;
+}
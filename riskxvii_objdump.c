@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdint.h>
+
+#include "helper.h"
+#include "program.h"
+#include "cfg.h"
+#include "disasm.h"
+
+static void print_block(const struct program *prog, int index) {
+    const struct cfg_block *b = &prog->cfg.blocks[index];
+    printf("\nblock %d: 0x%04x-0x%04x, %d instruction%s", index, b->start_pc, b->end_pc,
+           b->count, b->count == 1 ? "" : "s");
+    if (b->flags & CFG_FUNCTION) {
+        printf(", function entry");
+    }
+    if (b->flags & CFG_LOOP_HEADER) {
+        printf(", loop header");
+    }
+    if (!(b->flags & CFG_REACHABLE)) {
+        printf(", unreachable");
+    }
+    printf("\n");
+
+    int zeros = 0;
+    for (int pc = b->start_pc; pc <= b->end_pc; pc += 4) {
+        // runs of empty words (padding) are collapsed
+        if (prog->raw[pc / 4] == 0) {
+            if (zeros++ == 1) {
+                printf("    ...\n");
+            }
+            if (zeros > 1 && pc != b->end_pc) {
+                continue;
+            }
+        } else {
+            zeros = 0;
+        }
+        char text[64];
+        disassemble(&prog->decoded[pc / 4], pc, text, sizeof(text));
+        printf("    %04x:  %08x  %s\n", pc, (uint32_t)prog->raw[pc / 4], text);
+    }
+
+    if (b->taken_pc >= 0 || b->fallthrough_pc >= 0) {
+        printf("    ->");
+        if (b->taken_pc >= 0) {
+            printf(" taken 0x%04x", b->taken_pc);
+        }
+        if (b->fallthrough_pc >= 0) {
+            printf(" fallthrough 0x%04x", b->fallthrough_pc);
+        }
+        printf("\n");
+    }
+}
+
+// Memory accesses of one hint kind whose address is known statically
+static void print_accesses(const struct program *prog, int kind, const char *title) {
+    const struct cfg *cfg = &prog->cfg;
+    printf("\n%s:\n", title);
+    int found = 0;
+    for (int i = 0; i < NUM_INSTRUCTIONS; i++) {
+        if (cfg->hints[i].kind != kind) {
+            continue;
+        }
+        int address = cfg->hints[i].address;
+        const char *routine = virtual_routine_name(address);
+        printf("    %04x:  %-4s 0x%04x%s%s\n", i * 4, operation_name(cfg->insts[i].operation),
+               (uint32_t)address, routine != NULL ? "  " : "", routine != NULL ? routine : "");
+        found++;
+    }
+    if (found == 0) {
+        printf("    none\n");
+    }
+}
+
+// Prints the disassembly, control-flow graph and static memory accesses of an image
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        printf("Usage: ./riskxvii-objdump <image>\n");
+        return 1;
+    }
+
+    struct program prog;
+    int error = program_load(&prog, argv[1]);
+    if (error != PROGRAM_OK) {
+        program_print_error(error);
+        return 1;
+    }
+
+    const struct cfg *cfg = &prog.cfg;
+    int loops = 0, functions = 0, reachable = 0;
+    for (int i = 0; i < cfg->num_blocks; i++) {
+        loops += (cfg->blocks[i].flags & CFG_LOOP_HEADER) != 0;
+        functions += (cfg->blocks[i].flags & CFG_FUNCTION) != 0;
+        reachable += (cfg->blocks[i].flags & CFG_REACHABLE) != 0;
+    }
+    printf("%s: %d blocks (%d reachable), %d loops, %d functions\n",
+           argv[1], cfg->num_blocks, reachable, loops, functions);
+
+    for (int i = 0; i < cfg->num_blocks; i++) {
+        print_block(&prog, i);
+    }
+    print_accesses(&prog, HINT_VIRTUAL, "Virtual routine accesses");
+    print_accesses(&prog, HINT_HEAP, "Heap accesses");
+
+    program_free(&prog);
+    return 0;
+}
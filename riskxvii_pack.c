@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "bundle.h"
+#include "helper.h"
+#include "program.h"
+
+/*
+    Packs images and inputs into a bundle (see bundle.h). The entries
+    are read from stdin, one per line:
+
+        <image> [<input>]
+
+    An entry is named after its input file, or its image if it has no
+    input, without the directory and extension; vm_riskxvii --bundle
+    selects entries by these names. Images that fail to load are left
+    out, with a message on stderr.
+*/
+
+#define MAX_LINE 8192
+
+struct pack_entry {
+    char *image_path;
+    char *input_path;           // NULL: empty input
+    char *name;
+};
+
+// Unique images by hash, open addressing. slots holds image numbers + 1
+struct image_table {
+    uint32_t *slots;
+    size_t mask;
+    struct bundle_image *images;
+    uint32_t count;
+};
+
+static void usage(void) {
+    printf("Usage: ./riskxvii-pack <bundle> < list\n");
+    printf("       each line of list: <image> [<input>]\n");
+}
+
+// Name of an entry: the file name of path without its extension
+static char *entry_name(const char *path) {
+    const char *start = strrchr(path, '/');
+    start = start != NULL ? start + 1 : path;
+    const char *end = strrchr(start, '.');
+    size_t size = end != NULL && end != start ? (size_t)(end - start) : strlen(start);
+    char *name = (char *)malloc(size + 1);
+    memcpy(name, start, size);
+    name[size] = '\0';
+    return name;
+}
+
+static int read_list(struct pack_entry **entries, size_t *count) {
+    size_t capacity = 1024;
+    *entries = (struct pack_entry *)malloc(capacity * sizeof(struct pack_entry));
+    *count = 0;
+    char line[MAX_LINE];
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        char image[MAX_LINE], input[MAX_LINE];
+        int fields = sscanf(line, "%8191s %8191s", image, input);
+        if (fields <= 0) {
+            continue;
+        }
+        if (*count == capacity) {
+            capacity *= 2;
+            *entries = (struct pack_entry *)realloc(*entries, capacity * sizeof(struct pack_entry));
+        }
+        struct pack_entry *e = &(*entries)[(*count)++];
+        e->image_path = strdup(image);
+        e->input_path = fields == 2 ? strdup(input) : NULL;
+        e->name = entry_name(fields == 2 ? input : image);
+    }
+    return *count == 0;
+}
+
+// Writes image unless an identical one is in the table, returns its number
+static uint32_t add_image(struct image_table *t, FILE *out, const struct blob *image) {
+    uint64_t hash = hash_bytes(image, sizeof(struct blob));
+    size_t i = hash & t->mask;
+    while (t->slots[i] != 0) {
+        const struct bundle_image *seen = &t->images[t->slots[i] - 1];
+        if (seen->hash == hash) {
+            // compare the stored copy, in case two images share a hash
+            struct blob stored;
+            off_t end = ftello(out);
+            fseeko(out, (off_t)seen->offset, SEEK_SET);
+            size_t read = fread(&stored, 1, sizeof(stored), out);
+            fseeko(out, end, SEEK_SET);
+            if (read == sizeof(stored) && memcmp(&stored, image, sizeof(stored)) == 0) {
+                return t->slots[i] - 1;
+            }
+        }
+        i = (i + 1) & t->mask;
+    }
+    t->images[t->count].hash = hash;
+    t->images[t->count].offset = (uint64_t)ftello(out);
+    fwrite(image, 1, sizeof(struct blob), out);
+    t->slots[i] = ++t->count;
+    return t->count - 1;
+}
+
+// Appends the file at path to out, returns its size or -1
+static long append_file(FILE *out, const char *path) {
+    FILE *in = fopen(path, "rb");
+    if (in == NULL) {
+        return -1;
+    }
+    char buf[65536];
+    long size = 0;
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        fwrite(buf, 1, n, out);
+        size += n;
+    }
+    fclose(in);
+    return size;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        usage();
+        return 1;
+    }
+    struct pack_entry *list;
+    size_t count;
+    if (read_list(&list, &count)) {
+        usage();
+        return 1;
+    }
+
+    FILE *out = fopen(argv[1], "w+b");
+    if (out == NULL) {
+        printf("Could not open file.\n");
+        return 1;
+    }
+    struct bundle_header header = {0};
+    header.magic = BUNDLE_MAGIC;
+    struct bundle_entry *entries = (struct bundle_entry *)calloc(count, sizeof(struct bundle_entry));
+    size_t *kept = (size_t *)malloc(count * sizeof(size_t));
+
+    // the data follows the entry table, which shrinks if images are left
+    // out; the space it would have taken is simply unused
+    fseeko(out, (off_t)(sizeof(struct bundle_header) + count * sizeof(struct bundle_entry)), SEEK_SET);
+
+    struct image_table table = {0};
+    size_t slots = 2;
+    while (slots < count * 2) {
+        slots *= 2;
+    }
+    table.slots = (uint32_t *)calloc(slots, sizeof(uint32_t));
+    table.mask = slots - 1;
+    table.images = (struct bundle_image *)malloc(count * sizeof(struct bundle_image));
+
+    int failed = 0;
+    uint32_t n = 0;
+    struct blob *image = (struct blob *)malloc(sizeof(struct blob));
+    for (size_t i = 0; i < count && !failed; i++) {
+        struct program prog;
+        int error = program_load(&prog, list[i].image_path);
+        if (error != PROGRAM_OK) {
+            fprintf(stderr, "%s: %s\n", list[i].image_path, program_error_message(error));
+            continue;
+        }
+        memcpy(image, prog.image, sizeof(struct blob));
+        program_free(&prog);
+        entries[n].image = add_image(&table, out, image);
+
+        entries[n].input_offset = (uint64_t)ftello(out);
+        if (list[i].input_path != NULL) {
+            long size = append_file(out, list[i].input_path);
+            if (size < 0) {
+                printf("%s: Could not open file.\n", list[i].input_path);
+                failed = 1;
+            } else if (size > UINT32_MAX) {
+                printf("%s: Input too large for a bundle.\n", list[i].input_path);
+                failed = 1;
+            }
+            entries[n].input_size = (uint32_t)(size > 0 ? size : 0);
+        }
+        kept[n++] = i;
+    }
+    free(image);
+
+    // then the names and the image table, once their sizes are known
+    for (uint32_t i = 0; i < n; i++) {
+        entries[i].name_offset = (uint64_t)ftello(out);
+        entries[i].name_size = (uint32_t)strlen(list[kept[i]].name);
+        fwrite(list[kept[i]].name, 1, entries[i].name_size, out);
+    }
+    off_t end = ftello(out);
+    header.images_offset = (uint64_t)(end + 7) / 8 * 8;
+    header.image_count = table.count;
+    header.entry_count = n;
+    fseeko(out, (off_t)header.images_offset, SEEK_SET);
+    fwrite(table.images, sizeof(struct bundle_image), table.count, out);
+    fseeko(out, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, out);
+    fwrite(entries, sizeof(struct bundle_entry), n, out);
+    failed |= fclose(out) != 0;
+    if (failed) {
+        remove(argv[1]);
+    } else {
+        printf("%u entries, %u unique images\n", n, table.count);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        free(list[i].image_path);
+        free(list[i].input_path);
+        free(list[i].name);
+    }
+    free(list);
+    free(entries);
+    free(kept);
+    free(table.slots);
+    free(table.images);
+    return failed;
+}
@@ -1,7 +1,7 @@
 #!/bin/bash
 
 rm *.gcno *.gcda *.gcov
-gcc -fprofile-arcs -ftest-coverage -o vm_riskxvii vm_riskxvii.c helper.c operations.c memory_handling.c
+gcc -fprofile-arcs -ftest-coverage -rdynamic -o vm_riskxvii vm_riskxvii.c daemon.c helper.c operations.c memory_handling.c program.c vm.c console.c block_cache.c block_opt.c cfg.c aot_loader.c bulk.c perf.c debug.c tier.c hart.c bundle.c lockstep.c metrics.c arena.c -ldl -lpthread
 
 output_dir="out"
 input_dir="in"
@@ -16,5 +16,70 @@ for input_file in "${input_dir}"/*.in; do
     ./vm_riskxvii "${mi_file}" < "${input_file}" > "${output_dir}/${filename}.out"
 done
 
+# Replaying a recorded run must reproduce its output without reading stdin
+./vm_riskxvii --record replay.log testcases/add_2_numbers.mi < in/add_2_numbers.in > /dev/null
+./vm_riskxvii --replay replay.log testcases/add_2_numbers.mi < /dev/null > "${output_dir}/add_2_numbers_replay.out"
+rm replay.log
+# Runs of a batch share one instance, which must start each run as if fresh
+./vm_riskxvii --batch testcases/reset_state.mi in/reset_state.in in/reset_state.in > "${output_dir}/reset_state_batch.out"
+./vm_riskxvii --engine block --batch testcases/reset_state.mi in/reset_state.in in/reset_state.in >> "${output_dir}/reset_state_batch.out"
+# Every engine must count the same retired instructions
+./vm_riskxvii --engine block testcases/counters.mi < in/counters.in > "${output_dir}/counters_engines.out"
+./vm_riskxvii --engine lockstep --batch testcases/counters.mi in/counters.in in/counters.in >> "${output_dir}/counters_engines.out"
+# The lockstep engine must print what separate runs print, with lanes
+# that part ways on their inputs and more inputs than lanes
+./vm_riskxvii --engine lockstep --lanes 4 --batch testcases/heap_bubblesort_1.mi in/heap_bubblesort_1.in in/3_sum.in in/simple_random.in in/fib_1.in in/add_2_numbers.in > "${output_dir}/heap_bubblesort_1_lockstep.out"
+# Lanes parted by a branch must rejoin where the paths meet
+./vm_riskxvii --stats --engine lockstep --batch testcases/lockstep_rejoin.mi in/lockstep_rejoin.in in/heap_malloc_2.in in/lockstep_rejoin.in in/heap_malloc_2.in in/lockstep_rejoin.in in/heap_malloc_2.in in/lockstep_rejoin.in in/heap_malloc_2.in 2>&1 | grep -v "^Time\|^MIPS" > "${output_dir}/lockstep_rejoin_lanes.out"
+# Workers must print what a batch run one input after another prints
+./vm_riskxvii --workers 3 --batch testcases/heap_bubblesort_1.mi in/heap_bubblesort_1.in in/3_sum.in in/simple_random.in in/fib_1.in in/add_2_numbers.in > "${output_dir}/heap_bubblesort_1_workers.out"
+./vm_riskxvii --workers 2 --engine block --batch testcases/heap_bubblesort_1.mi in/heap_bubblesort_1.in in/3_sum.in in/simple_random.in in/fib_1.in in/add_2_numbers.in >> "${output_dir}/heap_bubblesort_1_workers.out"
+# The metrics of a batch must come out the same on the engines that count
+# instruction classes, leaving out the timings and process size
+./vm_riskxvii --metrics metrics_test.json --batch testcases/heap_bubblesort_1.mi in/heap_bubblesort_1.in in/fib_1.in > /dev/null
+grep -v "seconds\|mips\|rss" metrics_test.json > "${output_dir}/metrics.out"
+./vm_riskxvii --engine block --metrics-prometheus metrics_test.prom --batch testcases/heap_bubblesort_1.mi in/heap_bubblesort_1.in in/fib_1.in > /dev/null
+grep "^riskxvii_instructions_by_class_total\|^riskxvii_virtual_routine_calls_total" metrics_test.prom >> "${output_dir}/metrics.out"
+rm metrics_test.json metrics_test.prom
+
+# An ahead-of-time translated image must behave exactly like the interpreter
+gcc -o riskxvii-aot riskxvii_aot.c aot.c helper.c operations.c memory_handling.c program.c vm.c console.c block_cache.c block_opt.c cfg.c aot_loader.c bulk.c perf.c debug.c tier.c hart.c bundle.c lockstep.c metrics.c arena.c -ldl -lpthread
+./riskxvii-aot testcases/add_2_numbers_withfunc.mi aot_test.c
+gcc -O2 -shared -fPIC -I. -o aot_test.so aot_test.c
+./vm_riskxvii --aot ./aot_test.so testcases/add_2_numbers_withfunc.mi < in/add_2_numbers_withfunc.in > "${output_dir}/add_2_numbers_withfunc_aot.out"
+# The tiered engine, promoting at once up to the translated code, must too
+./vm_riskxvii --engine tiered --tier-threshold 1 --aot ./aot_test.so testcases/add_2_numbers_withfunc.mi < in/add_2_numbers_withfunc.in > "${output_dir}/add_2_numbers_withfunc_tiered.out"
+rm aot_test.c aot_test.so
+
+# A scripted debugger session: breakpoint, step, watchpoint and inspection
+./vm_riskxvii --debug-script testcases/add_2_numbers_withfunc.debug testcases/add_2_numbers_withfunc.mi < in/add_2_numbers_withfunc.in > "${output_dir}/add_2_numbers_withfunc_debug.out" 2>&1
+# Watchpoints see the destination of bulk routines
+./vm_riskxvii --debug-script testcases/bulk_memory.debug testcases/bulk_memory.mi < in/bulk_memory.in > "${output_dir}/bulk_memory_debug.out" 2>&1
+# Watchpoints see the stores made by atomics
+./vm_riskxvii --debug-script testcases/harts_sum.debug testcases/harts_sum.mi < in/harts_sum.in > "${output_dir}/harts_sum_debug.out" 2>&1
+
+# Harts sharing memory must reach the same totals on either engine
+./vm_riskxvii --harts 4 testcases/harts_sum.mi < in/harts_sum.in > "${output_dir}/harts_sum_harts.out"
+./vm_riskxvii --engine block --harts 4 testcases/harts_sum.mi < in/harts_sum.in > "${output_dir}/harts_sum_harts_block.out"
+
+# A bundle runs its entries like separate runs, sharing the decoded form
+# of identical images, and picks entries by name
+gcc -o riskxvii-pack riskxvii_pack.c helper.c operations.c memory_handling.c program.c vm.c console.c block_cache.c block_opt.c cfg.c aot_loader.c bulk.c perf.c debug.c tier.c hart.c bundle.c lockstep.c metrics.c arena.c -ldl -lpthread
+printf "testcases/add_2_numbers.mi in/add_2_numbers.in\ntestcases/printing_h.mi in/printing_h.in\ntestcases/add_2_numbers.mi in/mul_2_numbers.in\n" | ./riskxvii-pack bundle_test.rxb > /dev/null
+./vm_riskxvii --bundle bundle_test.rxb > "${output_dir}/bundle.out"
+./vm_riskxvii --bundle bundle_test.rxb mul_2_numbers printing_h >> "${output_dir}/bundle.out"
+rm bundle_test.rxb
+
+# Jobs run by the daemon must print what the vm prints, also when its
+# instances and decoded image are reused, and stop at the step budget
+gcc -o riskxvii-client riskxvii_client.c daemon.c helper.c operations.c memory_handling.c program.c vm.c console.c block_cache.c block_opt.c cfg.c aot_loader.c bulk.c perf.c debug.c tier.c hart.c bundle.c lockstep.c metrics.c arena.c -ldl -lpthread
+./vm_riskxvii --daemon daemon_test.sock --pool 2 &
+daemon_pid=$!
+while [ ! -S daemon_test.sock ]; do sleep 0.1; done
+./riskxvii-client --repeat 2 daemon_test.sock testcases/add_2_numbers_withfunc.mi < in/add_2_numbers_withfunc.in > "${output_dir}/add_2_numbers_withfunc_daemon.out"
+./riskxvii-client --send-image --budget 20 daemon_test.sock testcases/add_2_numbers_withfunc.mi < in/add_2_numbers_withfunc.in > "${output_dir}/add_2_numbers_withfunc_daemon_budget.out" 2>&1
+kill "${daemon_pid}"
+rm daemon_test.sock
+
 # Coverage logs (gcov) are generated in the same directory as the source files
-gcov vm_riskxvii-vm_riskxvii vm_riskxvii-helper vm_riskxvii-operations vm_riskxvii-memory_handling
+gcov vm_riskxvii-vm_riskxvii vm_riskxvii-daemon vm_riskxvii-helper vm_riskxvii-operations vm_riskxvii-memory_handling vm_riskxvii-program vm_riskxvii-vm vm_riskxvii-console vm_riskxvii-block_cache vm_riskxvii-block_opt vm_riskxvii-cfg vm_riskxvii-aot_loader vm_riskxvii-bulk vm_riskxvii-perf vm_riskxvii-debug vm_riskxvii-tier vm_riskxvii-hart vm_riskxvii-bundle vm_riskxvii-lockstep vm_riskxvii-metrics vm_riskxvii-arena
@@ -0,0 +1,65 @@
+# Bulk memory virtual routines: memcpy, memset, memcmp and vector add
+  li t0, 0x800
+  li s0, 10              # newline
+  li a1, 128
+  sw a1, 0x30(t0)        # malloc(128): two heap banks, R[28] = 0xb700
+  mv s1, t3
+  # memcpy 40 bytes of a[] into the heap, straddling the bank boundary
+  addi a0, s1, 40
+  li a1, 0x400
+  li a2, 40
+  sw zero, 0x38(t0)
+  lw a3, 76(s1)          # a[9] copied to 0xb74c
+  sw a3, 4(t0)
+  sb s0, 0(t0)
+  # memcmp heap copy with a[]: equal
+  addi a0, s1, 40
+  li a1, 0x400
+  li a2, 40
+  sw zero, 0x40(t0)
+  sw t3, 4(t0)
+  sb s0, 0(t0)
+  # memcmp a[] with b[]: a[0] = 1 < b[0] = 10
+  li a0, 0x400
+  li a1, 0x428
+  sw zero, 0x40(t0)
+  sw t3, 4(t0)
+  sb s0, 0(t0)
+  # vadd c[] = a[] + b[] (10 elements) in data memory
+  li a0, 0x450
+  li a1, 0x400
+  li a2, 0x428
+  li a3, 10
+  sw zero, 0x44(t0)
+  lw a4, 0x450(zero)
+  sw a4, 4(t0)
+  sb s0, 0(t0)
+  lw a4, 0x474(zero)
+  sw a4, 4(t0)
+  sb s0, 0(t0)
+  # vadd into the heap copy, across the bank boundary: heap[] += b[]
+  addi a0, s1, 40
+  addi a1, s1, 40
+  li a2, 0x428
+  li a3, 10
+  sw zero, 0x44(t0)
+  lw a4, 76(s1)
+  sw a4, 4(t0)
+  sb s0, 0(t0)
+  # memset 8 bytes to 0x7f across the boundary
+  addi a0, s1, 60
+  li a1, 0x7f
+  li a2, 8
+  sw zero, 0x3c(t0)
+  lw a4, 62(s1)
+  sw a4, 8(t0)
+  sb s0, 0(t0)
+  # memcpy past the end of the heap allocation is illegal
+  addi a0, s1, 100
+  li a1, 0x400
+  li a2, 40
+  sw zero, 0x38(t0)
+  sw zero, 0x0c(t0)
+.data
+a: .word 1, 2, 3, 4, 5, 6, 7, 8, 9, 10
+b: .word 10, 20, 30, 40, 50, 60, 70, 80, 90, 100
@@ -0,0 +1,46 @@
+# Counter routines: prints the instructions retired up to the first
+# read of instret and its high word, the instructions a 10 iteration
+# loop retires between two reads, then 1 for each of time and cycle if
+# the loop took between 0 and 2^30 ns by it. The clock readings are
+# cleared, so every engine ends in the same state. Prints 3 0, 42, 1 1
+  li t0, 0x800
+  lw s1, 0x50(t0)         # instret
+  lw s2, 0x54(t0)         # its high word
+  sw s1, 4(t0)
+  li t1, 32
+  sw t1, 0(t0)
+  sw s2, 4(t0)
+  li t1, 10
+  sw t1, 0(t0)
+  lw s3, 0x58(t0)         # time
+  lw s4, 0x60(t0)         # cycle
+  lw s1, 0x50(t0)
+  li t2, 10
+loop:
+  addi t2, t2, -1
+  add t3, t3, t2
+  xor t4, t3, t2
+  bne t2, zero, loop
+  lw s2, 0x50(t0)
+  lw s5, 0x58(t0)
+  lw s6, 0x60(t0)
+  sub s2, s2, s1
+  sw s2, 4(t0)
+  li t1, 10
+  sw t1, 0(t0)
+  lui t5, 0x40000
+  sub s5, s5, s3
+  sltu s5, s5, t5
+  sw s5, 4(t0)
+  li t1, 32
+  sw t1, 0(t0)
+  sub s6, s6, s4
+  sltu s6, s6, t5
+  sw s6, 4(t0)
+  li t1, 10
+  sw t1, 0(t0)
+  li s3, 0
+  li s4, 0
+  li s5, 0
+  li s6, 0
+  sw zero, 0xC(t0)
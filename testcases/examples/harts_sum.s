@@ -0,0 +1,68 @@
+# Multi-hart reduction (run with --harts n): hart 0 reads a count, then
+# every hart adds its share of 1..count with amoadd.w, with an lr.w/sc.w
+# loop and under an amoswap.w spinlock, and adds its id + 1 through a
+# heap bank of its own. Hart 0 prints the number of harts and the totals
+  li t0, 0x800
+  li s5, 0x400            # shared words, see below
+  lw s0, 0x48(t0)         # hart id
+  bne s0, zero, join
+  lw t1, 0x16(t0)         # count, only hart 0 has input
+  sw t1, 4(s5)
+join:
+  li t1, 1
+  addi t2, s5, 16
+  amoadd.w zero, t1, (t2) # number of harts
+  sw zero, 0x4C(t0)       # barrier
+  lw s1, 16(s5)           # stride
+  lw s2, 4(s5)            # count
+  addi s3, s0, 1          # i
+loop:
+  blt s2, s3, done
+  amoadd.w zero, s3, (s5) # sum with amoadd.w
+  addi t2, s5, 12
+retry:
+  lr.w t5, (t2)           # sum with lr.w/sc.w
+  add t5, t5, s3
+  sc.w t4, t5, (t2)
+  bne t4, zero, retry
+  addi t2, s5, 8
+  li t1, 1
+acquire:
+  amoswap.w t4, t1, (t2)  # spinlock around a plain increment
+  bne t4, zero, acquire
+  lw t5, 20(s5)
+  addi t5, t5, 1
+  sw t5, 20(s5)
+  amoswap.w zero, zero, (t2)
+  add s3, s3, s1
+  j loop
+done:
+  li t1, 64
+  sw t1, 0x30(t0)         # malloc, pointer in t3
+  addi t1, s0, 1
+  sw t1, 0(t3)
+  lw t4, 0(t3)
+  addi t2, s5, 24
+  amoadd.w zero, t4, (t2) # sum of the heap words
+  sw t3, 0x34(t0)         # free
+  sw zero, 0x4C(t0)       # barrier
+  bne s0, zero, halt
+  lw a0, 16(s5)
+  call print
+  lw a0, 0(s5)
+  call print
+  lw a0, 12(s5)
+  call print
+  lw a0, 20(s5)
+  call print
+  lw a0, 24(s5)
+  call print
+halt:
+  sw zero, 0x4C(t0)       # barrier, the others wait for the output
+  sw zero, 12(t0)         # halt
+
+print:
+  sw a0, 4(t0)
+  li t1, 10
+  sb t1, 0(t0)            # newline
+  ret
@@ -0,0 +1,40 @@
+# Heap loads/stores within one bank and across a bank boundary
+  li t0, 0x800
+  li a0, 10            # newline
+  li a1, 128
+  sw a1, 0x30(t0)      # malloc(128) -> two banks, R[28] = 0xb700
+  li s0, 0x12345678
+  li s1, -2            # 0xfffffffe
+  # within one bank
+  sw s0, 8(t3)
+  lw a2, 8(t3)
+  sw a2, 8(t0)
+  sb a0, 0(t0)
+  sh s1, 16(t3)
+  lh a2, 16(t3)
+  sw a2, 8(t0)
+  sb a0, 0(t0)
+  lhu a2, 16(t3)
+  sw a2, 8(t0)
+  sb a0, 0(t0)
+  # crossing the 0xb73f/0xb740 boundary
+  sw s0, 62(t3)
+  lw a2, 62(t3)
+  sw a2, 8(t0)
+  sb a0, 0(t0)
+  lhu a2, 62(t3)
+  sw a2, 8(t0)
+  sb a0, 0(t0)
+  sh s1, 63(t3)
+  lh a2, 63(t3)
+  sw a2, 8(t0)
+  sb a0, 0(t0)
+  lhu a2, 63(t3)
+  sw a2, 8(t0)
+  sb a0, 0(t0)
+  lw a2, 61(t3)
+  sw a2, 8(t0)
+  sb a0, 0(t0)
+  # word crossing into an unallocated bank is illegal
+  sw s0, 126(t3)
+  sw zero, 0x0c(t0)
@@ -0,0 +1,36 @@
+# RV32M: reads a count, then that many pairs a b, and prints
+# mul mulh mulhsu mulhu div divu rem remu of each pair in hex
+  li t0, 0x800
+  lw s0, 0x16(t0)         # number of pairs
+loop:
+  beq s0, zero, done
+  lw s1, 0x16(t0)         # a
+  lw s2, 0x16(t0)         # b
+  mul a0, s1, s2
+  call print
+  mulh a0, s1, s2
+  call print
+  mulhsu a0, s1, s2
+  call print
+  mulhu a0, s1, s2
+  call print
+  div a0, s1, s2
+  call print
+  divu a0, s1, s2
+  call print
+  rem a0, s1, s2
+  call print
+  remu a0, s1, s2
+  call print
+  li t1, 10
+  sb t1, 0(t0)            # newline
+  addi s0, s0, -1
+  j loop
+done:
+  sw zero, 12(t0)         # halt
+
+print:
+  sw a0, 8(t0)            # hex
+  li t1, 32
+  sb t1, 0(t0)            # space
+  ret
@@ -0,0 +1,39 @@
+# State a run leaves behind (run with --batch on several inputs): prints
+# a data word from the image, a word set by memset and a heap word, then
+# overwrites all three, and prints a heap word that was stored to, freed
+# and allocated again. Every run must print 7 0 0 0
+  li t0, 0x800
+  li s0, 0x400
+  lw t1, 0(s0)            # 7, from the image
+  sw t1, 4(t0)
+  li t1, 32
+  sw t1, 0(t0)
+  li t1, 1234
+  sw t1, 0(s0)
+  li a0, 0x600            # memset 16 bytes at 0x600
+  lw t1, 0(a0)
+  sw t1, 4(t0)
+  li t1, 32
+  sw t1, 0(t0)
+  li a1, 0x55
+  li a2, 16
+  sw zero, 0x3C(t0)
+  li t1, 64               # malloc, then store to the bank
+  sw t1, 0x30(t0)
+  mv s1, t3
+  lw t1, 0(s1)
+  sw t1, 4(t0)
+  li t1, 32
+  sw t1, 0(t0)
+  li t1, 99
+  sw t1, 0(s1)
+  sw s1, 0x34(t0)         # free it and allocate it again
+  li t1, 64
+  sw t1, 0x30(t0)
+  lw t1, 0(t3)
+  sw t1, 4(t0)
+  li t1, 10
+  sw t1, 0(t0)
+  sw zero, 0xC(t0)
+.data
+  .word 7
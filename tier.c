@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "helper.h"
+#include "cfg.h"
+#include "tier.h"
+
+// Instructions native code runs before control returns to the manager
+#define TIER_QUANTUM 10000
+
+static const char *tier_names[NUM_TIERS] = {"interp", "block", "native"};
+
+void tier_init(struct tier_manager *tm, const struct program *prog, const struct aot_module *aot,
+               int pinned, uint32_t threshold)
+{
+    memset(tm, 0, sizeof(struct tier_manager));
+    tm->program = prog;
+    tm->aot = aot;
+    tm->pinned = pinned;
+    tm->threshold = threshold > 0 ? threshold : 1;
+    tm->current = -1;
+    tm->bc = (struct block_cache *)malloc(sizeof(struct block_cache));
+    block_cache_init(tm->bc, prog);
+}
+
+void tier_free(struct tier_manager *tm) {
+    block_cache_free(tm->bc);
+    free(tm->bc);
+    tm->bc = NULL;
+}
+
+// Charges the time since the last switch to the tier running until now
+static void switch_tier(struct tier_manager *tm, int tier) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (tm->current >= 0) {
+        tm->nanoseconds[tm->current] += (uint64_t)(now.tv_sec - tm->since.tv_sec) * 1000000000 +
+                                        now.tv_nsec - tm->since.tv_nsec;
+    }
+    tm->current = tier;
+    tm->since = now;
+}
+
+// Interprets the rest of the block from the current pc
+static int interpret_block(const struct tier_manager *tm, struct vm *vm) {
+    int pc = vm->pc;
+    int count = 1;
+    if (pc >= 0 && pc < INST_MEM_SIZE && pc % 4 == 0) {
+        count = (cfg_block_at(&tm->program->cfg, pc)->end_pc - pc) / 4 + 1;
+    }
+    int status = VM_RUNNING;
+    for (int i = 0; i < count && status == VM_RUNNING && vm->instret < vm->instret_limit; i++) {
+        status = vm_step(vm);
+    }
+    return status;
+}
+
+// Whether the block at pc runs in the block engine and can never be
+// promoted out of it
+static int stays_in_block_tier(const struct tier_manager *tm, int pc) {
+    if (tm->pinned != TIER_AUTO) {
+        return tm->pinned == TIER_BLOCK;
+    }
+    return tm->aot == NULL && pc >= 0 && pc < INST_MEM_SIZE && pc % 4 == 0 &&
+           tm->tier[tm->program->cfg.block_of[pc / 4]] == TIER_BLOCK;
+}
+
+int tier_step(struct tier_manager *tm, struct vm *vm) {
+    int pc = vm->pc;
+    int index = -1;
+    int tier = TIER_INTERP;
+    if (pc >= 0 && pc < INST_MEM_SIZE && pc % 4 == 0) {
+        index = tm->program->cfg.block_of[pc / 4];
+        tier = tm->tier[index];
+    }
+    if (tm->pinned != TIER_AUTO) {
+        tier = tm->pinned;
+    }
+    if (tier != tm->current) {
+        switch_tier(tm, tier);
+    }
+
+    uint64_t start = vm->instret;
+    uint64_t limit = vm->instret_limit;
+    int status;
+    switch (tier) {
+        case TIER_BLOCK:
+            // chain blocks inside the block engine while no count is needed
+            do {
+                status = block_cache_step(tm->bc, vm);
+            } while (status == VM_RUNNING && vm->instret < limit && stays_in_block_tier(tm, vm->pc));
+            break;
+        case TIER_NATIVE:
+            // a quantum, or what is left of the caller's budget
+            vm->instret_limit = vm->instret + TIER_QUANTUM < limit ? vm->instret + TIER_QUANTUM : limit;
+            status = tm->aot->run(vm);
+            vm->instret_limit = limit;
+            break;
+        default:
+            status = tm->pinned == TIER_INTERP ? vm_run(vm) : interpret_block(tm, vm);
+    }
+    tm->instret[tier] += vm->instret - start;
+
+    // hot blocks move up a tier
+    int top = tm->aot != NULL ? TIER_NATIVE : TIER_BLOCK;
+    if (index >= 0 && tm->pinned == TIER_AUTO && tier < top && ++tm->count[index] >= tm->threshold) {
+        tm->tier[index]++;
+        tm->count[index] = 0;
+        tm->promotions[tier + 1]++;
+    }
+    return status;
+}
+
+int tier_run(struct tier_manager *tm, struct vm *vm) {
+    int status = VM_RUNNING;
+    while (status == VM_RUNNING && vm->instret < vm->instret_limit) {
+        status = tier_step(tm, vm);
+    }
+    switch_tier(tm, -1);
+    return status;
+}
+
+void tier_print_stats(const struct tier_manager *tm) {
+    for (int i = 0; i < NUM_TIERS; i++) {
+        if (i == TIER_NATIVE && tm->aot == NULL) {
+            continue;
+        }
+        fprintf(stderr, "Tier %s: %llu instructions, %.6f s", tier_names[i],
+                (unsigned long long)tm->instret[i], tm->nanoseconds[i] / 1e9);
+        if (i > TIER_INTERP) {
+            fprintf(stderr, ", %llu blocks promoted", (unsigned long long)tm->promotions[i]);
+        }
+        fprintf(stderr, "\n");
+    }
+    block_cache_print_stats(tm->bc);
+}
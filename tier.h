@@ -0,0 +1,66 @@
+#ifndef TIER_H
+#define TIER_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "aot.h"
+#include "block_cache.h"
+#include "program.h"
+#include "vm.h"
+
+#define TIER_AUTO -1
+#define TIER_INTERP 0       // vm_step, one instruction at a time
+#define TIER_BLOCK 1        // optimised, chained blocks (block_cache.h)
+#define TIER_NATIVE 2       // translated code (aot.h), only with a module
+#define NUM_TIERS 3
+
+#define TIER_DEFAULT_THRESHOLD 50
+
+/*
+    Tiered execution. Every block of the program's control-flow graph
+    starts in the interpreter with an execution counter; once the block
+    has been entered threshold times it moves up a tier, to the block
+    engine and, if a translated module was loaded, then to native code.
+    Native code runs a quantum of instructions at a time (the module
+    stops at the next block boundary), after which the manager looks at
+    the tier of wherever the guest has got to.
+
+    A pinned tier runs everything in that tier, for benchmarking.
+*/
+struct tier_manager {
+    const struct program *program;
+    struct block_cache *bc;
+    const struct aot_module *aot;   // NULL: no native tier
+    int pinned;                     // TIER_AUTO or the tier to stay in
+    uint32_t threshold;
+    uint32_t count[NUM_INSTRUCTIONS];   // entries, by cfg block
+    char tier[NUM_INSTRUCTIONS];        // current tier, by cfg block
+    // time is taken whenever execution moves between tiers
+    int current;                    // tier running now, -1 before the first
+    struct timespec since;
+    // statistics
+    uint64_t instret[NUM_TIERS];
+    uint64_t nanoseconds[NUM_TIERS];
+    uint64_t promotions[NUM_TIERS];     // blocks promoted into each tier
+};
+
+// Sets up tiering for prog. aot may be NULL, pinned is TIER_AUTO or a tier
+void tier_init(struct tier_manager *tm, const struct program *prog, const struct aot_module *aot,
+               int pinned, uint32_t threshold);
+
+// Runs vm until it stops or instret reaches vm->instret_limit (returning
+// VM_RUNNING), as vm_run does. Returns the vm status
+int tier_run(struct tier_manager *tm, struct vm *vm);
+
+// Runs the block at vm->pc in its tier (a quantum in native code, cut
+// short by vm->instret_limit), then promotes it if it has become hot.
+// Returns the vm status
+int tier_step(struct tier_manager *tm, struct vm *vm);
+
+// Prints instructions, time and promotions per tier to stderr
+void tier_print_stats(const struct tier_manager *tm);
+
+void tier_free(struct tier_manager *tm);
+
+#endif // TIER_H
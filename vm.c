@@ -0,0 +1,469 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "helper.h"
+#include "operations.h"
+#include "memory_handling.h"
+#include "program.h"
+#include "vm.h"
+#include "perf.h"
+#include "hart.h"
+#include "bulk.h"
+#include "metrics.h"
+#include "opcodes.h"
+
+// The state of a fresh instance of prog, all but its memory: the
+// callers point blob, reg_bank, virt_mem and heap at their own
+static void init_state(struct vm *vm, const struct program *prog) {
+    vm->program = prog;
+    vm->blob = NULL;
+    vm->blob_mapped = 0;
+    vm->decoded = prog->decoded;
+    vm->reg_bank = NULL;
+    vm->virt_mem = NULL;
+    vm->heap = NULL;
+    vm->hart_id = 0;
+    vm->harts = NULL;
+    vm->reservation = -1;
+    vm->reserved_value = 0;
+    vm->pc = 0;
+    vm->instret = 0;
+    vm->instret_limit = UINT64_MAX;
+    vm->console = NULL;
+    vm->metrics = NULL;
+    vm->program_id = prog->id;
+    vm->dirty_lines = 0;
+    vm->context = NULL;
+}
+
+void vm_init(struct vm *vm, const struct program *prog) {
+    init_state(vm, prog);
+    vm->blob = program_map_blob(prog, &vm->blob_mapped);
+    vm->reg_bank = (int *)calloc(REG_BANK_SIZE, sizeof(int));
+    vm->virt_mem = (char *)calloc(VIRT_MEM_SIZE, sizeof(char));
+    vm->heap = (struct heap *)malloc(sizeof(struct heap));
+    heap_init(vm->heap);
+}
+
+void vm_init_context(struct vm *vm, const struct program *prog, struct vm_context *ctx) {
+    init_state(vm, prog);
+    memcpy(&ctx->blob, prog->image, sizeof(struct blob));
+    memset(ctx->reg_bank, 0, sizeof(ctx->reg_bank));
+    memset(ctx->virt_mem, 0, sizeof(ctx->virt_mem));
+    heap_init_banks(&ctx->heap, ctx->banks);
+    vm->blob = &ctx->blob;
+    vm->reg_bank = ctx->reg_bank;
+    vm->virt_mem = ctx->virt_mem;
+    vm->heap = &ctx->heap;
+    vm->context = ctx;
+}
+
+void vm_reset(struct vm *vm, const struct program *prog) {
+    if (vm->program_id == prog->id) {
+        // instruction memory cannot be stored to, only the data memory
+        // lines written since the blob was mapped differ from the image
+        uint32_t all = ((uint32_t)1 << DATA_MEM_SIZE / DIRTY_LINE_SIZE) - 1;
+        for (uint32_t lines = vm->dirty_lines & all; lines != 0; lines &= lines - 1) {
+            int offset = __builtin_ctz(lines) * DIRTY_LINE_SIZE;
+            memcpy(&vm->blob->data_mem[offset], &prog->image->data_mem[offset], DIRTY_LINE_SIZE);
+        }
+    } else if (vm->context != NULL) {
+        memcpy(vm->blob, prog->image, sizeof(struct blob));
+        vm->program_id = prog->id;
+    } else {
+        program_unmap_blob(vm->blob, vm->blob_mapped);
+        vm->blob = program_map_blob(prog, &vm->blob_mapped);
+        vm->program_id = prog->id;
+    }
+    vm->dirty_lines = 0;
+    vm->program = prog;
+    vm->decoded = prog->decoded;
+    memset(vm->reg_bank, 0, REG_BANK_SIZE * sizeof(int));
+    memset(vm->virt_mem, 0, VIRT_MEM_SIZE);
+    heap_reset(vm->heap);
+    vm->reservation = -1;
+    vm->reserved_value = 0;
+    vm->pc = 0;
+    vm->instret = 0;
+    vm->instret_limit = UINT64_MAX;
+}
+
+void vm_init_hart(struct vm *vm, const struct vm *primary, int hart_id, struct hart_group *harts) {
+    init_state(vm, primary->program);
+    vm->blob = primary->blob;
+    vm->blob_mapped = primary->blob_mapped;
+    vm->decoded = primary->decoded;
+    vm->heap = primary->heap;
+    vm->program_id = primary->program_id;
+    vm->instret_limit = primary->instret_limit;
+    vm->reg_bank = (int *)calloc(REG_BANK_SIZE, sizeof(int));
+    vm->virt_mem = (char *)calloc(VIRT_MEM_SIZE, sizeof(char));
+    vm->hart_id = hart_id;
+    vm->harts = harts;
+    // read back through the hart id routine (0x0848)
+    memcpy(&vm->virt_mem[0x48], &hart_id, sizeof(int));
+}
+
+void vm_free(struct vm *vm) {
+    if (vm->context != NULL) {
+        heap_destroy(vm->heap);
+        return;
+    }
+    free(vm->reg_bank);
+    free(vm->virt_mem);
+    // other harts share hart 0's memory
+    if (vm->hart_id == 0) {
+        program_unmap_blob(vm->blob, vm->blob_mapped);
+        heap_destroy(vm->heap);
+        free(vm->heap);
+    }
+}
+
+// vm_mark_data for a store already checked to be in data memory. The
+// last byte of an unaligned one may set the bit past the last line,
+// which vm_reset ignores
+static inline __attribute__((always_inline)) void mark_store(struct vm *vm, int address, int size) {
+    unsigned offset = (uint16_t)address - 0x0400;
+    vm->dirty_lines |= 1u << offset / DIRTY_LINE_SIZE | 1u << (offset + size - 1) / DIRTY_LINE_SIZE;
+}
+
+// Snapshots the counter read at address (see vm.h) into virt_mem, where
+// the load then finds it
+static void read_counter(struct vm *vm, int address) {
+    uint64_t value;
+    struct timespec now;
+    switch (address) {
+        case COUNTER_INSTRET:
+            value = vm->instret;
+            break;
+        case COUNTER_TIME:
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            value = (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+            break;
+        case COUNTER_CYCLE:
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+            value = (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+            break;
+        default:    // a high word, read from the last snapshot
+            return;
+    }
+    memcpy(&vm->virt_mem[address - 0x0800], &value, sizeof(value));
+}
+
+/*
+    The cases of vm_execute's switch, expanded from RV32_OPERATIONS
+    (opcodes.h) by class. Each calls the operation's handler with the
+    operands its syntax names. Loads also get a case for each region
+    memory_operation_handling may send them to, stores one for the heap.
+    A handler that fails sends the instruction to the illegal operation
+    error.
+*/
+#define ALU_SYNTAX_R(handler) handler(reg_bank, inst.rd, inst.rs1, inst.rs2)
+#define ALU_SYNTAX_I(handler) handler(reg_bank, inst.rd, inst.rs1, inst.imm)
+#define ALU_SYNTAX_U(handler) handler(reg_bank, inst.rd, inst.imm)
+#define JUMP_SYNTAX_JUMP(handler) handler(reg_bank, &pc, inst.rd, inst.imm)
+#define JUMP_SYNTAX_MEM_RD(handler) handler(reg_bank, &pc, inst.rd, inst.rs1, inst.imm)
+
+#define FAIL_IF(failed)                                                         \
+    if (failed) {                                                               \
+        operation = OP_ILLEGAL;                                                 \
+        goto illegal;                                                           \
+    }
+
+#define EXECUTE_ALU(name, handler, syntax, funct3)                              \
+    case OP_##name:                                                             \
+        ALU_##syntax(handler);                                                  \
+        break;
+#define EXECUTE_MULDIV EXECUTE_ALU
+#define EXECUTE_LOAD(name, handler, syntax, funct3)                             \
+    case OP_##name:                                                             \
+        handler(reg_bank, blob->data_mem, inst.rd, inst.rs1, inst.imm);         \
+        break;                                                                  \
+    case OP_VIRTUAL_BASE + OP_##name:                                           \
+        handler(reg_bank, virt_mem, inst.rd, inst.rs1, inst.imm - 0x0400);      \
+        break;                                                                  \
+    case OP_INST_LOAD_BASE + OP_##name:                                         \
+        handler(reg_bank, blob->inst_mem, inst.rd, inst.rs1, inst.imm + 0x0400); \
+        break;                                                                  \
+    case OP_HEAP_BASE + OP_##name:                                              \
+        FAIL_IF(handler##_heap(reg_bank, heap, inst.rd, inst.rs1, inst.imm))    \
+        break;
+// funct3 of a store is log2 of its size
+#define EXECUTE_STORE(name, handler, syntax, funct3)                            \
+    case OP_##name:                                                             \
+        handler(reg_bank, blob->data_mem, inst.rs1, inst.rs2, inst.imm);        \
+        mark_store(vm, reg_bank[inst.rs1] + inst.imm, 1 << (funct3));           \
+        break;                                                                  \
+    case OP_HEAP_BASE + OP_##name:                                              \
+        FAIL_IF(handler##_heap(reg_bank, heap, inst.rs1, inst.rs2, inst.imm))   \
+        break;
+#define EXECUTE_BRANCH(name, handler, syntax, funct3)                           \
+    case OP_##name:                                                             \
+        handler(reg_bank, &pc, inst.rs1, inst.rs2, inst.imm);                   \
+        break;
+#define EXECUTE_JUMP(name, handler, syntax, funct3)                             \
+    case OP_##name:                                                             \
+        JUMP_##syntax(handler);                                                 \
+        break;
+// Only lr.w leaves memory as it was
+#define EXECUTE_ATOMIC(name, handler, syntax, funct3)                           \
+    case OP_##name: {                                                           \
+        int address = reg_bank[inst.rs1];                                       \
+        FAIL_IF(handler(reg_bank, blob->data_mem, heap, inst.rd, inst.rs1, inst.rs2, \
+                        &vm->reservation, &vm->reserved_value))                 \
+        if (OP_##name != OP_LR_W) {                                             \
+            vm_mark_data(vm, address, 4);                                       \
+        }                                                                       \
+        break;                                                                  \
+    }
+
+// Executes one instruction. Always inlined so vm_run's loop keeps
+// the hot state in registers instead of paying a call per instruction.
+// The block engine passes its own (optimised) copy of the instruction
+// and a hint from block_optimise, otherwise both are NULL. It counts a
+// block's instructions in instret before running them; ahead is how
+// many of them follow this one
+static inline __attribute__((always_inline)) int vm_execute(
+    struct vm *vm, 
+    const struct decoded_instruction *block_inst, 
+    int block_raw, 
+    const struct block_hint *hint,
+    int ahead
+) {
+    int *reg_bank = vm->reg_bank;
+    struct blob *blob = vm->blob;
+    char *virt_mem = vm->virt_mem;
+    int pc = vm->pc;
+    int instruction;
+    struct decoded_instruction inst;
+
+    // Fetch the pre-decoded instruction, pcs that are not word aligned
+    // (reachable through jalr) are decoded on the spot
+    if (block_inst != NULL) {
+        instruction = block_raw;
+        inst = *block_inst;
+    } else if (pc >= 0 && pc % 4 == 0) {
+        instruction = vm->program->raw[pc / 4];
+        inst = vm->decoded[pc / 4];
+    } else if (pc >= 0) {
+        instruction = get_instruction(blob->inst_mem, pc);
+        inst = decode_instruction(instruction);
+    } else {
+        instruction = 0;
+        inst.rd = inst.rs1 = inst.rs2 = 0;
+        inst.imm = 0;
+        inst.operation = OP_ILLEGAL;
+    }
+    if (block_inst == NULL) {
+        vm->instret++;
+    }
+    // the handlers below rewrite the operation number, unpack it once
+    int operation = inst.operation;
+
+    // Result is overwritten before it is read
+    if (hint != NULL && hint->kind == HINT_DEAD) {
+        vm->pc = pc + 4;
+        return vm->pc >= INST_MEM_SIZE ? VM_FINISHED : VM_RUNNING;
+    }
+
+    // // Debugging purposes
+    // printf("%02x\t%2d\t\t%2d\t%4s\t\tx%2d\t%08x %4d\t\tx%2d\t%08x %4d\t\tx%2d\t%08x %4d\t\ti  %d\n", 
+    //         pc, pc, operation, operation_name(operation), 
+    //         inst.rs1, reg_bank[inst.rs1], reg_bank[inst.rs1],
+    //         inst.rs2, reg_bank[inst.rs2], reg_bank[inst.rs2],
+    //         inst.rd, reg_bank[inst.rd], reg_bank[inst.rd],
+    //         inst.imm);
+
+    // Memory access operations
+    int perf_section = PERF_SECTION_LOOP;
+    if (operation >= OP_LB && operation <= OP_SW) {
+        int address = reg_bank[inst.rs1] + inst.imm;
+        int invalid = 0;
+        // virtual routines (console record and replay, the counters) see
+        // only the instructions retired so far
+        int uncounted = 0;
+        if (address >= 0x0800 && address < 0x0900) {
+            uncounted = ahead;
+            if (vm->metrics != NULL) {
+                vm->metrics->routine_calls[address - 0x0800]++;
+            }
+        }
+        if (uncounted) {
+            vm->instret -= uncounted;
+        }
+        // Attribute virtual routines and heap work to their own counters
+        if (perf_active) {
+            if (address == 0x0830 || address == 0x0834 || address >= BASE_ADDR) {
+                perf_section = PERF_SECTION_HEAP;
+            } else if (address >= 0x0800 && address < 0x0900) {
+                perf_section = PERF_SECTION_VIRTUAL;
+            }
+            perf_section_switch(perf_section);
+        }
+        // Known address: go straight to the region's handler
+        switch (hint != NULL ? hint->kind : HINT_NONE) {
+            case HINT_VIRTUAL:
+                virtual_routine_handling(address, reg_bank, blob->data_mem, inst.rs2, &pc, 
+                                         virt_mem, &operation, vm->heap, vm->console);
+                break;
+            case HINT_DATA:
+                break;
+            case HINT_INST_LOAD:
+                operation += OP_INST_LOAD_BASE;
+                break;
+            case HINT_HEAP:
+                operation += OP_HEAP_BASE;
+                break;
+            default:
+                invalid = memory_operation_handling(
+                    address, 
+                    reg_bank, 
+                    blob->data_mem,
+                    inst.rs2, 
+                    &pc, 
+                    virt_mem, 
+                    &operation,
+                    vm->heap,
+                    vm->console
+                );
+        }
+        if (operation >= OP_VIRTUAL_BASE + OP_LB && operation <= OP_VIRTUAL_BASE + OP_LHU) {
+            read_counter(vm, address);
+        }
+        if (uncounted) {
+            vm->instret += uncounted;
+        }
+        if (invalid) {
+            operation = OP_ILLEGAL;
+        } 
+        // CPU Halt Requested - termination without errors!
+        else if (address == 0x080C) {
+            return VM_HALTED;
+        }
+        // Waits for the other harts, see hart.h
+        else if (address == HART_BARRIER && vm->harts != NULL) {
+            hart_barrier(vm->harts);
+        }
+        // Bulk routines that wrote memory (see bulk.h), they leave
+        // OP_ILLEGAL if a range was invalid
+        else if (operation == OP_VIRTUAL_BASE && (address == BULK_MEMCPY || address == BULK_MEMSET)) {
+            vm_mark_data(vm, reg_bank[10], reg_bank[12]);
+        } else if (operation == OP_VIRTUAL_BASE && address == BULK_VADD) {
+            vm_mark_data(vm, reg_bank[10], reg_bank[13] * 4);
+        }
+    }
+
+    struct heap *heap = vm->heap;
+
+    // Program flow operation error handling
+    if (operation >= OP_SLT && operation <= OP_JAL) {
+        if (pc + inst.imm < 0 ||
+            pc + inst.imm > INST_MEM_SIZE ||
+            inst.imm % 4 != 0) 
+        {
+            operation = OP_ILLEGAL;
+        }
+    }
+
+    // Perform the operation
+    switch (operation) {
+#define X(number, name, mnemonic, handler, syntax, class, major, funct3, funct7) \
+        EXECUTE_##class(name, handler, syntax, funct3)
+        RV32_OPERATIONS(X)
+#undef X
+        /*
+            DEBUGGER
+        */
+        case VM_TRAP_OPERATION:
+            vm->instret--;
+            return VM_TRAP;
+        /* 
+            VIRTUAL ROUTINES, MALLOC AND FREE
+        */
+        case OP_VIRTUAL_BASE: // already executed
+        case OP_HEAP_BASE:
+            break;
+        /*
+            DEFAULT
+        */
+        default:
+        illegal:
+            if (operation == OP_ILLEGAL) {
+                console_printf(vm->console, "Illegal Operation: 0x%08x\n", instruction);
+            }
+            else {
+                console_printf(vm->console, "Instruction Not Implemented: 0x%08x\n", instruction);
+            }
+            console_printf(vm->console, "PC = 0x%08x;\n", pc);
+            for (int i=0; i<32; i++) {
+                console_printf(vm->console, "R[%d] = 0x%08x;\n", i, reg_bank[i]);
+            }
+            vm->pc = pc;
+            return VM_ERROR;
+    }
+
+    if (perf_section != PERF_SECTION_LOOP) {
+        perf_section_switch(PERF_SECTION_LOOP);
+    }
+
+    pc += 4;
+    reg_bank[0] = 0;
+    vm->pc = pc;
+
+    if (pc >= INST_MEM_SIZE) {
+        return VM_FINISHED;
+    }
+    return VM_RUNNING;
+}
+
+int vm_step(struct vm *vm) {
+    return vm_execute(vm, NULL, 0, NULL, 0);
+}
+
+int vm_run_block(
+    struct vm *vm, 
+    const struct decoded_instruction *insts, 
+    const int *raw, 
+    const struct block_hint *hints, 
+    int count
+) {
+    int status = VM_RUNNING;
+    int i = 0;
+    vm->instret += count;
+    while (i < count && status == VM_RUNNING) {
+        status = vm_execute(vm, &insts[i], raw[i], &hints[i], count - 1 - i);
+        i++;
+    }
+    // the guest stopped early
+    vm->instret -= count - i;
+    return status;
+}
+
+// vm_run counting the class of every instruction, a loop of its own so
+// the plain one pays nothing for it
+static int run_counting_classes(struct vm *vm) {
+    uint64_t *classes = vm->metrics->classes;
+    int status;
+    do {
+        int pc = vm->pc;
+        int operation = pc >= 0 && pc < INST_MEM_SIZE && pc % 4 == 0 ? vm->decoded[pc / 4].operation : 0;
+        uint64_t retired = vm->instret;
+        status = vm_execute(vm, NULL, 0, NULL, 0);
+        classes[metrics_class(operation)] += vm->instret - retired;
+    } while (status == VM_RUNNING && vm->instret < vm->instret_limit);
+    return status;
+}
+
+int vm_run(struct vm *vm) {
+    if (vm->metrics != NULL && vm->metrics->has_classes) {
+        return run_counting_classes(vm);
+    }
+    int status;
+    do {
+        status = vm_execute(vm, NULL, 0, NULL, 0);
+    } while (status == VM_RUNNING && vm->instret < vm->instret_limit);
+    return status;
+}
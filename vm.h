@@ -0,0 +1,144 @@
+#ifndef VM_H
+#define VM_H
+
+#include "helper.h"
+#include "program.h"
+#include "memory_handling.h"
+#include "console.h"
+#include "block_opt.h"
+
+// Status returned by vm_step and vm_run
+#define VM_RUNNING 0
+#define VM_HALTED 1     // CPU Halt Requested
+#define VM_FINISHED 2   // pc ran past the end of instruction memory
+#define VM_ERROR 3      // illegal operation or unimplemented instruction
+#define VM_TRAP 4       // reached an instruction patched to VM_TRAP_OPERATION
+
+// Operation number a debugger patches into vm->decoded to regain control.
+// The instruction is not executed, the vm stops before it with VM_TRAP
+#define VM_TRAP_OPERATION 600
+
+// Data memory is tracked in lines of this many bytes, one bit of
+// vm->dirty_lines each, so vm_reset only restores the lines written
+#define DIRTY_LINE_SIZE 64
+
+/*
+    Counter routines, read-only. A load from a counter's address takes a
+    snapshot of the 64-bit value and returns its low word, a load from
+    the address + 4 returns the high word of the last snapshot:
+
+    0x0850 instret: instructions this hart has retired, the load included
+    0x0858 time: host monotonic clock, in nanoseconds
+    0x0860 cycle: estimated cycles of this hart, the CPU time of its
+                  host thread in nanoseconds (a 1 GHz guest clock)
+
+    Only differences between two reads of time and cycle are meaningful.
+*/
+#define COUNTER_INSTRET 0x0850
+#define COUNTER_TIME 0x0858
+#define COUNTER_CYCLE 0x0860
+
+struct hart_group;
+struct metrics;
+
+/*
+    Everything an instance owns, in one block: its registers, virtual
+    routine memory, private copy of the image and heap, banks included.
+    Each part starts on its own cache line. Instances created with
+    vm_init_context keep their state here instead of in separate
+    allocations, arenas (see arena.h) lay these out side by side.
+*/
+#define VM_CACHE_LINE 64
+
+struct vm_context {
+    int reg_bank[REG_BANK_SIZE] __attribute__((aligned(VM_CACHE_LINE)));
+    char virt_mem[VIRT_MEM_SIZE] __attribute__((aligned(VM_CACHE_LINE)));
+    struct blob blob __attribute__((aligned(VM_CACHE_LINE)));
+    struct heap heap __attribute__((aligned(VM_CACHE_LINE)));
+    MemoryBank banks[NUM_BANKS] __attribute__((aligned(VM_CACHE_LINE)));
+};
+
+/*
+    State of one VM instance. The program (image and pre-decoded
+    instructions) is shared, everything else belongs to the instance.
+*/
+struct vm {
+    const struct program *program;
+    struct blob *blob;          // copy-on-write view of program->image
+    // instructions fetched by vm_step and vm_run, program->decoded unless
+    // a debugger has patched a private copy (see debug.h)
+    const struct decoded_instruction *decoded;
+    char blob_mapped;
+    int *reg_bank;
+    char *virt_mem;
+    struct heap *heap;
+    // harts started by hart.c share the blob and heap of hart 0
+    int hart_id;
+    struct hart_group *harts;   // NULL for a single hart
+    int reservation;            // address reserved by lr.w, -1 if none
+    int32_t reserved_value;
+    int pc;
+    uint64_t instret;           // retired-instruction count
+    // vm_run returns VM_RUNNING once instret reaches this, and translated
+    // code (--aot) at the first block boundary after. UINT64_MAX by default
+    uint64_t instret_limit;
+    struct console *console;    // console input and output, NULL uses stdin and stdout
+    uint64_t program_id;        // program->id the blob was mapped for
+    uint32_t dirty_lines;       // data memory lines written since then
+    struct metrics *metrics;    // run being measured, NULL unless --metrics (see metrics.h)
+    struct vm_context *context; // holds the state above, NULL if it is allocated
+};
+
+// Creates a fresh instance of prog
+void vm_init(struct vm *vm, const struct program *prog);
+
+// vm_init with the instance's state in ctx, which must outlive it. The
+// image is copied into ctx rather than mapped
+void vm_init_context(struct vm *vm, const struct program *prog, struct vm_context *ctx);
+
+// Turns an instance of any program into a fresh instance of prog,
+// reusing its allocations. The console is kept. Resetting to the same
+// program only restores the data memory lines and heap banks the guest
+// wrote, so the cost follows what the last run touched
+void vm_reset(struct vm *vm, const struct program *prog);
+
+// Records a write of size bytes at address, ignoring any part outside
+// data memory
+static inline void vm_mark_data(struct vm *vm, int address, int size) {
+    int64_t first = (int64_t)address - 0x0400;
+    int64_t last = first + size - 1;
+    if (size <= 0 || last < 0 || first >= DATA_MEM_SIZE) {
+        return;
+    }
+    first = first < 0 ? 0 : first / DIRTY_LINE_SIZE;
+    last = last >= DATA_MEM_SIZE ? DATA_MEM_SIZE / DIRTY_LINE_SIZE - 1 : last / DIRTY_LINE_SIZE;
+    vm->dirty_lines |= (uint32_t)(((uint64_t)2 << last) - ((uint64_t)1 << first));
+}
+
+// Creates another hart of primary, with its own registers and pc but
+// sharing primary's memory and heap. primary must outlive it
+void vm_init_hart(struct vm *vm, const struct vm *primary, int hart_id, struct hart_group *harts);
+
+// Executes the instruction at the current pc
+int vm_step(struct vm *vm);
+
+// Executes the count instructions of a block starting at the current pc,
+// stopping early if the guest stops. insts and hints come from block_optimise
+int vm_run_block(
+    struct vm *vm, 
+    const struct decoded_instruction *insts, 
+    const int *raw, 
+    const struct block_hint *hints, 
+    int count
+);
+
+// Runs until the guest halts, errors or runs off the end of instruction
+// memory, or until instret reaches instret_limit (returning VM_RUNNING).
+// Counts instruction classes into vm->metrics if it has them
+// (see metrics.h)
+int vm_run(struct vm *vm);
+
+// Frees all memory owned by the instance
+void vm_free(struct vm *vm);
+
+#endif // VM_H
@@ -1,357 +1,834 @@
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <stdint.h>
-
-#include "helper.h"
-#include "operations.h"
-#include "memory_handling.h"
-
-// // Debugging purposes
-// const char *operation_to_string(int operation) {
-//     operation -= 1;
-//     static const char *instructions[] = {
-//         "ADD", "ADDI",  "SUB", "LUI",
-//         "XOR", "XORI", "OR", "ORI", "AND", "ANDI",
-//         "SLL", "SRL", "SRA", "LB", "LH",
-//         "LW", "LBU", "LHU", "SB", "SH", "SW",
-//         "SLT", "SLTI", "SLTU", "SLTIU", "BEQ", "BNE",
-//         "BLT", "BLTU", "BGE", "BGEU", "JAL", "JALR"
-//     };
-
-//     if (operation >= 0 && operation < sizeof(instructions) / sizeof(instructions[0])) {
-//         return instructions[operation];
-//     } else {
-//         return "Unknown";
-//     }
-// }
+#include <string.h>
+#include <time.h>
 
+#include "aot.h"
+#include "arena.h"
+#include "block_cache.h"
+#include "bundle.h"
+#include "console.h"
+#include "daemon.h"
+#include "debug.h"
+#include "hart.h"
+#include "lockstep.h"
+#include "metrics.h"
+#include "perf.h"
+#include "program.h"
+#include "tier.h"
+#include "vm.h"
 
-int main(int argc, char *argv[]) {
-    // exit if there is not exactly 1 arg
-    if (argc != 2) {
-        printf("Usage: ./vm_riskxvii <arg>\n");
-        return 1;
-    }
+#define ENGINE_SWITCH 0     // one instruction at a time
+#define ENGINE_BLOCK 1      // chained basic blocks, see block_cache.h
+#define ENGINE_AOT 2        // ahead-of-time translated image, see aot.h
+#define ENGINE_TIERED 3     // interpreter, then blocks, then --aot code, see tier.h
+#define ENGINE_LOCKSTEP 4   // batch inputs side by side in vector lanes, see lockstep.h
 
-    struct blob *blob = (struct blob *)malloc(sizeof(struct blob));
+#define MAX_WORKERS 1024
 
-    // argument is the path to a binary file, open it
-    FILE *file = fopen(argv[1], "r");
-    // exit if file is null
-    if (file == NULL) {
+struct options {
+    int batch;
+    int stats;              // print instruction count and MIPS to stderr
+    int perf_counters;      // print hardware performance counters to stderr
+    int engine;             // ENGINE_SWITCH, ENGINE_BLOCK, ENGINE_AOT, ENGINE_TIERED or ENGINE_LOCKSTEP
+    int lanes;              // instances run together by ENGINE_LOCKSTEP
+    int workers;            // threads running a batch, 0 for one run after another
+    int tier;               // tier pinned by --tier, TIER_AUTO otherwise
+    uint32_t tier_threshold;
+    const char *aot;        // shared object translated from the image
+    struct aot_module aot_module;
+    const char *record;     // log consumed input to this file
+    const char *replay;     // feed input from this log
+    const char *debug;      // debugger socket, see debug.h
+    const char *debug_script;   // debugger commands from a file
+    int harts;              // harts sharing memory, see hart.h
+    const char *bundle;     // run the entries of this bundle, see bundle.h
+    const char *daemon;     // serve jobs on this socket, see daemon.h
+    int pool;
+    int cache;
+    const char *metrics;            // write the run metrics as JSON to this file
+    const char *metrics_prometheus; // and as a Prometheus textfile to this one
+    struct metrics_report *report;  // the runs so far, NULL without either
+};
+
+// Runs prog on input, or on the current stdin if input is NULL, in vm,
+// which is reset first: runs one after another reuse the same instance,
+// and the reset only undoes what the previous run wrote. The run is added
+// to opts->report as name. Returns 1 on error
+static int run_instance(struct vm *vm, const struct program *prog, const struct options *opts,
+                        const char *input, size_t input_size, const char *name) {
+    struct console console;
+    vm_reset(vm, prog);
+    console_init(&console, &vm->instret);
+    if (input != NULL) {
+        console_buffer(&console, input, input_size);
+    }
+    if (opts->record != NULL && console_record(&console, opts->record)) {
+        printf("Could not open file.\n");
+        return 1;
+    }
+    if (opts->replay != NULL && console_replay(&console, opts->replay)) {
         printf("Could not open file.\n");
-        free(blob);
         return 1;
     }
+    vm->console = &console;
 
-    size_t readCount;
+    struct metrics job;
+    if (opts->report != NULL) {
+        metrics_start(&job, vm, name, 0);
+        // the engines that can count instruction classes
+        job.has_classes = opts->harts > 1 || opts->engine == ENGINE_BLOCK ||
+                          (opts->engine == ENGINE_SWITCH && opts->debug == NULL && opts->debug_script == NULL);
+    }
+    if (opts->perf_counters) {
+        perf_counters_start();
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int status;
+    struct block_cache *bc = NULL;
+    struct tier_manager *tm = NULL;
+    if (opts->harts > 1) {
+        status = harts_run(vm, opts->harts, opts->engine == ENGINE_BLOCK);
+    } else if (opts->engine == ENGINE_TIERED) {
+        tm = (struct tier_manager *)malloc(sizeof(struct tier_manager));
+        tier_init(tm, prog, opts->aot != NULL ? &opts->aot_module : NULL, opts->tier, opts->tier_threshold);
+        status = tier_run(tm, vm);
+    } else if (opts->engine == ENGINE_BLOCK) {
+        bc = (struct block_cache *)malloc(sizeof(struct block_cache));
+        block_cache_init(bc, prog);
+        status = block_cache_run(bc, vm);
+    } else if (opts->engine == ENGINE_AOT) {
+        status = opts->aot_module.run(vm);
+    } else if (opts->debug != NULL || opts->debug_script != NULL) {
+        struct debugger *dbg = (struct debugger *)malloc(sizeof(struct debugger));
+        if (opts->debug != NULL ? debug_open_socket(dbg, opts->debug) : debug_open_script(dbg, opts->debug_script)) {
+            fprintf(stderr, "Could not start the debugger.\n");
+            status = VM_ERROR;
+        } else {
+            status = debug_run(dbg, vm);
+        }
+        debug_close(dbg);
+        free(dbg);
+    } else {
+        status = vm_run(vm);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (opts->perf_counters) {
+        fflush(stdout);
+        perf_counters_stop(vm->instret);
+    }
 
-    // read the first 1024 bytes into instruction memory
-    readCount = fread(blob->inst_mem, 1, INST_MEM_SIZE, file);
-    if(readCount != INST_MEM_SIZE){
-        printf("Error: Unable to read instruction memory from file.\n");
-        free(blob);
-        fclose(file);
-        return 1;
+    if (opts->stats) {
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        fflush(stdout);
+        fprintf(stderr, "Instructions: %llu\n", (unsigned long long)vm->instret);
+        fprintf(stderr, "Time: %.6f s\n", seconds);
+        fprintf(stderr, "MIPS: %.2f\n", seconds > 0 ? vm->instret / seconds / 1e6 : 0.0);
+        if (bc != NULL) {
+            block_cache_print_stats(bc);
+        }
+        if (tm != NULL) {
+            tier_print_stats(tm);
+        }
+    }
+
+    if (opts->report != NULL) {
+        if (bc != NULL) {
+            block_cache_count_classes(bc, vm, status, job.classes);
+        }
+        metrics_stop(&job, vm, status, 0);
+        metrics_report_add(opts->report, &job);
     }
 
-    // read the next 1024 bytes into data memory
-    readCount = fread(blob->data_mem, 1, DATA_MEM_SIZE, file);
-    if(readCount != DATA_MEM_SIZE){
-        printf("Error: Unable to read data memory from file.\n");
-        free(blob);
-        fclose(file);
+    if (bc != NULL) {
+        block_cache_free(bc);
+        free(bc);
+    }
+    if (tm != NULL) {
+        tier_free(tm);
+        free(tm);
+    }
+
+    console_close(&console);
+    vm->console = NULL;
+    return status == VM_ERROR;
+}
+
+// Runs the named entries of the bundle at path, or all of them if there
+// are no names, one after another. Returns 1 on error
+static int run_bundle(const char *path, char **names, int count, const struct options *opts) {
+    struct bundle b;
+    int error = bundle_open(&b, path);
+    if (error != BUNDLE_OK) {
+        printf(error == BUNDLE_OPEN_FAILED ? "Could not open file.\n" : "Error: %s is not a valid bundle.\n", path);
         return 1;
     }
-    
+    int failed = 0;
+    int entries = count > 0 ? count : (int)b.header->entry_count;
+    // the entries in run order, and the last run of each image, after
+    // which its decoded program is freed
+    int *order = (int *)malloc(entries * sizeof(int));
+    int *last = (int *)malloc(b.header->image_count * sizeof(int));
+    for (int i = 0; i < entries; i++) {
+        order[i] = count > 0 ? bundle_find(&b, names[i]) : i;
+        if (order[i] >= 0) {
+            last[b.entries[order[i]].image] = i;
+        }
+    }
+    // one instance for every entry, vm_reset maps another image when
+    // the entry's differs
+    struct vm vm;
+    int started = 0;
+    for (int i = 0; i < entries; i++) {
+        int entry = order[i];
+        if (entry < 0) {
+            printf("Error: No entry %s in %s.\n", names[i], path);
+            failed = 1;
+            continue;
+        }
+        size_t input_size;
+        const char *input = bundle_input(&b, entry, &input_size);
+        const struct program *prog = bundle_program(&b, entry);
+        if (!started) {
+            vm_init(&vm, prog);
+            started = 1;
+        }
+        const struct bundle_entry *e = &b.entries[entry];
+        char name[METRICS_NAME_SIZE];
+        snprintf(name, sizeof(name), "%.*s", (int)e->name_size, b.data + e->name_offset);
+        failed |= run_instance(&vm, prog, opts, input, input_size, name);
+        fflush(stdout);
+        if (last[e->image] == i) {
+            bundle_release(&b, entry);
+        }
+    }
+    if (started) {
+        vm_free(&vm);
+    }
+    free(order);
+    free(last);
+    if (opts->stats) {
+        fprintf(stderr, "Bundle: %d entries run, %u unique images\n", entries, b.header->image_count);
+    }
+    bundle_close(&b);
+    return failed;
+}
+
+// Reads the whole file at path, NULL if it cannot be opened
+static char *read_file(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    size_t capacity = 4096;
+    char *data = (char *)malloc(capacity);
+    *size = 0;
+    size_t n;
+    while ((n = fread(data + *size, 1, capacity - *size, file)) > 0) {
+        *size += n;
+        if (*size == capacity) {
+            capacity *= 2;
+            data = (char *)realloc(data, capacity);
+        }
+    }
     fclose(file);
+    return data;
+}
+
+// Batch mode on the lockstep engine: runs prog on the input files
+// opts->lanes at a time and prints their outputs in order, as batch
+// mode does one by one. Returns 1 on error
+static int run_lockstep_batch(const struct program *prog, const struct options *opts, char **inputs, int count) {
+    struct vm lanes[LOCKSTEP_LANES];
+    struct console consoles[LOCKSTEP_LANES];
+    char *buffers[LOCKSTEP_LANES];
+    int status[LOCKSTEP_LANES];
+    int lane_of[LOCKSTEP_LANES];    // lane of each input of the window, -1 if unreadable
+    // per lane, without instruction classes
+    struct metrics *jobs = NULL;
+    if (opts->report != NULL) {
+        jobs = (struct metrics *)malloc(LOCKSTEP_LANES * sizeof(struct metrics));
+    }
+    // regs is vector aligned, beyond what malloc guarantees
+    struct lockstep *ls = (struct lockstep *)aligned_alloc(_Alignof(struct lockstep), sizeof(struct lockstep));
+    lockstep_init(ls);
+    for (int l = 0; l < opts->lanes; l++) {
+        vm_init(&lanes[l], prog);
+    }
+
+    if (opts->perf_counters) {
+        perf_counters_start();
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int failed = 0;
+    uint64_t instret = 0;
+    for (int first = 0; first < count; first += opts->lanes) {
+        int window = count - first < opts->lanes ? count - first : opts->lanes;
+        int used = 0;
+        for (int i = 0; i < window; i++) {
+            size_t size;
+            char *input = read_file(inputs[first + i], &size);
+            lane_of[i] = input != NULL ? used : -1;
+            if (input == NULL) {
+                continue;
+            }
+            struct vm *vm = &lanes[used];
+            vm_reset(vm, prog);
+            console_init(&consoles[used], &vm->instret);
+            console_buffer(&consoles[used], input, size);
+            console_capture_spilling(&consoles[used]);
+            vm->console = &consoles[used];
+            if (jobs != NULL) {
+                metrics_start(&jobs[used], vm, inputs[first + i], 0);
+            }
+            buffers[used++] = input;
+        }
+        lockstep_run(ls, lanes, used, status);
+        // the lanes ran together, each is charged the whole window's time
+        for (int l = 0; jobs != NULL && l < used; l++) {
+            metrics_stop(&jobs[l], &lanes[l], status[l], 0);
+            metrics_report_add(opts->report, &jobs[l]);
+        }
+
+        for (int i = 0; i < window; i++) {
+            int l = lane_of[i];
+            if (l < 0) {
+                printf("Could not open file.\n");
+                failed = 1;
+                continue;
+            }
+            console_write_output(&consoles[l], stdout);
+            if (consoles[l].output_truncated) {
+                fprintf(stderr, "%s: Output truncated.\n", inputs[first + i]);
+            }
+            failed |= status[l] == VM_ERROR;
+            instret += lanes[l].instret;
+        }
+        fflush(stdout);
+        for (int l = 0; l < used; l++) {
+            console_close(&consoles[l]);
+            lanes[l].console = NULL;
+            free(buffers[l]);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (opts->perf_counters) {
+        perf_counters_stop(instret);
+    }
+
+    if (opts->stats) {
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        fprintf(stderr, "Instructions: %llu\n", (unsigned long long)instret);
+        fprintf(stderr, "Time: %.6f s\n", seconds);
+        fprintf(stderr, "MIPS: %.2f\n", seconds > 0 ? instret / seconds / 1e6 : 0.0);
+        lockstep_print_stats(ls);
+    }
+
+    for (int l = 0; l < opts->lanes; l++) {
+        vm_free(&lanes[l]);
+    }
+    free(ls);
+    free(jobs);
+    return failed;
+}
+
+// A batch input run by a worker, see run_parallel_batch
+struct batch_job {
+    struct console console;     // output captured, spilling past the limit
+    char unreadable;
+    char done;
+    int status;
+    uint64_t instret;
+};
+
+// Inputs handed out to the workers. They take at most window inputs past
+// the last one printed, so finished outputs waiting on a slow earlier
+// one stay few
+struct batch_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;     // an input finished or was printed
+    int next;                   // next input to take
+    int printed;                // inputs printed so far
+    int window;
+    int count;
+};
+
+// The arenas of a parallel batch, one per NUMA node shared by the
+// workers on it (one for all of them without libnuma), each mapped by
+// the first of its workers to start and with a slot for every worker
+struct batch_arena {
+    int node;                       // -1 if unknown
+    int mapped;
+    struct arena arena;
+};
+
+struct batch_arenas {
+    pthread_mutex_t lock;
+    struct batch_arena *list;
+    int count;
+    int slots;
+};
+
+struct batch_worker {
+    int index;
+    const struct program *prog;
+    const struct options *opts;
+    char **inputs;
+    struct batch_queue *queue;
+    struct batch_arenas *arenas;
+    struct batch_job *jobs;
+    struct metrics *metrics;        // by input, NULL unless --metrics
+    pthread_t thread;
+    char started;
+    int cpu;                        // pinned to, -1 if not
+    int pages;                      // of its arena, -1 if it has none
+    int node;
+};
+
+// The next input for a worker, waiting while it is too far ahead of the
+// printed ones. count once there are none left
+static int batch_take(struct batch_queue *q) {
+    pthread_mutex_lock(&q->lock);
+    while (q->next < q->count && q->next >= q->printed + q->window) {
+        pthread_cond_wait(&q->changed, &q->lock);
+    }
+    int i = q->next < q->count ? q->next++ : q->count;
+    pthread_mutex_unlock(&q->lock);
+    return i;
+}
 
-    // initialize the program counter (PC) and other necessary variables
-    // note that memory and instructions have been initialised already
-    int pc = 0;
-    char *virt_mem = (char *)malloc(VIRT_MEM_SIZE * sizeof(char));
-    int *reg_bank = (int *)malloc(REG_BANK_SIZE * sizeof(int));
-    for (int i = 0; i < REG_BANK_SIZE; i++) {
-        reg_bank[i] = 0;
+// The arena of node, mapped on first use. NULL if it cannot be mapped
+static struct arena *batch_arena_of(struct batch_arenas *arenas, int node) {
+    pthread_mutex_lock(&arenas->lock);
+    struct batch_arena *a = NULL;
+    for (int i = 0; i < arenas->count && a == NULL; i++) {
+        if (arenas->list[i].node == node) {
+            a = &arenas->list[i];
+        }
     }
-    for (int i=0; i<VIRT_MEM_SIZE; i++) {
-        virt_mem[i] = 0;
+    if (a == NULL) {
+        a = &arenas->list[arenas->count++];
+        a->node = node;
+        a->mapped = arena_init(&a->arena, arenas->slots, node) == 0;
     }
+    pthread_mutex_unlock(&arenas->lock);
+    return a->mapped ? &a->arena : NULL;
+}
 
-    // linked-list storing the heap bank
-    // head points to NULL
-    MemoryBank *head = NULL;
+// Runs inputs on one instance, in the arena of the node the worker is
+// pinned to, so its memory is local
+static void *batch_worker_thread(void *arg) {
+    struct batch_worker *w = (struct batch_worker *)arg;
+    w->cpu = arena_pin_thread(w->index);
+    struct arena *arena = batch_arena_of(w->arenas, arena_node_of_cpu(w->cpu));
+    struct vm_context *ctx = NULL;
+    w->pages = -1;
+    w->node = -1;
+    if (arena != NULL) {
+        ctx = arena_alloc(arena);
+        w->pages = arena->pages;
+        w->node = arena->node;
+    }
+    struct vm vm;
+    if (ctx != NULL) {
+        vm_init_context(&vm, w->prog, ctx);
+    } else {
+        vm_init(&vm, w->prog);
+    }
 
-    int is_terminated = 0;
+    for (int i = batch_take(w->queue); i < w->queue->count; i = batch_take(w->queue)) {
+        struct batch_job *job = &w->jobs[i];
+        size_t size;
+        char *input = read_file(w->inputs[i], &size);
+        if (input == NULL) {
+            job->unreadable = 1;
+        } else {
+            vm_reset(&vm, w->prog);
+            console_init(&job->console, &vm.instret);
+            console_buffer(&job->console, input, size);
+            console_capture_spilling(&job->console);
+            vm.console = &job->console;
+            if (w->metrics != NULL) {
+                metrics_start(&w->metrics[i], &vm, w->inputs[i], 1);
+                w->metrics[i].has_classes = 1;
+            }
+            if (w->opts->engine == ENGINE_BLOCK) {
+                struct block_cache *bc = (struct block_cache *)malloc(sizeof(struct block_cache));
+                block_cache_init(bc, w->prog);
+                job->status = block_cache_run(bc, &vm);
+                if (w->metrics != NULL) {
+                    block_cache_count_classes(bc, &vm, job->status, w->metrics[i].classes);
+                }
+                block_cache_free(bc);
+                free(bc);
+            } else {
+                job->status = vm_run(&vm);
+            }
+            if (w->metrics != NULL) {
+                metrics_stop(&w->metrics[i], &vm, job->status, 1);
+            }
+            job->instret = vm.instret;
+            // the console keeps the output until it is printed
+            vm.console = NULL;
+            free(input);
+        }
+        pthread_mutex_lock(&w->queue->lock);
+        job->done = 1;
+        pthread_cond_broadcast(&w->queue->changed);
+        pthread_mutex_unlock(&w->queue->lock);
+    }
 
-    // main loop
-    while (!is_terminated) {
-        // Get the instruction at the current PC
-        int instruction = get_instruction(blob->inst_mem, pc);
+    vm_free(&vm);
+    if (ctx != NULL) {
+        arena_release(arena, ctx);
+    }
+    return NULL;
+}
 
-        // Decode the instruction
-        struct decoded_instruction inst = decode_instruction(instruction);
+// Batch mode on opts->workers threads (--workers), each pinned to its
+// own CPU and taking inputs in turn. Each output is printed, as batch
+// mode does, once it and every earlier input have run. Returns 1 on error
+static int run_parallel_batch(const struct program *prog, const struct options *opts, char **inputs, int count) {
+    static const char *page_names[] = {"normal", "huge", "transparent huge"};
+    struct batch_job *jobs = (struct batch_job *)calloc(count, sizeof(struct batch_job));
+    struct metrics *metrics = NULL;
+    if (opts->report != NULL) {
+        metrics = (struct metrics *)calloc(count, sizeof(struct metrics));
+    }
+    struct batch_worker *workers = (struct batch_worker *)calloc(opts->workers, sizeof(struct batch_worker));
+    struct batch_queue queue = {.next = 0, .printed = 0, .window = 4 * opts->workers, .count = count};
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.changed, NULL);
+    struct batch_arenas arenas = {.count = 0, .slots = opts->workers};
+    arenas.list = (struct batch_arena *)calloc(opts->workers, sizeof(struct batch_arena));
+    pthread_mutex_init(&arenas.lock, NULL);
 
-        // // Debugging purposes
-        // printf("%02x\t%2d\t\t%2d\t%4s\t\tx%2d\t%08x %4d\t\tx%2d\t%08x %4d\t\tx%2d\t%08x %4d\t\ti  %d\n", 
-        //         pc, pc, inst.operation, operation_to_string(inst.operation), 
-        //         inst.rs1, reg_bank[inst.rs1], reg_bank[inst.rs1],
-        //         inst.rs2, reg_bank[inst.rs2], reg_bank[inst.rs2],
-        //         inst.rd, reg_bank[inst.rd], reg_bank[inst.rd],
-        //         inst.imm);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int failed = 0;
+    int started = 0;
+    for (int i = 0; i < opts->workers; i++) {
+        struct batch_worker *w = &workers[i];
+        w->index = i;
+        w->prog = prog;
+        w->opts = opts;
+        w->inputs = inputs;
+        w->queue = &queue;
+        w->arenas = &arenas;
+        w->jobs = jobs;
+        w->metrics = metrics;
+        w->started = pthread_create(&w->thread, NULL, batch_worker_thread, w) == 0;
+        if (!w->started) {
+            fprintf(stderr, "Could not start worker %d.\n", i);
+            failed = 1;
+        }
+        started += w->started;
+    }
 
-        // if inst.rd, inst.rs1, inst.rs2 are out of bounds
-        if (inst.rd > 31 || inst.rs1 > 31 || inst.rs2 > 31) {
-            inst.operation = 500;
+    uint64_t instret = 0;
+    for (int i = 0; i < count && started > 0; i++) {
+        pthread_mutex_lock(&queue.lock);
+        while (!jobs[i].done) {
+            pthread_cond_wait(&queue.changed, &queue.lock);
         }
+        pthread_mutex_unlock(&queue.lock);
 
-        // Memory access operations
-        if (inst.operation > 13 && inst.operation < 22) {
-            int address = reg_bank[inst.rs1] + inst.imm;
-            if (memory_operation_handling(
-                address, 
-                reg_bank, 
-                blob->data_mem,
-                inst.rs2, 
-                &pc, 
-                virt_mem, 
-                &(inst.operation),
-                &head
-            )) {
-                inst.operation = 500;
-            } 
-            // CPU Halt Requested - termination without errors!
-            else if (address == 0x080C) {
-                break;
+        if (jobs[i].unreadable) {
+            printf("Could not open file.\n");
+            failed = 1;
+        } else {
+            console_write_output(&jobs[i].console, stdout);
+            if (jobs[i].console.output_truncated) {
+                fprintf(stderr, "%s: Output truncated.\n", inputs[i]);
+            }
+            console_close(&jobs[i].console);
+            failed |= jobs[i].status == VM_ERROR;
+            instret += jobs[i].instret;
+            if (metrics != NULL) {
+                metrics_report_add(opts->report, &metrics[i]);
             }
         }
+        fflush(stdout);
+
+        pthread_mutex_lock(&queue.lock);
+        queue.printed = i + 1;
+        pthread_cond_broadcast(&queue.changed);
+        pthread_mutex_unlock(&queue.lock);
+    }
+    for (int i = 0; i < opts->workers; i++) {
+        if (workers[i].started) {
+            pthread_join(workers[i].thread, NULL);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
 
-        // Program flow operation error handling
-        if (inst.operation > 21 && inst.operation < 33) {
-            if (pc + inst.imm < 0 ||
-                pc + inst.imm > INST_MEM_SIZE ||
-                inst.imm % 4 != 0) 
-            {
-                inst.operation = 500;
+    if (opts->stats) {
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        int pinned = 0;
+        for (int i = 0; i < opts->workers; i++) {
+            pinned += workers[i].cpu >= 0;
+        }
+        fprintf(stderr, "Instructions: %llu\n", (unsigned long long)instret);
+        fprintf(stderr, "Time: %.6f s\n", seconds);
+        fprintf(stderr, "MIPS: %.2f\n", seconds > 0 ? instret / seconds / 1e6 : 0.0);
+        fprintf(stderr, "Workers: %d, %d pinned\n", opts->workers, pinned);
+        fprintf(stderr, "Arenas: %d\n", arenas.count);
+        for (int i = 0; i < opts->workers; i++) {
+            const struct batch_worker *w = &workers[i];
+            fprintf(stderr, "Worker %d: cpu %d, arena on %s pages, ", i, w->cpu,
+                    w->pages >= 0 ? page_names[w->pages] : "no");
+            if (w->node >= 0) {
+                fprintf(stderr, "NUMA node %d\n", w->node);
+            } else {
+                fprintf(stderr, "first-touch placement\n");
             }
         }
+    }
 
-        // Perform the operation
-        switch (inst.operation) {
-            /*
-                ARITHMETIC AND LOGIC OPERATIONS
-            */
-            case 1: // ADD
-                add(reg_bank, inst.rd, inst.rs1, inst.rs2);
-                break;
-            case 2: // ADDI
-                addi(reg_bank, inst.rd, inst.rs1, inst.imm);
-                break;
-            case 3: // SUB
-                sub(reg_bank, inst.rd, inst.rs1, inst.rs2);
-                break;
-            case 4: // LUI
-                lui(reg_bank, inst.rd, inst.imm);
-                break;
-            case 5: // XOR
-                xor_reg(reg_bank, inst.rd, inst.rs1, inst.rs2);
-                break;
-            case 6: // XORI
-                xori(reg_bank, inst.rd, inst.rs1, inst.imm);
-                break;
-            case 7: // OR
-                or_reg(reg_bank, inst.rd, inst.rs1, inst.rs2);
-                break;
-            case 8: // ORI
-                ori(reg_bank, inst.rd, inst.rs1, inst.imm);
-                break;
-            case 9: // AND
-                and_reg(reg_bank, inst.rd, inst.rs1, inst.rs2);
-                break;
-            case 10: // ANDI
-                andi(reg_bank, inst.rd, inst.rs1, inst.imm);
-                break;
-            case 11: // SLL
-                sll(reg_bank, inst.rd, inst.rs1, inst.rs2);
-                break;
-            case 12: // SRL
-                srl(reg_bank, inst.rd, inst.rs1, inst.rs2);
-                break;
-            case 13: // SRA
-                sra(reg_bank, inst.rd, inst.rs1, inst.rs2);
-                break;
-            /*
-                MEMORY ACCESS OPERATIONS
-            */
-            case 14: // LB
-                lb(reg_bank, blob->data_mem, inst.rd, inst.rs1, inst.imm);
-                break;
-            case 15: // LH
-                lh(reg_bank, blob->data_mem, inst.rd, inst.rs1, inst.imm);
-                break;
-            case 16: // LW
-                lw(reg_bank, blob->data_mem, inst.rd, inst.rs1, inst.imm);
-                break;
-            case 17: // LBU
-                lbu(reg_bank, blob->data_mem, inst.rd, inst.rs1, inst.imm);
-                break;
-            case 18: // LHU
-                lhu(reg_bank, blob->data_mem, inst.rd, inst.rs1, inst.imm);
-                break;
-            case 19: // SB
-                sb(reg_bank, blob->data_mem, inst.rs1, inst.rs2, inst.imm);
-                break;
-            case 20: // SH
-                sh(reg_bank, blob->data_mem, inst.rs1, inst.rs2, inst.imm);
-                break;
-            case 21: // SW
-                sw(reg_bank, blob->data_mem, inst.rs1, inst.rs2, inst.imm);
-                break;
-            /*
-                PROGRAM FLOW OPERATIONS
-            */
-            case 22: // SLT
-                slt(reg_bank, inst.rd, inst.rs1, inst.rs2);
-                break;
-            case 23: // SLTI
-                slti(reg_bank, inst.rd, inst.rs1, inst.imm);
-                break;
-            case 24: // SLTU
-                sltu(reg_bank, inst.rd, inst.rs1, inst.rs2);
-                break;
-            case 25: // SLTIU
-                sltiu(reg_bank, inst.rd, inst.rs1, inst.imm);
-                break;
-            case 26: // BEQ
-                beq(reg_bank, &pc, inst.rs1, inst.rs2, inst.imm);
-                break;
-            case 27: // BNE
-                bne(reg_bank, &pc, inst.rs1, inst.rs2, inst.imm);
-                break;
-            case 28: // BLT
-                blt(reg_bank, &pc, inst.rs1, inst.rs2, inst.imm);
-                break;
-            case 29: // BLTU
-                bltu(reg_bank, &pc, inst.rs1, inst.rs2, inst.imm);
-                break;
-            case 30: // BGE
-                bge(reg_bank, &pc, inst.rs1, inst.rs2, inst.imm);
-                break;
-            case 31: // BGEU
-                bgeu(reg_bank, &pc, inst.rs1, inst.rs2, inst.imm);
-                break;
-            case 32: // JAL
-                jal(reg_bank, &pc, inst.rd, inst.imm);
-                break;
-            case 33: // JALR
-                jalr(reg_bank, &pc, inst.rd, inst.rs1, inst.imm);
-                break;
-            /* 
-                VIRTUAL ROUTINES
-            */
-            case 100: // Virtual Routine, already exectued
-                break;
-            case 114: // LB
-                lb(reg_bank, virt_mem, inst.rd, inst.rs1, inst.imm - 0x0400);
-                break;
-            case 115: // LH
-                lh(reg_bank, virt_mem, inst.rd, inst.rs1, inst.imm - 0x0400);
-                break;
-            case 116: // LW
-                lw(reg_bank, virt_mem, inst.rd, inst.rs1, inst.imm - 0x0400);
-                break;
-            case 117: // LBU
-                lbu(reg_bank, virt_mem, inst.rd, inst.rs1, inst.imm - 0x0400);
-                break;
-            case 118: // LHU
-                lhu(reg_bank, virt_mem, inst.rd, inst.rs1, inst.imm - 0x0400);
-                break;
-            /*
-                MEMORY ACCESS TO INSTRUCTION MEMORY
-            */
-            case 214: // LB
-                lb(reg_bank, blob->inst_mem, inst.rd, inst.rs1, inst.imm + 0x0400);
-                break;
-            case 215: // LH
-                lh(reg_bank, blob->inst_mem, inst.rd, inst.rs1, inst.imm + 0x0400);
-                break;
-            case 216: // LW
-                lw(reg_bank, blob->inst_mem, inst.rd, inst.rs1, inst.imm + 0x0400);
-                break;
-            case 217: // LBU
-                lbu(reg_bank, blob->inst_mem, inst.rd, inst.rs1, inst.imm + 0x0400);
-                break;
-            case 218: // LHU
-                lhu(reg_bank, blob->inst_mem, inst.rd, inst.rs1, inst.imm + 0x0400);
-                break;
-            /*
-                MEMORY ACCESS TO HEAP BANK
-            */
-            case 400: // Malloc or free
-                break;
-            case 414: // LB
-                if (lb_heap(reg_bank, head, inst.rd, inst.rs1, inst.imm)) {
-                    break;
-                }
-            case 415: // LH
-                if (!lh_heap(reg_bank, head, inst.rd, inst.rs1, inst.imm)) {
-                    break;
-                }
-            case 416: // LW
-                if (!lw_heap(reg_bank, head, inst.rd, inst.rs1, inst.imm)) {
-                    break;
-                }
-            case 417: // LBU
-                if (!lbu_heap(reg_bank, head, inst.rd, inst.rs1, inst.imm)) {
-                    break;
-                }
-            case 418: // LHU
-                if (!lhu_heap(reg_bank, head, inst.rd, inst.rs1, inst.imm)) {
-                    break;
-                }
-            case 419: // SB
-                if (!sb_heap(reg_bank, head, inst.rs1, inst.rs2, inst.imm)) {
-                    break;
-                }
-            case 420: // SH
-                if (!sh_heap(reg_bank, head, inst.rs1, inst.rs2, inst.imm)) {
-                    break;
-                }
-            case 421: // SW
-                if (!sw_heap(reg_bank, head, inst.rs1, inst.rs2, inst.imm)) {
-                    break;
-                }
-            /*
-                DEFAULT
-            */
-            default:
-                // Heap bank issues
-                if ((inst.operation > 399 && inst.operation < 422) || inst.operation == 500) {
-                    printf("Illegal Operation: 0x%08x\n", instruction);
-                }
-                else {
-                    printf("Instruction Not Implemented: 0x%08x\n", instruction);
-                }
-                printf("PC = 0x%08x;\n", pc);
-                for (int i=0; i<32; i++) {
-                    printf("R[%d] = 0x%08x;\n", i, reg_bank[i]);
+    for (int i = 0; i < arenas.count; i++) {
+        if (arenas.list[i].mapped) {
+            arena_free(&arenas.list[i].arena);
+        }
+    }
+    free(arenas.list);
+    pthread_mutex_destroy(&arenas.lock);
+    pthread_cond_destroy(&queue.changed);
+    pthread_mutex_destroy(&queue.lock);
+    free(workers);
+    free(metrics);
+    free(jobs);
+    return failed;
+}
+
+// Writes the report to the --metrics files and frees it. Returns failed,
+// or 1 if a file could not be written
+static int write_metrics(const struct options *opts, int failed) {
+    if (opts->report == NULL) {
+        return failed;
+    }
+    if (opts->metrics != NULL && metrics_write_json(opts->report, opts->metrics)) {
+        fprintf(stderr, "Could not write %s.\n", opts->metrics);
+        failed = 1;
+    }
+    if (opts->metrics_prometheus != NULL && metrics_write_prometheus(opts->report, opts->metrics_prometheus)) {
+        fprintf(stderr, "Could not write %s.\n", opts->metrics_prometheus);
+        failed = 1;
+    }
+    metrics_report_free(opts->report);
+    return failed;
+}
+
+static void usage(void) {
+    printf("Usage: ./vm_riskxvii <arg>\n");
+    printf("       ./vm_riskxvii [options] [--record <log> | --replay <log>] <image>\n");
+    printf("       ./vm_riskxvii [options] --batch <image> <input>...\n");
+    printf("Options: --stats, --perf-counters, --engine switch|block|tiered|lockstep, --aot <image.so>,\n");
+    printf("         --tier interp|block|native, --tier-threshold <n>,\n");
+    printf("         --debug <socket>, --debug-script <file>, --harts <n>, --lanes <n>,\n");
+    printf("         --metrics <file>, --metrics-prometheus <file>, --workers <n>\n");
+    printf("       ./vm_riskxvii [options] --bundle <bundle> [<entry>...]\n");
+    printf("       ./vm_riskxvii --daemon <socket> [--pool <n>] [--cache <n>] [--metrics ...]\n");
+}
+
+int main(int argc, char *argv[]) {
+    struct options opts = {0};
+    opts.tier = TIER_AUTO;
+    opts.tier_threshold = TIER_DEFAULT_THRESHOLD;
+    opts.harts = 1;
+    opts.lanes = LOCKSTEP_DEFAULT_LANES;
+    opts.pool = DAEMON_DEFAULT_POOL;
+    opts.cache = DAEMON_DEFAULT_CACHE;
+    int argi = 1;
+
+    // leading options
+    while (argi < argc && strncmp(argv[argi], "--", 2) == 0) {
+        if (strcmp(argv[argi], "--batch") == 0) {
+            // --batch runs one image against several input files, sharing
+            // the loaded and pre-decoded image between the instances
+            opts.batch = 1;
+        } else if (strcmp(argv[argi], "--stats") == 0) {
+            opts.stats = 1;
+        } else if (strcmp(argv[argi], "--perf-counters") == 0) {
+            opts.perf_counters = 1;
+        } else if (strcmp(argv[argi], "--engine") == 0 && argi + 1 < argc) {
+            argi++;
+            if (strcmp(argv[argi], "switch") == 0) {
+                opts.engine = ENGINE_SWITCH;
+            } else if (strcmp(argv[argi], "block") == 0) {
+                opts.engine = ENGINE_BLOCK;
+            } else if (strcmp(argv[argi], "tiered") == 0) {
+                opts.engine = ENGINE_TIERED;
+            } else if (strcmp(argv[argi], "lockstep") == 0) {
+                opts.engine = ENGINE_LOCKSTEP;
+            } else {
+                usage();
+                return 1;
+            }
+        } else if (strcmp(argv[argi], "--aot") == 0 && argi + 1 < argc) {
+            // under --engine tiered the module is the native tier
+            if (opts.engine != ENGINE_TIERED) {
+                opts.engine = ENGINE_AOT;
+            }
+            opts.aot = argv[++argi];
+        } else if (strcmp(argv[argi], "--tier") == 0 && argi + 1 < argc) {
+            // pins a tier of the tiered engine, for benchmarking
+            static const char *tiers[NUM_TIERS] = {"interp", "block", "native"};
+            argi++;
+            opts.tier = TIER_AUTO;
+            for (int i = 0; i < NUM_TIERS; i++) {
+                if (strcmp(argv[argi], tiers[i]) == 0) {
+                    opts.tier = i;
                 }
-                error_and_free(reg_bank, blob, virt_mem, head);
+            }
+            if (opts.tier == TIER_AUTO) {
+                usage();
+                return 1;
+            }
+            opts.engine = ENGINE_TIERED;
+        } else if (strcmp(argv[argi], "--tier-threshold") == 0 && argi + 1 < argc) {
+            opts.tier_threshold = (uint32_t)strtoul(argv[++argi], NULL, 10);
+        } else if (strcmp(argv[argi], "--harts") == 0 && argi + 1 < argc) {
+            opts.harts = atoi(argv[++argi]);
+        } else if (strcmp(argv[argi], "--lanes") == 0 && argi + 1 < argc) {
+            opts.lanes = atoi(argv[++argi]);
+        } else if (strcmp(argv[argi], "--workers") == 0 && argi + 1 < argc) {
+            opts.workers = atoi(argv[++argi]);
+        } else if (strcmp(argv[argi], "--bundle") == 0 && argi + 1 < argc) {
+            opts.bundle = argv[++argi];
+        } else if (strcmp(argv[argi], "--daemon") == 0 && argi + 1 < argc) {
+            opts.daemon = argv[++argi];
+        } else if (strcmp(argv[argi], "--pool") == 0 && argi + 1 < argc) {
+            opts.pool = atoi(argv[++argi]);
+        } else if (strcmp(argv[argi], "--cache") == 0 && argi + 1 < argc) {
+            opts.cache = atoi(argv[++argi]);
+        } else if (strcmp(argv[argi], "--metrics") == 0 && argi + 1 < argc) {
+            opts.metrics = argv[++argi];
+        } else if (strcmp(argv[argi], "--metrics-prometheus") == 0 && argi + 1 < argc) {
+            opts.metrics_prometheus = argv[++argi];
+        } else if (strcmp(argv[argi], "--record") == 0 && argi + 1 < argc) {
+            opts.record = argv[++argi];
+        } else if (strcmp(argv[argi], "--replay") == 0 && argi + 1 < argc) {
+            opts.replay = argv[++argi];
+        } else if (strcmp(argv[argi], "--debug") == 0 && argi + 1 < argc) {
+            opts.debug = argv[++argi];
+        } else if (strcmp(argv[argi], "--debug-script") == 0 && argi + 1 < argc) {
+            opts.debug_script = argv[++argi];
+        } else {
+            usage();
+            return 1;
+        }
+        argi++;
+    }
+
+    struct metrics_report report;
+    if (opts.metrics != NULL || opts.metrics_prometheus != NULL) {
+        metrics_report_init(&report);
+        opts.report = &report;
+    }
+
+    // images and input come with each job
+    if (opts.daemon != NULL) {
+        if (argi != argc || opts.pool < 1 || opts.cache < 1) {
+            usage();
+            return 1;
+        }
+        if (daemon_run(opts.daemon, opts.pool, opts.cache, opts.metrics, opts.metrics_prometheus)) {
+            printf("Could not listen on %s.\n", opts.daemon);
+            return 1;
+        }
+        return 0;
+    }
+
+    // entries bring their own image and input
+    if (opts.bundle != NULL) {
+        if (opts.batch || opts.record != NULL || opts.replay != NULL || opts.aot != NULL ||
+            opts.debug != NULL || opts.debug_script != NULL || opts.engine == ENGINE_LOCKSTEP ||
+            (opts.harts > 1 && opts.engine > ENGINE_BLOCK))
+        {
+            usage();
+            return 1;
         }
+        return write_metrics(&opts, run_bundle(opts.bundle, &argv[argi], argc - argi, &opts));
+    }
+
+    // exit if there is not exactly 1 arg (or an image and inputs in batch mode)
+    int args = argc - argi;
+    if ((!opts.batch && args != 1) || (opts.batch && args < 2) ||
+        (opts.record != NULL && opts.replay != NULL) ||
+        (opts.batch && (opts.record != NULL || opts.replay != NULL)) ||
+        (opts.tier == TIER_NATIVE && opts.aot == NULL) ||
+        // lockstep runs the inputs of a batch side by side
+        (opts.engine == ENGINE_LOCKSTEP && (!opts.batch || opts.aot != NULL)) ||
+        opts.lanes < 1 || opts.lanes > LOCKSTEP_LANES ||
+        // workers run a batch on the switch or block engine, one hart each,
+        // and perf counters only follow the main thread
+        opts.workers < 0 || opts.workers > MAX_WORKERS ||
+        (opts.workers > 0 && (!opts.batch || opts.engine > ENGINE_BLOCK || opts.aot != NULL || opts.harts > 1 ||
+                              opts.perf_counters)) ||
+        // harts run the switch or block engine, with nondeterministic timing
+        opts.harts < 1 || opts.harts > MAX_HARTS ||
+        (opts.harts > 1 && (opts.engine > ENGINE_BLOCK || opts.record != NULL || opts.replay != NULL ||
+                            opts.debug != NULL || opts.debug_script != NULL)) ||
+        // the debugger drives the switch interpreter of a single instance
+        ((opts.debug != NULL || opts.debug_script != NULL) &&
+         (opts.batch || opts.engine != ENGINE_SWITCH || (opts.debug != NULL && opts.debug_script != NULL)))) 
+    {
+        usage();
+        return 1;
+    }
 
-        pc += 4;
-        reg_bank[0] = 0;
+    // argument is the path to a binary file, load it
+    struct program *prog = (struct program *)malloc(sizeof(struct program));
+    int error = program_load(prog, argv[argi]);
+    if (error != PROGRAM_OK) {
+        program_print_error(error);
+        free(prog);
+        return 1;
+    }
 
-        if (pc >= INST_MEM_SIZE) {
-            is_terminated = 1;
+    if (opts.aot != NULL) {
+        error = aot_load(&opts.aot_module, opts.aot, prog);
+        if (error != AOT_OK) {
+            printf(error == AOT_IMAGE_MISMATCH ? "Error: %s was translated from a different image.\n"
+                                               : "Error: Unable to load %s.\n", opts.aot);
+            program_free(prog);
+            free(prog);
+            return 1;
         }
     }
 
-    // Program finished without errors
-    free(reg_bank);
-    free(blob);
-    free(virt_mem);
-    heap_free_all(head);
-    return 0;
+    if (opts.engine == ENGINE_LOCKSTEP || opts.workers > 0) {
+        int failed = opts.workers > 0 ? run_parallel_batch(prog, &opts, &argv[argi + 1], argc - argi - 1)
+                                      : run_lockstep_batch(prog, &opts, &argv[argi + 1], argc - argi - 1);
+        program_free(prog);
+        free(prog);
+        return write_metrics(&opts, failed);
+    }
+
+    int failed = 0;
+    struct vm vm;
+    vm_init(&vm, prog);
+    if (!opts.batch) {
+        failed = run_instance(&vm, prog, &opts, NULL, 0, "");
+    } else {
+        for (int i = argi + 1; i < argc; i++) {
+            if (freopen(argv[i], "r", stdin) == NULL) {
+                printf("Could not open file.\n");
+                failed = 1;
+                continue;
+            }
+            failed |= run_instance(&vm, prog, &opts, NULL, 0, argv[i]);
+            fflush(stdout);
+        }
+    }
+    vm_free(&vm);
 
-}
\ No newline at end of file
+    aot_unload(&opts.aot_module);
+    program_free(prog);
+    free(prog);
+    return write_metrics(&opts, failed);
+}